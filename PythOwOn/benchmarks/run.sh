@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+# Runs every benchmark script in this directory with each PythOwOn binary given, and prints
+# the best wall-clock time of several runs. A script whose output differs between the
+# binaries is flagged, so that a faster build giving the wrong answer doesn't go unnoticed.
+#
+# usage: run.sh [-n runs] binary...
+#
+# To compare two versions, build each one and pass both binaries. The dispatch comparison
+# of VM::Run needs a second Release build with SWITCH_DISPATCH defined.
+#
+#   loop_local.pwn   typed while loop over function locals, 10M iterations
+#   loop_global.pwn  the same loop over globals
+#   loop_range.pwn   `for i in 0..10000000`
+#   fib30.pwn        recursive fib(30), for call and return overhead
+#   calls.pwn        two small functions called 3M times each from a while loop
+
+set -euo pipefail
+
+runs=5
+if [[ "${1:-}" == "-n" ]]; then
+    runs=$2
+    shift 2
+fi
+
+if [[ $# -eq 0 ]]; then
+    echo "usage: $0 [-n runs] binary..." >&2
+    exit 1
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+TIMEFORMAT=%R
+status=0
+
+printf "%-16s" "benchmark"
+for binary in "$@"; do printf "  %12s" "$(basename "$binary")"; done
+printf "\n"
+
+for script in "$here"/*.pwn; do
+    printf "%-16s" "$(basename "$script")"
+    expected=""
+
+    for binary in "$@"; do
+        output=$("$binary" -r "$script" 2>&1) || true
+        if [[ -z "$expected" ]]; then expected=$output; fi
+
+        best=""
+        for ((i = 0; i < runs; i++)); do
+            time=$({ time "$binary" -r "$script" > /dev/null 2>&1; } 2>&1)
+            if [[ -z "$best" ]] || awk "BEGIN { exit !($time < $best) }"; then best=$time; fi
+        done
+
+        if [[ "$output" == "$expected" ]]; then
+            printf "  %11ss" "$best"
+        else
+            printf "  %12s" "WRONG OUTPUT"
+            status=1
+        fi
+    done
+
+    printf "\n"
+done
+
+exit $status
@@ -0,0 +1,84 @@
+#include "AotRuntime.hpp"
+
+#include <algorithm>
+
+#include "Common.hpp"
+
+
+uint8_t AotRuntime::run(const AotFunction script, const uint32_t scriptDepth,
+                        const uint32_t functionDepth) {
+    vm.ReserveStack(scriptDepth, functionDepth);
+    frames.clear();
+    frames.reserve(VM::FRAMES_MAX);
+    frames.push_back({nullptr, 0});
+
+    return runFrame(script, vm.state.stack.begin()) ? InterpretResult::OK
+                                                     : InterpretResult::RUNTIME_ERROR;
+}
+
+// Tail calls come back here to be run in the frame they left.
+bool AotRuntime::runFrame(AotFunction code, Value* slots) {
+    while (code(*this, slots)) {
+        if (tailCallee == nullptr) return true;
+        code = tailCallee->native;
+        tailCallee = nullptr;
+    }
+
+    return false;
+}
+
+bool AotRuntime::call(Value* callee, const uint8_t argCount, const size_t line) {
+    if (!callee->isObjectType(ObjType::FUNCTION)) return error(line, "Can only call functions.");
+
+    const ObjFunction* function = callee->object()->asFunction();
+    if (argCount != function->arity) {
+        return error(line, FMT_FORMAT("Expected {} arguments but got {}.", function->arity,
+                                      argCount));
+    }
+    if (frames.size() == VM::FRAMES_MAX) return error(line, "Stack overflow.");
+
+    frames.back().line = line;
+    frames.push_back({function, 0});
+    const bool ok = runFrame(function->native, callee);
+    frames.pop_back();
+    return ok;
+}
+
+bool AotRuntime::tailCall(Value* slots, const Value* callee, const uint8_t argCount,
+                          const size_t line) {
+    if (!callee->isObjectType(ObjType::FUNCTION)) return error(line, "Can only call functions.");
+
+    const ObjFunction* function = callee->object()->asFunction();
+    if (argCount != function->arity) {
+        return error(line, FMT_FORMAT("Expected {} arguments but got {}.", function->arity,
+                                      argCount));
+    }
+
+    std::copy(callee, callee + argCount + 1, slots);
+    frames.back().function = function;
+    tailCallee = function;
+    return true;
+}
+
+Value* AotRuntime::global(const Value name, const size_t line) {
+    const ObjString* string = name.object()->asString();
+    const auto found = vm.state.globals.find(*string);
+    if (found == vm.state.globals.end()) {
+        error(line, FMT_FORMAT("Undefined variable '{}'.", string->str));
+        return nullptr;
+    }
+
+    return &found->second;
+}
+
+bool AotRuntime::error(const size_t line, const std::string& message) {
+    FMT_PRINT("{}\n", message);
+
+    frames.back().line = line;
+    for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame) {
+        if (frame->function == nullptr) { FMT_PRINTLN("[line {}] in script", frame->line); }
+        else { FMT_PRINTLN("[line {}] in {}()", frame->line, frame->function->name->str); }
+    }
+
+    return false;
+}
@@ -1,10 +1,94 @@
 #include "Chunk.hpp"
 
+#include <algorithm>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 #include "Common.hpp"
 
 
+const char* OpCode::name(const Code code) {
+    // In the order Code declares them.
+    static constexpr const char* names[] = {
+        "CONSTANT",
+        "CONSTANT_LONG",
+        "NONE",
+        "TRUE",
+        "FALSE",
+        "POP",
+        "POPN",
+        "GET_LOCAL",
+        "GET_LOCAL_LONG",
+        "SET_LOCAL",
+        "SET_LOCAL_LONG",
+        "GET_GLOBAL",
+        "GET_GLOBAL_LONG",
+        "DEF_GLOBAL",
+        "DEF_GLOBAL_LONG",
+        "SET_GLOBAL",
+        "SET_GLOBAL_LONG",
+        "EQUAL",
+        "GREATER",
+        "LESS",
+        "ADD",
+        "SUBTRACT",
+        "MULTIPLY",
+        "DIVIDE",
+        "LEFTSHIFT",
+        "RIGHTSHIFT",
+        "MODULO",
+        "NEGATE",
+        "ADD_INT",
+        "ADD_DOUBLE",
+        "SUBTRACT_INT",
+        "SUBTRACT_DOUBLE",
+        "MULTIPLY_INT",
+        "MULTIPLY_DOUBLE",
+        "LESS_INT",
+        "LESS_DOUBLE",
+        "GREATER_INT",
+        "GREATER_DOUBLE",
+        "ADD_INT_INT",
+        "ADD_DOUBLE_DOUBLE",
+        "LESS_INT_INT",
+        "LESS_DOUBLE_DOUBLE",
+        "GREATER_INT_INT",
+        "GREATER_DOUBLE_DOUBLE",
+        "GET_GLOBAL_CACHED",
+        "LOOP_JIT",
+        "CONCAT_STR",
+        "CHECK_TYPE",
+        "BUILD_STRING",
+        "AND",
+        "OR",
+        "NOT",
+        "PRINT",
+        "JUMP",
+        "JUMP_FALSE",
+        "JUMP_LONG",
+        "JUMP_FALSE_LONG",
+        "LOOP",
+        "LOOP_LONG",
+        "JUMP_TRUE",
+        "JUMP_BACK",
+        "FOR_RANGE",
+        "DUP",
+        "INC",
+        "DEC",
+        "CALL",
+        "TAIL_CALL",
+        "FIBER",
+        "RESUME",
+        "YIELD",
+        "RETURN",
+    };
+    static_assert(std::size(names) == RETURN + 1);
+
+    return code <= RETURN ? names[code] : "UNKNOWN";
+}
+
 void Chunk::write(uint8_t byte, size_t line) {
     code.emplace_back(byte);
     lines.emplace_back(line);
@@ -51,9 +135,405 @@ void Chunk::writeVariable(OpCode::Code op, const uint32_t var, const size_t line
 }
 
 
-#if defined(_DEBUG)
+size_t Chunk::instructionSize(const size_t offset) const {
+    switch (code[offset]) {
+        case OpCode::CONSTANT:
+        case OpCode::POPN:
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::GET_GLOBAL:
+        case OpCode::GET_GLOBAL_CACHED:
+        case OpCode::DEF_GLOBAL:
+        case OpCode::SET_GLOBAL:
+        case OpCode::CHECK_TYPE:
+        case OpCode::BUILD_STRING:
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::FIBER: return 2;
+
+        case OpCode::JUMP:
+        case OpCode::JUMP_FALSE:
+        case OpCode::JUMP_TRUE:
+        case OpCode::LOOP:
+        case OpCode::LOOP_JIT:
+        case OpCode::JUMP_BACK: return 3;
+
+        case OpCode::FOR_RANGE: return 4;
+
+        case OpCode::CONSTANT_LONG:
+        case OpCode::GET_LOCAL_LONG:
+        case OpCode::SET_LOCAL_LONG:
+        case OpCode::GET_GLOBAL_LONG:
+        case OpCode::DEF_GLOBAL_LONG:
+        case OpCode::SET_GLOBAL_LONG:
+        case OpCode::JUMP_LONG:
+        case OpCode::JUMP_FALSE_LONG:
+        case OpCode::LOOP_LONG: return 5;
+
+        default: return 1;
+    }
+}
+
+// @formatter:off
+// clang-format off
+int32_t Chunk::stackEffect(const size_t offset) const {
+    switch (code[offset]) {
+        case OpCode::CONSTANT:
+        case OpCode::CONSTANT_LONG:
+        case OpCode::NONE:
+        case OpCode::TRUE:
+        case OpCode::FALSE:
+        case OpCode::GET_LOCAL:
+        case OpCode::GET_LOCAL_LONG:
+        case OpCode::GET_GLOBAL:
+        case OpCode::GET_GLOBAL_LONG:
+        case OpCode::GET_GLOBAL_CACHED:
+        case OpCode::DUP:             return 1;
+
+        case OpCode::POP:
+        case OpCode::DEF_GLOBAL:
+        case OpCode::DEF_GLOBAL_LONG:
+        case OpCode::EQUAL:
+        case OpCode::GREATER:
+        case OpCode::LESS:
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::LEFTSHIFT:
+        case OpCode::RIGHTSHIFT:
+        case OpCode::MODULO:
+        case OpCode::ADD_INT:
+        case OpCode::ADD_DOUBLE:
+        case OpCode::SUBTRACT_INT:
+        case OpCode::SUBTRACT_DOUBLE:
+        case OpCode::MULTIPLY_INT:
+        case OpCode::MULTIPLY_DOUBLE:
+        case OpCode::LESS_INT:
+        case OpCode::LESS_DOUBLE:
+        case OpCode::GREATER_INT:
+        case OpCode::GREATER_DOUBLE:
+        case OpCode::ADD_INT_INT:
+        case OpCode::ADD_DOUBLE_DOUBLE:
+        case OpCode::LESS_INT_INT:
+        case OpCode::LESS_DOUBLE_DOUBLE:
+        case OpCode::GREATER_INT_INT:
+        case OpCode::GREATER_DOUBLE_DOUBLE:
+        case OpCode::CONCAT_STR:
+        case OpCode::AND:
+        case OpCode::OR:
+        case OpCode::PRINT:
+        case OpCode::YIELD:
+        case OpCode::RETURN:          return -1;
+
+        case OpCode::POPN:            return -code[offset + 1];
+        case OpCode::BUILD_STRING:    return 1 - code[offset + 1];
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::FIBER:           return -code[offset + 1];
+
+        default:                      return 0;
+    }
+}
+// clang-format on
+// @formatter:on
+
+// @formatter:off
+// clang-format off
+uint32_t Chunk::stackInputs(const size_t offset) const {
+    switch (code[offset]) {
+        case OpCode::POP:
+        case OpCode::SET_LOCAL:
+        case OpCode::SET_LOCAL_LONG:
+        case OpCode::DEF_GLOBAL:
+        case OpCode::DEF_GLOBAL_LONG:
+        case OpCode::SET_GLOBAL:
+        case OpCode::SET_GLOBAL_LONG:
+        case OpCode::NEGATE:
+        case OpCode::CHECK_TYPE:
+        case OpCode::NOT:
+        case OpCode::PRINT:
+        case OpCode::JUMP_FALSE:
+        case OpCode::JUMP_TRUE:
+        case OpCode::DUP:
+        case OpCode::INC:
+        case OpCode::DEC:
+        case OpCode::RESUME:
+        case OpCode::YIELD:           return 1;
+
+        case OpCode::EQUAL:
+        case OpCode::GREATER:
+        case OpCode::LESS:
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::LEFTSHIFT:
+        case OpCode::RIGHTSHIFT:
+        case OpCode::MODULO:
+        case OpCode::ADD_INT:
+        case OpCode::ADD_DOUBLE:
+        case OpCode::SUBTRACT_INT:
+        case OpCode::SUBTRACT_DOUBLE:
+        case OpCode::MULTIPLY_INT:
+        case OpCode::MULTIPLY_DOUBLE:
+        case OpCode::LESS_INT:
+        case OpCode::LESS_DOUBLE:
+        case OpCode::GREATER_INT:
+        case OpCode::GREATER_DOUBLE:
+        case OpCode::CONCAT_STR:      return 2;
+
+        case OpCode::POPN:
+        case OpCode::BUILD_STRING:    return code[offset + 1];
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::FIBER:           return code[offset + 1] + 1u;
+
+        // The script's RETURN may find the stack empty; a function's always finds at
+        // least its callee slot, since a frame never pops below its arguments.
+        default:                      return 0;
+    }
+}
+// clang-format on
+// @formatter:on
+
+// A single forward pass is enough: the compiler only emits structured control flow,
+// so every forward jump into a point is seen before the point itself, and the code
+// after an unconditional jump is always the target of an earlier one. Code from a file
+// need not be like that, so loaded chunks take their depth from verify instead.
+int32_t Chunk::followStackDepth(const size_t end, const int32_t entryDepth,
+                                int32_t& maxDepth) const {
+    std::unordered_map<size_t, int32_t> targetDepths;
+    int32_t depth = entryDepth;
+    maxDepth = entryDepth;
+
+    for (size_t offset = 0; offset < end; offset += instructionSize(offset)) {
+        if (const auto target = targetDepths.find(offset); target != targetDepths.end())
+            depth = target->second;
+
+        switch (code[offset]) {
+            case OpCode::JUMP:
+            case OpCode::JUMP_FALSE:
+            case OpCode::JUMP_TRUE: {
+                const size_t jump = code[offset + 1] << 8 | code[offset + 2];
+                targetDepths.try_emplace(offset + 3 + jump, depth);
+                break;
+            }
+
+            case OpCode::FOR_RANGE: {
+                const size_t jump = code[offset + 2] << 8 | code[offset + 3];
+                targetDepths.try_emplace(offset + 4 + jump, depth);
+                break;
+            }
+
+            case OpCode::JUMP_LONG:
+            case OpCode::JUMP_FALSE_LONG: {
+                const size_t jump = static_cast<size_t>(code[offset + 1]) << 24 |
+                    code[offset + 2] << 16 | code[offset + 3] << 8 | code[offset + 4];
+                targetDepths.try_emplace(offset + 5 + jump, depth);
+                break;
+            }
+
+            default: break;
+        }
+
+        depth += stackEffect(offset);
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    if (const auto target = targetDepths.find(end); target != targetDepths.end())
+        return target->second;
+    return depth;
+}
+
+int32_t Chunk::stackDepthAt(const size_t end, const int32_t entryDepth) const {
+    int32_t maxDepth;
+    return followStackDepth(end, entryDepth, maxDepth);
+}
+
+uint32_t Chunk::maxStackDepth(const int32_t entryDepth) const {
+    int32_t maxDepth;
+    followStackDepth(code.size(), entryDepth, maxDepth);
+    return static_cast<uint32_t>(maxDepth);
+}
+
+std::optional<std::string> Chunk::verify(const int32_t entryDepth, uint32_t& maxDepth) const {
+    if (code.empty()) return "the chunk has no code";
+    if (lines.size() != code.size()) return "the line table does not match the code";
+
+    // Operands are read the way VM::Run reads them: one byte, or four big-endian ones.
+    const auto operand = [this](const size_t at, const bool wide) -> uint32_t {
+        if (!wide) return code[at];
+        return static_cast<uint32_t>(code[at]) << 24 | code[at + 1] << 16 |
+            code[at + 2] << 8 | code[at + 3];
+    };
+    const auto isName = [this](const uint32_t index) {
+        return index < constants.size() && constants[index].isObject() &&
+            constants[index].object()->type == ObjType::STRING;
+    };
+
+    // First find where each instruction starts and check what can be checked on its own.
+    std::vector<bool> starts(code.size(), false);
+    for (size_t offset = 0; offset < code.size(); offset += instructionSize(offset)) {
+        const uint8_t op = code[offset];
+        const bool wide = instructionSize(offset) == 5;
+
+        // AND, OR and the long jumps are never emitted, and the quickened forms are only
+        // written by VM::Run.
+        if (op > OpCode::RETURN || op == OpCode::AND || op == OpCode::OR ||
+            op == OpCode::JUMP_LONG || op == OpCode::JUMP_FALSE_LONG ||
+            op == OpCode::LOOP_LONG ||
+            (op >= OpCode::ADD_INT_INT && op <= OpCode::LOOP_JIT))
+            return FMT_FORMAT("unknown opcode {} at offset {}", op, offset);
+        if (offset + instructionSize(offset) > code.size())
+            return FMT_FORMAT("instruction at offset {} runs past the code", offset);
+        starts[offset] = true;
+
+        switch (op) {
+            case OpCode::CONSTANT:
+            case OpCode::CONSTANT_LONG:
+                if (operand(offset + 1, wide) >= constants.size())
+                    return FMT_FORMAT("constant out of range at offset {}", offset);
+                break;
+
+            case OpCode::GET_GLOBAL:
+            case OpCode::GET_GLOBAL_LONG:
+            case OpCode::DEF_GLOBAL:
+            case OpCode::DEF_GLOBAL_LONG:
+            case OpCode::SET_GLOBAL:
+            case OpCode::SET_GLOBAL_LONG:
+                if (!isName(operand(offset + 1, wide)))
+                    return FMT_FORMAT("global at offset {} is not named by a string", offset);
+                break;
+
+            case OpCode::CHECK_TYPE:
+                if (code[offset + 1] > static_cast<uint8_t>(StaticType::STRING))
+                    return FMT_FORMAT("unknown type at offset {}", offset);
+                break;
+
+            default: break;
+        }
+    }
+
+    // Then follow every path from the entry. Code that no path reaches is never run, so
+    // it is left alone.
+    constexpr int32_t UNSEEN = -1;
+    std::vector<int32_t> depths(code.size(), UNSEEN);
+    std::vector<size_t> pending;
+    const auto reach = [&](const size_t target, const int32_t depth) -> std::optional<std::string> {
+        if (target >= code.size() || !starts[target])
+            return FMT_FORMAT("jump to offset {}, which is not an instruction", target);
+        if (depths[target] == UNSEEN) {
+            depths[target] = depth;
+            pending.push_back(target);
+        }
+        else if (depths[target] != depth) {
+            return FMT_FORMAT("stack depth {} and {} meet at offset {}", depths[target],
+                              depth, target);
+        }
+        return std::nullopt;
+    };
+
+    int32_t deepest = entryDepth;
+    if (auto problem = reach(0, entryDepth)) return problem;
+    while (!pending.empty()) {
+        const size_t offset = pending.back();
+        pending.pop_back();
+
+        const uint8_t op = code[offset];
+        const int32_t depth = depths[offset];
+        const int32_t after = depth + stackEffect(offset);
+        const size_t next = offset + instructionSize(offset);
+        const bool wide = instructionSize(offset) == 5;
+
+        if (static_cast<int32_t>(stackInputs(offset)) > depth ||
+            (op != OpCode::RETURN && after < entryDepth))
+            return FMT_FORMAT("stack underflow at offset {}", offset);
+        deepest = std::max({deepest, depth, after});
+
+        switch (op) {
+            case OpCode::GET_LOCAL:
+            case OpCode::GET_LOCAL_LONG:
+            case OpCode::SET_LOCAL:
+            case OpCode::SET_LOCAL_LONG:
+                if (operand(offset + 1, wide) >= static_cast<uint32_t>(depth))
+                    return FMT_FORMAT("local slot out of range at offset {}", offset);
+                break;
+
+            // The counter, limit, step and loop variable.
+            case OpCode::FOR_RANGE:
+                if (code[offset + 1] + 3 >= depth)
+                    return FMT_FORMAT("local slot out of range at offset {}", offset);
+                break;
+
+            default: break;
+        }
+
+        std::optional<size_t> target;
+        bool fallsThrough = true;
+        switch (op) {
+            case OpCode::JUMP:
+                fallsThrough = false;
+                [[fallthrough]];
+            case OpCode::JUMP_FALSE:
+            case OpCode::JUMP_TRUE: target = next + (code[offset + 1] << 8 | code[offset + 2]);
+                break;
+
+            case OpCode::FOR_RANGE: target = next + (code[offset + 2] << 8 | code[offset + 3]);
+                break;
+
+            case OpCode::LOOP:
+            case OpCode::JUMP_BACK: {
+                const size_t back = code[offset + 1] << 8 | code[offset + 2];
+                if (back > next) return FMT_FORMAT("jump before the code at offset {}", offset);
+                target = next - back;
+                fallsThrough = false;
+                break;
+            }
+
+            case OpCode::RETURN: fallsThrough = false;
+                break;
+
+            default: break;
+        }
+
+        if (target) {
+            if (auto problem = reach(*target, after)) return problem;
+        }
+        if (fallsThrough) {
+            if (next >= code.size()) return "execution runs past the end of the code";
+            if (auto problem = reach(next, after)) return problem;
+        }
+    }
+
+    maxDepth = static_cast<uint32_t>(deepest);
+    return std::nullopt;
+}
+
+void Chunk::demoteTypedOps() {
+    for (size_t offset = 0; offset < code.size(); offset += instructionSize(offset)) {
+        switch (code[offset]) {
+            case OpCode::ADD_INT:
+            case OpCode::ADD_DOUBLE:
+            case OpCode::CONCAT_STR: code[offset] = OpCode::ADD;
+                break;
+            case OpCode::SUBTRACT_INT:
+            case OpCode::SUBTRACT_DOUBLE: code[offset] = OpCode::SUBTRACT;
+                break;
+            case OpCode::MULTIPLY_INT:
+            case OpCode::MULTIPLY_DOUBLE: code[offset] = OpCode::MULTIPLY;
+                break;
+            case OpCode::LESS_INT:
+            case OpCode::LESS_DOUBLE: code[offset] = OpCode::LESS;
+                break;
+            case OpCode::GREATER_INT:
+            case OpCode::GREATER_DOUBLE: code[offset] = OpCode::GREATER;
+                break;
+            default: break;
+        }
+    }
+}
 
-#include <iostream>
 
 namespace {
 size_t SimpleInstruction(std::string name, const size_t offset) {
@@ -96,7 +576,7 @@ size_t LongInstruction(std::string name, const Chunk* chunk, const size_t offset
     return offset + 5;
 }
 
-size_t JumpInstruction(std::string name, const Chunk* chunk, const uint8_t sign,
+size_t JumpInstruction(std::string name, const Chunk* chunk, const int32_t sign,
                        const size_t offset) {
     uint16_t jump = static_cast<uint16_t>(chunk->code[offset + 1] << 8);
     jump |= chunk->code[offset + 2];
@@ -104,17 +584,23 @@ size_t JumpInstruction(std::string name, const Chunk* chunk, const uint8_t sign,
               offset + 3 + static_cast<size_t>(sign) * jump);
     return offset + 3;
 }
-} // namespace
 
-#if defined(TRACE_EXECUTION)
+size_t ForRangeInstruction(std::string name, const Chunk* chunk, const size_t offset) {
+    const uint8_t slot = chunk->code[offset + 1];
+    uint16_t jump = static_cast<uint16_t>(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    FMT_PRINT("{:10} {:04}  {:04} -> {:04}\n", name, slot, offset, offset + 4 + jump);
+    return offset + 4;
+}
+} // namespace
 
-void Chunk::disassemble(std::string name) {
+void Chunk::disassemble(std::string name) const {
     FMT_PRINT("== {} ==\n", name);
     for (size_t offset = 0; offset < code.size();) { offset = disassembleInstruction(offset); }
     FMT_PRINT("\n");
 }
 
-size_t Chunk::disassembleInstruction(size_t offset) {
+size_t Chunk::disassembleInstruction(size_t offset) const {
     FMT_PRINT("{:04} ", offset);
     if (offset > 0 && lines[offset] == lines[offset - 1]) { FMT_PRINT("   | "); }
     else { FMT_PRINT("{:4} ", lines[offset]); }
@@ -175,6 +661,8 @@ size_t Chunk::disassembleInstruction(size_t offset) {
 
         case OpCode::ADD: return SimpleInstruction("ADD", offset);
 
+        case OpCode::SUBTRACT: return SimpleInstruction("SUBTRACT", offset);
+
         case OpCode::MULTIPLY: return SimpleInstruction("MULTIPLY", offset);
 
         case OpCode::DIVIDE: return SimpleInstruction("DIVIDE", offset);
@@ -193,6 +681,50 @@ size_t Chunk::disassembleInstruction(size_t offset) {
 
         case OpCode::NEGATE: return SimpleInstruction("NEGATE", offset);
 
+        case OpCode::ADD_INT: return SimpleInstruction("ADD_INT", offset);
+
+        case OpCode::ADD_DOUBLE: return SimpleInstruction("ADD_DOUBLE", offset);
+
+        case OpCode::SUBTRACT_INT: return SimpleInstruction("SUBTRACT_INT", offset);
+
+        case OpCode::SUBTRACT_DOUBLE: return SimpleInstruction("SUBTRACT_DOUBLE", offset);
+
+        case OpCode::MULTIPLY_INT: return SimpleInstruction("MULTIPLY_INT", offset);
+
+        case OpCode::MULTIPLY_DOUBLE: return SimpleInstruction("MULTIPLY_DOUBLE", offset);
+
+        case OpCode::LESS_INT: return SimpleInstruction("LESS_INT", offset);
+
+        case OpCode::LESS_DOUBLE: return SimpleInstruction("LESS_DOUBLE", offset);
+
+        case OpCode::GREATER_INT: return SimpleInstruction("GREATER_INT", offset);
+
+        case OpCode::GREATER_DOUBLE: return SimpleInstruction("GREATER_DOUBLE", offset);
+
+        case OpCode::ADD_INT_INT: return SimpleInstruction("ADD_INT_INT", offset);
+
+        case OpCode::ADD_DOUBLE_DOUBLE: return SimpleInstruction("ADD_DOUBLE_DOUBLE", offset);
+
+        case OpCode::LESS_INT_INT: return SimpleInstruction("LESS_INT_INT", offset);
+
+        case OpCode::LESS_DOUBLE_DOUBLE: return SimpleInstruction("LESS_DOUBLE_DOUBLE", offset);
+
+        case OpCode::GREATER_INT_INT: return SimpleInstruction("GREATER_INT_INT", offset);
+
+        case OpCode::GREATER_DOUBLE_DOUBLE: return SimpleInstruction(
+                "GREATER_DOUBLE_DOUBLE", offset);
+
+        case OpCode::GET_GLOBAL_CACHED: return ConstantInstruction(
+                "GET_GLOBAL_CACHED", this, offset);
+
+        case OpCode::LOOP_JIT: return JumpInstruction("LOOP_JIT", this, -1, offset);
+
+        case OpCode::CONCAT_STR: return SimpleInstruction("CONCAT_STR", offset);
+
+        case OpCode::CHECK_TYPE: return ByteInstruction("CHECK_TYPE", this, offset);
+
+        case OpCode::BUILD_STRING: return ByteInstruction("BUILD_STRING", this, offset);
+
         case OpCode::PRINT: return SimpleInstruction("PRINT", offset);
 
         case OpCode::JUMP: return JumpInstruction("JUMP", this, 1, offset);
@@ -207,13 +739,20 @@ size_t Chunk::disassembleInstruction(size_t offset) {
 
         case OpCode::LOOP_LONG: return LongInstruction("LOOP_LONG", this, offset);
 
+        case OpCode::JUMP_TRUE: return JumpInstruction("JUMP_TRUE", this, 1, offset);
+
+        case OpCode::JUMP_BACK: return JumpInstruction("JUMP_BACK", this, -1, offset);
+
+        case OpCode::FOR_RANGE: return ForRangeInstruction("FOR_RANGE", this, offset);
+
         case OpCode::CALL: return ByteInstruction("CALL", this, offset);
+        case OpCode::TAIL_CALL: return ByteInstruction("TAIL_CALL", this, offset);
+        case OpCode::FIBER: return ByteInstruction("FIBER", this, offset);
+        case OpCode::RESUME: return SimpleInstruction("RESUME", offset);
+        case OpCode::YIELD: return SimpleInstruction("YIELD", offset);
 
         default:
             FMT_PRINT("Uknown opcode {}\n", static_cast<size_t>(instruction));
             return offset + 1;
     }
 }
-#endif
-
-#endif
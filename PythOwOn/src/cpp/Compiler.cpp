@@ -9,25 +9,53 @@
 #include "Object.hpp"
 #include "Scanner.hpp"
 #include "Value.hpp"
+#include "VirtualMachine.hpp"
 #include "Utils/Enumerate.hpp"
 
 
-int32_t g_innermostLoopStart = -1;
-uint16_t g_innermostLoopScopeDepth = 0;
-
 namespace {
 template <typename T>
 T g_defaultRef = T();
+
+std::optional<StaticType> typeFromName(const std::string& name) {
+    if (name == "int") return StaticType::INT;
+    if (name == "double" || name == "float") return StaticType::DOUBLE;
+    if (name == "str") return StaticType::STRING;
+    if (name == "bool") return StaticType::BOOL;
+    return std::nullopt;
 }
 
-Compiler::Compiler() : chunk(g_defaultRef<Chunk>), scanner(Scanner("")), parser(Parser()) {
+bool isAssignment(const TokenType::Type type) {
+    switch (type) {
+        case TokenType::EQ:
+        case TokenType::PLUS_EQ:
+        case TokenType::MINUS_EQ:
+        case TokenType::STAR_EQ:
+        case TokenType::SLASH_EQ:
+        case TokenType::LSHIFT_EQ:
+        case TokenType::RSHIFT_EQ:
+        case TokenType::PERCENT_EQ: return true;
+
+        default: return false;
+    }
+}
+} // namespace
+
+Compiler::Compiler(VM& vm)
+    : vm(vm), chunk(g_defaultRef<Chunk>), scanner(Scanner("")), parser(Parser()),
+      exprType(StaticType::UNKNOWN), globalTypes(std::make_shared<GlobalTypes>()),
+      needsRecompile(false), branchCount(0),
+      coldArmStart(-1), coldArmEscapes(false), innermostLoopStart(-1),
+      innermostLoopScopeDepth(0), functionDepth(0), lazyFunctions(false),
+      frameStartDepth(0), lastCall(SIZE_MAX), inlineThreshold(16), stats(std::make_shared<CompileStats>()),
+      statsEnabled(false) {
     parser.hadError = false;
     parser.panicMode = false;
 
     // @formatter:off
     // clang-format off
     //       ParseTable Position        |         prefix        |     infix      |        precedence       |
-    rules[TokenType::LPAREN]     = { &Compiler::grouping,  nullptr,             Precedence::CALL       };
+    rules[TokenType::LPAREN]     = { &Compiler::grouping,  &Compiler::call,     Precedence::CALL       };
     rules[TokenType::RPAREN]     = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::LBRACE]     = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::RBRACE]     = { nullptr,              nullptr,             Precedence::NONE       };
@@ -35,6 +63,7 @@ Compiler::Compiler() : chunk(g_defaultRef<Chunk>), scanner(Scanner("")), parser(
     rules[TokenType::RBRACK]     = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::COMMA]      = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::DOT]        = { nullptr,              nullptr,             Precedence::NONE       };
+    rules[TokenType::DOTDOT]     = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::MINUS]      = { &Compiler::unary,     &Compiler::binary,   Precedence::TERM       };
     rules[TokenType::MINUSMINUS] = { &Compiler::unary,     &Compiler::unaryInfix,     Precedence::CALL       };
     rules[TokenType::MINUS_EQ]   = { nullptr,              &Compiler::binary,   Precedence::ASSIGNMENT };
@@ -61,6 +90,7 @@ Compiler::Compiler() : chunk(g_defaultRef<Chunk>), scanner(Scanner("")), parser(
     rules[TokenType::CARET]      = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::IDENTIFIER] = { &Compiler::variable,  nullptr,             Precedence::NONE       };
     rules[TokenType::STR]        = { &Compiler::string,    nullptr,             Precedence::NONE       };
+    rules[TokenType::FSTR]       = { &Compiler::interpolation, nullptr,         Precedence::NONE       };
     rules[TokenType::NUM]        = { &Compiler::number,    nullptr,             Precedence::NONE       };
     rules[TokenType::INF]        = { &Compiler::number,    nullptr,             Precedence::NONE       };
     rules[TokenType::NAN]        = { &Compiler::number,    nullptr,             Precedence::NONE       };
@@ -88,6 +118,9 @@ Compiler::Compiler() : chunk(g_defaultRef<Chunk>), scanner(Scanner("")), parser(
     rules[TokenType::CONTINUE]   = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::BREAK]      = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::IN]         = { nullptr,              nullptr,             Precedence::NONE       };
+    rules[TokenType::FIBER]      = { &Compiler::fiber,     nullptr,             Precedence::NONE       };
+    rules[TokenType::RESUME]     = { &Compiler::resume,    nullptr,             Precedence::NONE       };
+    rules[TokenType::YIELD]      = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::ERROR]      = { nullptr,              nullptr,             Precedence::NONE       };
     rules[TokenType::EOF]        = { nullptr,              nullptr,             Precedence::NONE       };
     // clang-format on
@@ -99,7 +132,12 @@ void Compiler::advance() {
     parser.previous = parser.current;
 
     while (true) {
-        parser.current = scanner.scanToken();
+        if (statsEnabled) {
+            const auto start = std::chrono::steady_clock::now();
+            parser.current = scanner.scanToken();
+            stats->scanTime += std::chrono::steady_clock::now() - start;
+        }
+        else { parser.current = scanner.scanToken(); }
 
         if (parser.current.type != TokenType::ERROR) break;
 
@@ -110,14 +148,16 @@ void Compiler::advance() {
 void Compiler::errorAt(Token token, const std::string& message) {
     if (parser.panicMode) return;
     parser.panicMode = true;
-    FMT_PRINT("[line {}] Error", token.line);
+    std::string error = sourceName.empty() ? "" : sourceName + ": ";
+    error += FMT_FORMAT("[line {}] Error", token.line);
 
-    if (token.type == TokenType::EOF) { FMT_PRINT(" at end"); }
+    if (token.type == TokenType::EOF) { error += " at end"; }
     else if (token.type == TokenType::ERROR) { // Nothing
     }
-    else { FMT_PRINT(" at '{}'", token.lexeme); }
+    else { error += FMT_FORMAT(" at '{}'", token.lexeme); }
 
-    FMT_PRINT(": {}\n", message);
+    // In one piece, so that errors from compilers on other threads don't cut into it.
+    FMT_PRINT("{}: {}\n", error, message);
     parser.hadError = true;
 }
 
@@ -145,6 +185,8 @@ void Compiler::emitBytes(const uint8_t byte1, const uint8_t byte2) {
 }
 
 uint16_t Compiler::emitJump(const OpCode op) {
+    if (op == OpCode::JUMP_FALSE) chunk.branches.emplace_back(branchCount++, chunk.code.size());
+
     emitByte(op);
     emitByte(0xff);
     emitByte(0xff);
@@ -200,13 +242,102 @@ void Compiler::emitLoop(const uint16_t loopStart) {
     emitByte(offset & 0xff);
 }
 
+void Compiler::emitJumpBack(const size_t target) {
+    emitByte(OpCode::JUMP_BACK);
+
+    const size_t offset = chunk.code.size() - target + 2;
+    if (offset > UINT16_MAX) { errorAt(parser.previous, "Too much code to jump over."); }
+
+    emitByte(offset >> 8 & 0xff);
+    emitByte(offset & 0xff);
+}
+
 void Compiler::emitReturn() { emitByte(OpCode::RETURN); }
 
+// Decide from the profile whether the arm reached when `branch` is (or isn't) taken
+// runs rarely enough to be worth moving out of line. Cold arms don't nest.
+bool Compiler::beginColdArm(const uint32_t branch, const bool jumpTaken) {
+    if (branch >= branchProfile.size() || coldArmStart != -1) return false;
+
+    const auto [taken, fallthrough] = branchProfile[branch];
+    const uint64_t armCount = jumpTaken ? taken : fallthrough;
+    if (taken + fallthrough == 0 || armCount * 20 > taken + fallthrough) return false;
+
+    coldArmStart = static_cast<int32_t>(chunk.code.size());
+    coldArmEscapes = false;
+    return true;
+}
+
+// Move everything emitted since `start` into a new cold block, unless the arm jumps
+// to code outside itself (the relative offset would break once it moves).
+std::optional<size_t> Compiler::endColdArm(const size_t start) {
+    coldArmStart = -1;
+    if (coldArmEscapes || parser.hadError) return std::nullopt;
+
+    ColdBlock block{};
+    block.code.assign(chunk.code.begin() + static_cast<ssize_t>(start), chunk.code.end());
+    block.lines.assign(chunk.lines.begin() + static_cast<ssize_t>(start), chunk.lines.end());
+    chunk.code.resize(start);
+    chunk.lines.resize(start);
+
+    for (size_t i = chunk.branches.size(); i > 0 && chunk.branches[i - 1].second >= start; i--) {
+        chunk.branches[i - 1].second -= start;
+        block.branches.push_back(i - 1);
+    }
+
+    coldBlocks.push_back(std::move(block));
+    return coldBlocks.size() - 1;
+}
+
+void Compiler::emitColdBlocks() {
+    for (const auto& [code, lines, entryJump, resumeAt, branches] : coldBlocks) {
+        patchJump(entryJump);
+        for (const size_t branch : branches) chunk.branches[branch].second += chunk.code.size();
+        chunk.code.insert(chunk.code.end(), code.begin(), code.end());
+        chunk.lines.insert(chunk.lines.end(), lines.begin(), lines.end());
+        emitJumpBack(resumeAt);
+    }
+
+    coldBlocks.clear();
+}
+
+// Make sure the value on top of the stack matches an annotated type, checking at
+// runtime only when the compiler can't tell.
+void Compiler::emitTypeGuard(const StaticType expected, const Token& name,
+                             const bool isInitializer) {
+    if (exprType == expected) return;
+
+    if (exprType == StaticType::UNKNOWN) {
+        emitBytes(OpCode::CHECK_TYPE, static_cast<uint8_t>(expected));
+        exprType = expected;
+        return;
+    }
+
+    errorAt(name, FMT_FORMAT("Cannot {} '{}: {}' with a value of type '{}'.",
+                             isInitializer ? "initialise" : "assign to", name.lexeme,
+                             StaticTypeName(expected), StaticTypeName(exprType)));
+}
+
 void Compiler::endCompiler() {
     emitReturn();
+    emitColdBlocks();
+    chunk.maxDepth = chunk.maxStackDepth(0);
+
+#if defined(_DEBUG)
+    // The compiler's output is held to the same checks as code loaded from a file.
+    if (!parser.hadError) {
+        uint32_t verifiedDepth;
+        if (const auto problem = chunk.verify(0, verifiedDepth))
+            FMT_PRINTLN("Invalid bytecode: {}", *problem);
+        else if (verifiedDepth > chunk.maxDepth)
+            FMT_PRINTLN("Invalid bytecode: the stack gets {} deep, not {}", verifiedDepth,
+                        chunk.maxDepth);
+    }
+#endif
 
 #if defined(TRACE_EXECUTION)
     if (!parser.hadError) { chunk.disassemble("code"); }
+    if (stats->inlinedCalls > 0) { FMT_PRINTLN("== {} call sites inlined ==", stats->inlinedCalls); }
 #endif
 }
 
@@ -245,7 +376,7 @@ void Compiler::parsePrecedence(const Precedence precedence) {
 }
 
 uint32_t Compiler::identifierConstant(const Token* name) {
-    const ObjString* str = ObjString::Create(name->lexeme);
+    const ObjString* str = ObjString::Create(vm, name->lexeme);
     const Value objVal = Value::ObjectVal(str);
     return chunk.addConstant(objVal);
 }
@@ -263,6 +394,15 @@ std::optional<uint32_t> Compiler::resolveLocal(const Token& name) {
     return std::nullopt;
 }
 
+StaticType Compiler::parseTypeHint() {
+    consume(TokenType::IDENTIFIER, "Expected type name after ':'.");
+
+    if (const auto type = typeFromName(parser.previous.lexeme)) return *type;
+
+    errorAt(parser.previous, FMT_FORMAT("Unknown type '{}'.", parser.previous.lexeme));
+    return StaticType::UNKNOWN;
+}
+
 uint32_t Compiler::parseVariable(const std::string& errorMessage) {
     consume(TokenType::IDENTIFIER, errorMessage);
 
@@ -272,30 +412,226 @@ uint32_t Compiler::parseVariable(const std::string& errorMessage) {
     return identifierConstant(&parser.previous);
 }
 
-void Compiler::markInitialized() {
+void Compiler::markInitialized(const StaticType type, const bool annotated) {
     if (state.scopeDepth == 0) return;
 
-    state.locals.back().depth = static_cast<int32_t>(state.scopeDepth);
+    Local& local = state.locals.back();
+    local.depth = static_cast<int32_t>(state.scopeDepth);
+    local.annotated = annotated;
+    local.type = annotated || !dynamicLocals.contains(local.ordinal) ? type : StaticType::UNKNOWN;
 }
 
-void Compiler::defineVariable(const uint32_t global) {
+void Compiler::defineVariable(const uint32_t global, const Token& name, const StaticType type,
+                              const bool annotated) {
     if (state.scopeDepth > 0) {
-        markInitialized();
+        markInitialized(type, annotated);
         return;
     }
 
+    defineGlobalType(name, type, annotated);
+    passGlobals.insert(name.lexeme);
+    rebindGlobal(name.lexeme);
+    stats->globals++;
     emitVariable(OpCode::DEF_GLOBAL, global);
 }
 
+// Every definition of an annotated global has to agree with its annotation, as code
+// anywhere in the unit relies on it.
+void Compiler::defineGlobalType(const Token& name, const StaticType type, const bool annotated) {
+    const auto global = globalTypes->annotated.find(name.lexeme);
+    if (global == globalTypes->annotated.end()) {
+        if (!annotated) return;
+
+        // Code compiled before this unit could store anything in it.
+        if (vm.HasGlobal(name.lexeme) || earlierUnguarded.contains(name.lexeme)) {
+            errorAt(name, FMT_FORMAT("Cannot annotate '{}', earlier input already uses it "
+                                     "without a type.", name.lexeme));
+            return;
+        }
+
+        globalTypes->annotated.emplace(name.lexeme, type);
+        if (passGlobals.contains(name.lexeme)) needsRecompile = true;
+        return;
+    }
+
+    if (type == global->second) return;
+
+    if (annotated) {
+        errorAt(name, FMT_FORMAT("Cannot redefine '{}: {}' as '{}: {}'.", name.lexeme,
+                                 StaticTypeName(global->second), name.lexeme,
+                                 StaticTypeName(type)));
+    }
+    else {
+        errorAt(name, FMT_FORMAT("Cannot redefine '{}: {}' with a value of type '{}'.",
+                                 name.lexeme, StaticTypeName(global->second),
+                                 StaticTypeName(type)));
+    }
+}
+
+// Look past the current '(' for `params) { return <expr>; }`, without consuming
+// anything. Bodies that assign, nest blocks or call themselves don't qualify.
+std::optional<InlineCandidate> Compiler::findInlineCandidate(const Token& name) const {
+    if (inlineThreshold == 0 || parser.current.type != TokenType::LPAREN) return std::nullopt;
+
+    Scanner lookahead = scanner;
+    InlineCandidate candidate{source, 0, 0, {}};
+    Token token = lookahead.scanToken();
+
+    while (token.type == TokenType::IDENTIFIER) {
+        std::string param = token.lexeme;
+        StaticType type = StaticType::UNKNOWN;
+
+        token = lookahead.scanToken();
+        if (token.type == TokenType::COLON) {
+            const auto hint = typeFromName(lookahead.scanToken().lexeme);
+            if (!hint) return std::nullopt;
+
+            type = *hint;
+            token = lookahead.scanToken();
+        }
+        candidate.params.emplace_back(std::move(param), type);
+        if (candidate.params.size() > UINT8_MAX) return std::nullopt;
+
+        if (token.type == TokenType::COMMA) token = lookahead.scanToken();
+        else break;
+    }
+
+    if (token.type != TokenType::RPAREN || lookahead.scanToken().type != TokenType::LBRACE ||
+        lookahead.scanToken().type != TokenType::RETURN)
+        return std::nullopt;
+
+    token = lookahead.scanToken();
+    candidate.exprStart = lookahead.tokenStart();
+    candidate.line = token.line;
+
+    for (uint32_t size = 0; token.type != TokenType::SEMI; token = lookahead.scanToken()) {
+        if (++size > inlineThreshold || isAssignment(token.type)) return std::nullopt;
+
+        switch (token.type) {
+            case TokenType::LBRACE:
+            case TokenType::RBRACE:
+            case TokenType::ERROR:
+            case TokenType::EOF: return std::nullopt;
+
+            case TokenType::IDENTIFIER:
+                if (token.lexeme == name.lexeme) return std::nullopt;
+                break;
+
+            default: break;
+        }
+    }
+
+    if (lookahead.tokenStart() == candidate.exprStart) return std::nullopt; // `return;`
+    if (lookahead.scanToken().type != TokenType::RBRACE) return std::nullopt;
+
+    return candidate;
+}
+
+// Count the arguments of the call opened by the current '(', without consuming them.
+std::optional<uint32_t> Compiler::peekArgumentCount() const {
+    Scanner lookahead = scanner;
+    uint32_t depth = 0;
+    uint32_t commas = 0;
+    bool empty = true;
+
+    for (Token token = lookahead.scanToken();; token = lookahead.scanToken(), empty = false) {
+        switch (token.type) {
+            case TokenType::LPAREN:
+            case TokenType::LBRACK:
+            case TokenType::LBRACE: depth++; break;
+
+            case TokenType::RPAREN:
+            case TokenType::RBRACK:
+            case TokenType::RBRACE:
+                if (depth == 0) return empty ? 0 : commas + 1;
+                depth--;
+                break;
+
+            case TokenType::COMMA:
+                if (depth == 0) commas++;
+                break;
+
+            case TokenType::ERROR:
+            case TokenType::EOF: return std::nullopt;
+
+            default: break;
+        }
+    }
+}
+
+// Compile a call to an inline candidate as its body. The arguments are left where a
+// call would put them, the body reads them from there, and its result replaces them.
+bool Compiler::inlineCall(const Token& name) {
+    const auto found = inlineCandidates.find(name.lexeme);
+    if (found == inlineCandidates.end() || notInlinable.contains(name.lexeme)) return false;
+
+    for (const auto& frame : inlineFrames)
+        if (frame.function == name.lexeme) return false;
+
+    const InlineCandidate callee = found->second;
+    const auto arity = static_cast<uint32_t>(callee.params.size());
+    if (peekArgumentCount() != arity) return false;
+
+    const auto base = static_cast<uint32_t>(chunk.stackDepthAt(chunk.code.size(),
+                                                                static_cast<int32_t>(frameStartDepth)));
+    InlineFrame frame{name.lexeme, {}};
+
+    advance();
+    for (uint32_t i = 0; i < arity; i++) {
+        if (i > 0) consume(TokenType::COMMA, "Expected ',' between arguments.");
+        expression();
+
+        // A mismatch the compiler can already see still only fails if it is run.
+        const auto& [param, hint] = callee.params[i];
+        if (hint != StaticType::UNKNOWN && exprType != hint)
+            emitBytes(OpCode::CHECK_TYPE, static_cast<uint8_t>(hint));
+
+        frame.params.push_back({param, base + i, hint != StaticType::UNKNOWN ? hint : exprType});
+    }
+    consume(TokenType::RPAREN, "Expected ')' after arguments.");
+
+    const Scanner callerScanner = scanner;
+    const Parser callerParser = parser;
+    scanner = Scanner(*callee.source, callee.exprStart, callee.line);
+    inlineFrames.push_back(std::move(frame));
+
+    advance();
+    expression();
+
+    inlineFrames.pop_back();
+    scanner = callerScanner;
+    parser.current = callerParser.current;
+    parser.previous = callerParser.previous;
+
+    if (arity > 0) {
+        emitVariable(OpCode::SET_LOCAL, base);
+        emitByte(OpCode::POP);
+    }
+    if (arity > 2) emitBytes(OpCode::POPN, static_cast<uint8_t>(arity - 1));
+    else if (arity == 2) emitByte(OpCode::POP);
+
+    stats->inlinedCalls++;
+    return true;
+}
+
+// `name` is about to be given another value, so calls to it can't be inlined.
+void Compiler::rebindGlobal(const std::string& name) {
+    if (inlineCandidates.erase(name) == 0) return;
+
+    inlineCandidatesSnapshot.reset();
+    notInlinable.insert(name);
+    needsRecompile = true;
+}
+
 void Compiler::declareVariable() {
     if (state.scopeDepth == 0) return;
 
     const Token* name = &parser.previous;
 
-    for (const auto& [localName, localDepth] : state.locals | std::views::reverse) {
-        if (localDepth != -1 && static_cast<unsigned>(localDepth) < state.scopeDepth) break;
+    for (const auto& local : state.locals | std::views::reverse) {
+        if (local.depth != -1 && static_cast<unsigned>(local.depth) < state.scopeDepth) break;
 
-        if (name->lexeme == localName.lexeme) {
+        if (name->lexeme == local.name.lexeme) {
             errorAt(*name, "Already variable with this name in this scope.");
         }
     }
@@ -306,11 +642,49 @@ void Compiler::declareVariable() {
     }
 
     state.addLocal(*name);
+    stats->locals++;
+}
+
+// Reconcile the type of the value just compiled with the variable it is assigned to.
+void Compiler::checkAssignment(const Token& name, const std::optional<uint32_t> local) {
+    if (!local) {
+        const auto global = globalTypes->annotated.find(name.lexeme);
+        if (global != globalTypes->annotated.end()) emitTypeGuard(global->second, name, false);
+        else globalTypes->unguarded.insert(name.lexeme);
+        return;
+    }
+
+    Local& target = state.locals[*local];
+    if (target.type == StaticType::UNKNOWN || target.type == exprType) return;
+
+    if (target.annotated) {
+        emitTypeGuard(target.type, name, false);
+        return;
+    }
+
+    // The inferred type was wrong, and code using it may already have been emitted.
+    dynamicLocals.insert(target.ordinal);
+    needsRecompile = true;
 }
 
 void Compiler::namedVariable(const Token& name, const bool canAssign) {
+    const Token target = name; // `name` may alias parser.previous, which is about to move
     OpCode getOp, setOp;
-    std::optional<uint32_t> arg = resolveLocal(name);
+    std::optional<uint32_t> arg;
+
+    // An inlined body sees its own parameters and the globals, not the caller's locals.
+    if (inlineFrames.empty()) { arg = resolveLocal(name); }
+    else {
+        for (const auto& [param, slot, type] : inlineFrames.back().params) {
+            if (param != name.lexeme) continue;
+
+            emitVariable(OpCode::GET_LOCAL, slot);
+            exprType = type;
+            return;
+        }
+    }
+
+    if (!arg && parser.current.type == TokenType::LPAREN && inlineCall(target)) return;
 
     if (arg) {
         getOp = OpCode::GET_LOCAL;
@@ -318,27 +692,42 @@ void Compiler::namedVariable(const Token& name, const bool canAssign) {
     }
     else {
         arg = identifierConstant(&name);
+        passGlobals.insert(name.lexeme);
         getOp = OpCode::GET_GLOBAL;
         setOp = OpCode::SET_GLOBAL;
     }
 
     if (canAssign && match(TokenType::EQ)) {
         expression();
+        checkAssignment(target, getOp == OpCode::GET_LOCAL ? arg : std::nullopt);
+        if (setOp == OpCode::SET_GLOBAL) rebindGlobal(target.lexeme);
         emitVariable(setOp, *arg);
     }
-    else { emitVariable(getOp, *arg); }
+    else {
+        emitVariable(getOp, *arg);
+
+        if (getOp == OpCode::GET_LOCAL) { exprType = state.locals[*arg].type; }
+        else {
+            const auto global = globalTypes->annotated.find(name.lexeme);
+            exprType = global != globalTypes->annotated.end() ? global->second
+                                                              : StaticType::UNKNOWN;
+        }
+    }
 }
 
 void Compiler::and_(bool) {
+    const StaticType leftType = exprType;
     const uint16_t endJump = emitJump(OpCode::JUMP_FALSE);
 
     emitByte(OpCode::POP);
     parsePrecedence(Precedence::AND);
 
     patchJump(endJump);
+    if (exprType != leftType) exprType = StaticType::UNKNOWN;
 }
 
 void Compiler::or_(bool) {
+    const StaticType leftType = exprType;
     const uint16_t elseJump = emitJump(OpCode::JUMP_FALSE);
     const uint16_t endJump = emitJump(OpCode::JUMP);
 
@@ -347,6 +736,7 @@ void Compiler::or_(bool) {
 
     parsePrecedence(Precedence::OR);
     patchJump(endJump);
+    if (exprType != leftType) exprType = StaticType::UNKNOWN;
 }
 
 void Compiler::expression() { parsePrecedence(Precedence::ASSIGNMENT); }
@@ -369,15 +759,47 @@ void Compiler::ifStatement() {
     consume(TokenType::RPAREN, "Expected ')' after condition.");
 
     const uint16_t ifJump = emitJump(OpCode::JUMP_FALSE);
+    const uint32_t branch = branchCount - 1;
+
+    const size_t thenStart = chunk.code.size();
+    const bool coldThen = beginColdArm(branch, false);
     emitByte(OpCode::POP);
     statement();
 
+    if (const auto block = coldThen ? endColdArm(thenStart) : std::nullopt) {
+        // Enter the then arm on a true condition instead, and fall into the else arm.
+        chunk.code[ifJump - 1] = OpCode::JUMP_TRUE;
+        coldBlocks[*block].entryJump = ifJump;
+
+        emitByte(OpCode::POP);
+        if (match(TokenType::ELSE)) statement();
+
+        coldBlocks[*block].resumeAt = chunk.code.size();
+        return;
+    }
+
     const uint16_t elseJump = emitJump(OpCode::JUMP);
 
     patchJump(ifJump);
+
+    const size_t elseStart = chunk.code.size();
+    const bool coldElse = beginColdArm(branch, true);
     emitByte(OpCode::POP);
 
     if (match(TokenType::ELSE)) statement();
+
+    if (const auto block = coldElse ? endColdArm(elseStart) : std::nullopt) {
+        // The then arm no longer has anything to jump over.
+        chunk.code.resize(elseJump - 1);
+        chunk.lines.resize(elseJump - 1);
+        // The jump is patched again once the block is placed; until then it points nowhere.
+        chunk.code[ifJump] = chunk.code[ifJump + 1] = 0xff;
+
+        coldBlocks[*block].entryJump = ifJump;
+        coldBlocks[*block].resumeAt = chunk.code.size();
+        return;
+    }
+
     patchJump(elseJump);
 }
 
@@ -476,6 +898,11 @@ void Compiler::whileStatement() {
 }
 
 void Compiler::forStatement() {
+    if (atRangeLoop()) {
+        forRangeStatement();
+        return;
+    }
+
     beginScope();
 
     consume(TokenType::LPAREN, "Expected '(' after 'for'.");
@@ -485,10 +912,10 @@ void Compiler::forStatement() {
     else if (match(TokenType::LET)) { varDeclaration(); }
     else { expressionStatement(); }
 
-    const int32_t surroundingLoopStart = g_innermostLoopStart;
-    const uint16_t surroundingLoopScopeDepth = g_innermostLoopScopeDepth;
-    g_innermostLoopStart = static_cast<int32_t>(chunk.code.size());
-    g_innermostLoopScopeDepth = static_cast<uint16_t>(state.scopeDepth);
+    const int32_t surroundingLoopStart = innermostLoopStart;
+    const uint16_t surroundingLoopScopeDepth = innermostLoopScopeDepth;
+    innermostLoopStart = static_cast<int32_t>(chunk.code.size());
+    innermostLoopScopeDepth = static_cast<uint16_t>(state.scopeDepth);
 
     int32_t exitJump = -1;
     if (!match(TokenType::SEMI)) {
@@ -506,40 +933,160 @@ void Compiler::forStatement() {
         emitByte(OpCode::POP);
         consume(TokenType::RPAREN, "Expected ')' after for clauses.");
 
-        emitLoop(static_cast<uint16_t>(g_innermostLoopStart));
-        g_innermostLoopStart = incrementStart;
+        emitLoop(static_cast<uint16_t>(innermostLoopStart));
+        innermostLoopStart = incrementStart;
         patchJump(bodyJump);
     }
 
     statement();
 
-    emitLoop(static_cast<uint16_t>(g_innermostLoopStart));
+    emitLoop(static_cast<uint16_t>(innermostLoopStart));
 
     if (exitJump != -1) {
         patchJump(exitJump);
         emitByte(OpCode::POP);
     }
 
-    g_innermostLoopStart = surroundingLoopStart;
-    g_innermostLoopScopeDepth = surroundingLoopScopeDepth;
+    innermostLoopStart = surroundingLoopStart;
+    innermostLoopScopeDepth = surroundingLoopScopeDepth;
 
     endScope();
 }
 
+// `for i in ...` or `for (i in ...)`, telling it apart from a C-style loop.
+bool Compiler::atRangeLoop() const {
+    Scanner lookahead = scanner;
+    Token token = parser.current;
+
+    if (token.type == TokenType::LPAREN) token = lookahead.scanToken();
+    return token.type == TokenType::IDENTIFIER && lookahead.scanToken().type == TokenType::IN;
+}
+
+// The counter, limit and step of a range loop live in hidden locals below the loop
+// variable, so a single FOR_RANGE per iteration can test and advance them.
+void Compiler::forRangeStatement() {
+    beginScope();
+
+    const bool parenthesized = match(TokenType::LPAREN);
+    consume(TokenType::IDENTIFIER, "Expected loop variable name.");
+    const Token name = parser.previous;
+    consume(TokenType::IN, "Expected 'in' after loop variable.");
+
+    const auto slot = static_cast<uint32_t>(state.locals.size());
+    if (slot > UINT8_MAX - 3) errorAt(name, "Too many locals in scope for a range loop.");
+
+    const StaticType counterType = rangeBounds();
+    for (const char* hidden : {"(range counter)", "(range limit)", "(range step)"}) {
+        state.addLocal(Token{TokenType::IDENTIFIER, hidden, name.line});
+        markInitialized(StaticType::UNKNOWN, false);
+    }
+
+    emitByte(OpCode::NONE);
+    state.addLocal(name);
+    stats->locals++;
+    markInitialized(counterType, false);
+
+    if (parenthesized) consume(TokenType::RPAREN, "Expected ')' after range.");
+
+    const int32_t surroundingLoopStart = innermostLoopStart;
+    const uint16_t surroundingLoopScopeDepth = innermostLoopScopeDepth;
+    innermostLoopStart = static_cast<int32_t>(chunk.code.size());
+    innermostLoopScopeDepth = static_cast<uint16_t>(state.scopeDepth);
+
+    emitBytes(OpCode::FOR_RANGE, static_cast<uint8_t>(slot));
+    emitByte(0xff);
+    emitByte(0xff);
+    const auto exitJump = static_cast<uint16_t>(chunk.code.size() - 2);
+
+    statement();
+
+    emitLoop(static_cast<uint16_t>(innermostLoopStart));
+    patchJump(exitJump);
+
+    innermostLoopStart = surroundingLoopStart;
+    innermostLoopScopeDepth = surroundingLoopScopeDepth;
+
+    endScope();
+}
+
+// Compiles `a..b` or `range([start,] stop[, step])` to its start, limit and step, and
+// returns the type the counter will have.
+StaticType Compiler::rangeBounds() {
+    StaticType start = StaticType::INT;
+    StaticType step = StaticType::INT;
+
+    if (parser.current.type == TokenType::IDENTIFIER && parser.current.lexeme == "range" &&
+        Scanner(scanner).scanToken().type == TokenType::LPAREN) {
+        advance();
+        const auto argCount = peekArgumentCount();
+        advance();
+
+        if (!argCount || *argCount < 1 || *argCount > 3) {
+            errorAt(parser.current, "range() takes between 1 and 3 arguments.");
+            return StaticType::UNKNOWN;
+        }
+
+        if (*argCount == 1) { emitConstant(Value::IntegerVal(0)); }
+        else {
+            expression();
+            start = exprType;
+            consume(TokenType::COMMA, "Expected ',' after range start.");
+        }
+
+        expression();
+
+        if (*argCount == 3) {
+            consume(TokenType::COMMA, "Expected ',' after range stop.");
+            expression();
+            step = exprType;
+        }
+        else { emitConstant(Value::IntegerVal(1)); }
+
+        consume(TokenType::RPAREN, "Expected ')' after range arguments.");
+    }
+    else {
+        expression();
+        start = exprType;
+        consume(TokenType::DOTDOT, "Expected '..' or range() after 'in'.");
+        expression();
+        emitConstant(Value::IntegerVal(1));
+    }
+
+    if (start == StaticType::INT && step == StaticType::INT) return StaticType::INT;
+    if ((start == StaticType::INT || start == StaticType::DOUBLE) &&
+        (step == StaticType::INT || step == StaticType::DOUBLE))
+        return StaticType::DOUBLE;
+    return StaticType::UNKNOWN;
+}
+
 void Compiler::continueStatement() {
-    if (g_innermostLoopStart == -1) {
+    if (innermostLoopStart == -1) {
         errorAt(parser.previous, "Cannot continue outside of a loop.");
     }
 
+    if (coldArmStart != -1 && innermostLoopStart < coldArmStart) coldArmEscapes = true;
+
     consume(TokenType::SEMI, "Expected ';' after continue.");
 
-    for (auto& [_, localDepth] : state.locals | std::views::reverse) {
-        if (localDepth <= g_innermostLoopScopeDepth) break;
+    for (const auto& local : state.locals | std::views::reverse) {
+        if (local.depth <= innermostLoopScopeDepth) break;
 
         emitByte(OpCode::POP);
     }
 
-    emitLoop(static_cast<uint16_t>(g_innermostLoopStart));
+    emitLoop(static_cast<uint16_t>(innermostLoopStart));
+}
+
+// A bare `yield;` yields None. Whether the function runs in a fiber is only known once it runs.
+void Compiler::yieldStatement() {
+    if (functionDepth == 0) errorAt(parser.previous, "Can't yield outside of a function.");
+
+    if (match(TokenType::SEMI)) { emitByte(OpCode::NONE); }
+    else {
+        expression();
+        consume(TokenType::SEMI, "Expected ';' after yield value.");
+    }
+    emitByte(OpCode::YIELD);
 }
 
 void Compiler::breakStatement() { consume(TokenType::SEMI, "Expected ';' after break."); }
@@ -562,11 +1109,21 @@ void Compiler::statement() {
     else if (match(TokenType::FOR)) { forStatement(); }
     else if (match(TokenType::CONTINUE)) { continueStatement(); }
     else if (match(TokenType::BREAK)) { breakStatement(); }
+    else if (match(TokenType::YIELD)) { yieldStatement(); }
     else if (match(TokenType::RETURN)) {
-        if (match(TokenType::SEMI)) { emitReturn(); }
+        if (match(TokenType::SEMI)) {
+            if (functionDepth > 0) emitByte(OpCode::NONE);
+            emitReturn();
+        }
         else {
+            lastCall = SIZE_MAX;
             expression();
             consume(TokenType::SEMI, "Expected ';' after return value.");
+
+            // The frame is no longer needed once the call is made, so the callee reuses it.
+            // Any jump that skips the call lands on the RETURN, which is kept for it.
+            if (functionDepth > 0 && lastCall == chunk.code.size() - 2)
+                chunk.code[lastCall] = OpCode::TAIL_CALL;
             emitByte(OpCode::RETURN);
         }
     }
@@ -575,6 +1132,7 @@ void Compiler::statement() {
 
 void Compiler::declaration() {
     if (match(TokenType::LET)) { varDeclaration(); }
+    else if (match(TokenType::DEF)) { funDeclaration(); }
     else { statement(); }
 
     if (parser.panicMode) panicSync();
@@ -582,13 +1140,176 @@ void Compiler::declaration() {
 
 void Compiler::varDeclaration() {
     const uint32_t var = parseVariable("Expected variable name.");
+    const Token name = parser.previous;
+
+    const bool annotated = match(TokenType::COLON);
+    const StaticType hint = annotated ? parseTypeHint() : StaticType::UNKNOWN;
 
     if (match(TokenType::EQ)) { expression(); }
-    else { emitByte(OpCode::NONE); }
+    else {
+        emitByte(OpCode::NONE);
+        exprType = StaticType::NONE;
+    }
+
+    if (annotated) emitTypeGuard(hint, name, true);
 
     consume(TokenType::SEMI, "Expected ';' after variable declaration.");
 
-    defineVariable(var);
+    defineVariable(var, name, annotated ? hint : exprType, annotated);
+}
+
+void Compiler::funDeclaration() {
+    const uint32_t var = parseVariable("Expected function name.");
+    const Token name = parser.previous;
+    const bool global = state.scopeDepth == 0;
+    auto candidate = global ? findInlineCandidate(name) : std::nullopt;
+
+    // A local function may refer to itself.
+    markInitialized(StaticType::UNKNOWN, false);
+    function(name);
+
+    defineVariable(var, name, StaticType::UNKNOWN, false);
+
+    if (candidate && !notInlinable.contains(name.lexeme)) {
+        inlineCandidates.insert_or_assign(name.lexeme, std::move(*candidate));
+        inlineCandidatesSnapshot.reset();
+    }
+}
+
+void Compiler::function(const Token& name) {
+    ObjFunction* fn = ObjFunction::Create(vm, ObjString::Create(vm, name.lexeme));
+    stats->functions++;
+
+    if (lazyFunctions) { declareLazy(fn); }
+    else { compileFunction(fn); }
+
+    emitConstant(Value::ObjectVal(fn));
+    exprType = StaticType::UNKNOWN;
+}
+
+// Compile the parameter list and body starting at the current '(' into `function`.
+// The enclosing chunk's compilation state is put aside until the body is done.
+void Compiler::compileFunction(ObjFunction* function) {
+    Chunk enclosingChunk = std::move(chunk);
+    CompilerState enclosingState = std::move(state);
+    std::vector<ColdBlock> enclosingColdBlocks = std::move(coldBlocks);
+    const int32_t enclosingColdArmStart = coldArmStart;
+    const int32_t enclosingLoopStart = innermostLoopStart;
+    const uint16_t enclosingLoopScopeDepth = innermostLoopScopeDepth;
+    const uint32_t enclosingFrameStartDepth = frameStartDepth;
+
+    chunk = Chunk();
+    state = CompilerState();
+    state.localCount = enclosingState.localCount;
+    coldBlocks.clear();
+    coldArmStart = -1;
+    innermostLoopStart = -1;
+    innermostLoopScopeDepth = 0;
+    functionDepth++;
+
+    // Slot 0 holds the function being called.
+    beginScope();
+    state.addLocal(Token{TokenType::IDENTIFIER, "", parser.current.line})->depth = 0;
+
+    std::vector<std::pair<uint32_t, StaticType>> paramGuards;
+    uint32_t arity = 0;
+
+    consume(TokenType::LPAREN, "Expected '(' after function name.");
+    if (parser.current.type != TokenType::RPAREN) {
+        do {
+            if (++arity > UINT8_MAX) errorAt(parser.current, "Can't have more than 255 parameters.");
+
+            consume(TokenType::IDENTIFIER, "Expected parameter name.");
+            declareVariable();
+
+            const bool annotated = match(TokenType::COLON);
+            const StaticType hint = annotated ? parseTypeHint() : StaticType::UNKNOWN;
+            markInitialized(hint, annotated);
+            if (hint != StaticType::UNKNOWN) paramGuards.emplace_back(arity, hint);
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RPAREN, "Expected ')' after parameters.");
+    consume(TokenType::LBRACE, "Expected '{' before function body.");
+    frameStartDepth = arity + 1;
+
+    // Annotated parameters are checked once on entry, and trusted from then on.
+    for (const auto& [slot, type] : paramGuards) {
+        emitVariable(OpCode::GET_LOCAL, slot);
+        emitBytes(OpCode::CHECK_TYPE, static_cast<uint8_t>(type));
+        emitByte(OpCode::POP);
+    }
+
+    block();
+    emitBytes(OpCode::NONE, OpCode::RETURN);
+    emitColdBlocks();
+    chunk.maxDepth = chunk.maxStackDepth(static_cast<int32_t>(frameStartDepth));
+
+#if defined(_DEBUG)
+    if (!parser.hadError) {
+        uint32_t verifiedDepth;
+        if (const auto problem = chunk.verify(static_cast<int32_t>(frameStartDepth),
+                                              verifiedDepth))
+            FMT_PRINTLN("Invalid bytecode in {}(): {}", function->name->str, *problem);
+        else if (verifiedDepth > chunk.maxDepth)
+            FMT_PRINTLN("Invalid bytecode in {}(): the stack gets {} deep, not {}",
+                        function->name->str, verifiedDepth, chunk.maxDepth);
+    }
+#endif
+
+    function->arity = arity;
+    if (function->chunk == nullptr) function->chunk = new Chunk();
+    *function->chunk = std::move(chunk);
+
+#if defined(TRACE_EXECUTION)
+    if (!parser.hadError) { function->chunk->disassemble(function->name->str); }
+#endif
+
+    enclosingState.localCount = state.localCount;
+    chunk = std::move(enclosingChunk);
+    state = std::move(enclosingState);
+    coldBlocks = std::move(enclosingColdBlocks);
+    coldArmStart = enclosingColdArmStart;
+    innermostLoopStart = enclosingLoopStart;
+    innermostLoopScopeDepth = enclosingLoopScopeDepth;
+    frameStartDepth = enclosingFrameStartDepth;
+    functionDepth--;
+}
+
+// Record where the body is and skip over it; only the arity is needed before the
+// first call. Errors inside the body are reported once it is compiled.
+void Compiler::declareLazy(ObjFunction* function) {
+    if (!inlineCandidatesSnapshot)
+        inlineCandidatesSnapshot = std::make_shared<const InlineCandidates>(inlineCandidates);
+    function->lazy = new LazyFunction{source, scanner.tokenStart(), parser.current.line,
+                                      globalTypes, inlineCandidatesSnapshot, stats};
+
+    consume(TokenType::LPAREN, "Expected '(' after function name.");
+    if (parser.current.type != TokenType::RPAREN) {
+        do {
+            if (++function->arity > UINT8_MAX)
+                errorAt(parser.current, "Can't have more than 255 parameters.");
+
+            consume(TokenType::IDENTIFIER, "Expected parameter name.");
+            if (match(TokenType::COLON)) parseTypeHint();
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RPAREN, "Expected ')' after parameters.");
+    consume(TokenType::LBRACE, "Expected '{' before function body.");
+
+    for (uint32_t depth = 1; depth > 0; advance()) {
+        if (parser.current.type == TokenType::EOF) {
+            errorAt(parser.current, "Expected '}' after block.");
+            return;
+        }
+
+        if (parser.current.type == TokenType::LBRACE) depth++;
+        else if (parser.current.type == TokenType::RBRACE) depth--;
+
+        // The body is compiled too late to stop calls from being inlined, so assume
+        // anything it assigns to is a global.
+        if (isAssignment(parser.current.type) && parser.previous.type == TokenType::IDENTIFIER)
+            rebindGlobal(parser.previous.lexeme);
+    }
 }
 
 void Compiler::block() {
@@ -649,6 +1370,11 @@ void Compiler::unary(bool) {
     }
     // clang-format on
     // @formatter:on
+
+    if (operatorType == TokenType::NOT) { exprType = StaticType::BOOL; }
+    else if (exprType != StaticType::INT && exprType != StaticType::DOUBLE) {
+        exprType = StaticType::UNKNOWN;
+    }
 }
 
 void Compiler::unaryInfix(bool) {
@@ -661,6 +1387,10 @@ void Compiler::unaryInfix(bool) {
     }
     // clang-format on
     // @formatter:on
+
+    if (exprType != StaticType::INT && exprType != StaticType::DOUBLE) {
+        exprType = StaticType::UNKNOWN;
+    }
 }
 
 // Emit an `assignment by` instruction (+=, -=, etc.)
@@ -680,6 +1410,7 @@ void Compiler::emitAssignmentBy(const TokenType::Type byType, const uint32_t var
 
 void Compiler::binary(bool) {
     const TokenType::Type operatorType = parser.previous.type;
+    const StaticType leftType = exprType;
 
     uint32_t var;
     OpCode setter;
@@ -695,23 +1426,100 @@ void Compiler::binary(bool) {
     ParseRule* rule = getRule(operatorType);
     parsePrecedence(static_cast<Precedence>(static_cast<size_t>(rule->precedence) + 1));
 
+    if (operatorType == TokenType::MINUS_EQ) {
+        emitAssignmentBy(TokenType::MINUS_EQ, var, setter);
+        exprType = StaticType::UNKNOWN;
+        return;
+    }
+
+    emitBinaryOp(operatorType, leftType, exprType);
+}
+
+// Emit the instruction(s) for a binary operator, picking the type-specialized form
+// when both operand types are proven, and set exprType to the type of the result.
+void Compiler::emitBinaryOp(const TokenType::Type operatorType, const StaticType left,
+                            const StaticType right) {
+    const bool bothInt = left == StaticType::INT && right == StaticType::INT;
+    const bool bothDouble = left == StaticType::DOUBLE && right == StaticType::DOUBLE;
+    const bool bothNumbers = (left == StaticType::INT || left == StaticType::DOUBLE) &&
+        (right == StaticType::INT || right == StaticType::DOUBLE);
+    const StaticType numberType = bothNumbers
+                                      ? bothInt ? StaticType::INT : StaticType::DOUBLE
+                                      : StaticType::UNKNOWN;
+
     // @formatter:off
     // clang-format off
     switch (operatorType) {
-        case TokenType::MINUS:      emitBytes(OpCode::NEGATE, OpCode::ADD);             break;
-        case TokenType::MINUS_EQ:   emitAssignmentBy(TokenType::MINUS_EQ, var, setter); break;
-        case TokenType::PLUS:       emitByte(OpCode::ADD);                              break;
-        case TokenType::SLASH:      emitByte(OpCode::DIVIDE);                           break;
-        case TokenType::STAR:       emitByte(OpCode::MULTIPLY);                         break;
-        case TokenType::BANG_EQ:    emitBytes(OpCode::EQUAL, OpCode::NOT);              break;
-        case TokenType::EQ_EQ:      emitByte(OpCode::EQUAL);                            break;
-        case TokenType::GREATER:    emitByte(OpCode::GREATER);                          break;
-        case TokenType::GREATER_EQ: emitBytes(OpCode::LESS, OpCode::NOT);               break;
-        case TokenType::LESS:       emitByte(OpCode::LESS);                             break;
-        case TokenType::LESS_EQ:    emitBytes(OpCode::GREATER, OpCode::NOT);            break;
-        case TokenType::LSHIFT:     emitByte(OpCode::LEFTSHIFT);                        break;
-        case TokenType::RSHIFT:     emitByte(OpCode::RIGHTSHIFT);                       break;
-        case TokenType::PERCENT:    emitByte(OpCode::MODULO);                           break;
+        case TokenType::MINUS:
+            if (bothInt)         emitByte(OpCode::SUBTRACT_INT);
+            else if (bothDouble) emitByte(OpCode::SUBTRACT_DOUBLE);
+            else                 emitBytes(OpCode::NEGATE, OpCode::ADD);
+            exprType = numberType;
+            break;
+
+        case TokenType::PLUS:
+            if (bothInt)         emitByte(OpCode::ADD_INT);
+            else if (bothDouble) emitByte(OpCode::ADD_DOUBLE);
+            else if (left == StaticType::STRING && right == StaticType::STRING)
+                                 emitByte(OpCode::CONCAT_STR);
+            else                 emitByte(OpCode::ADD);
+
+            if (bothNumbers) exprType = numberType;
+            else if ((left == StaticType::STRING || right == StaticType::STRING) &&
+                     left != StaticType::UNKNOWN && right != StaticType::UNKNOWN)
+                exprType = StaticType::STRING;
+            else exprType = StaticType::UNKNOWN;
+            break;
+
+        case TokenType::STAR:
+            if (bothInt)         emitByte(OpCode::MULTIPLY_INT);
+            else if (bothDouble) emitByte(OpCode::MULTIPLY_DOUBLE);
+            else                 emitByte(OpCode::MULTIPLY);
+
+            if (bothNumbers) exprType = numberType;
+            else if ((left == StaticType::STRING && right == StaticType::INT) ||
+                     (left == StaticType::INT && right == StaticType::STRING))
+                exprType = StaticType::STRING;
+            else exprType = StaticType::UNKNOWN;
+            break;
+
+        case TokenType::GREATER:
+            if (bothInt)         emitByte(OpCode::GREATER_INT);
+            else if (bothDouble) emitByte(OpCode::GREATER_DOUBLE);
+            else                 emitByte(OpCode::GREATER);
+            exprType = StaticType::BOOL;
+            break;
+
+        case TokenType::GREATER_EQ:
+            if (bothInt)         emitBytes(OpCode::LESS_INT, OpCode::NOT);
+            else if (bothDouble) emitBytes(OpCode::LESS_DOUBLE, OpCode::NOT);
+            else                 emitBytes(OpCode::LESS, OpCode::NOT);
+            exprType = StaticType::BOOL;
+            break;
+
+        case TokenType::LESS:
+            if (bothInt)         emitByte(OpCode::LESS_INT);
+            else if (bothDouble) emitByte(OpCode::LESS_DOUBLE);
+            else                 emitByte(OpCode::LESS);
+            exprType = StaticType::BOOL;
+            break;
+
+        case TokenType::LESS_EQ:
+            if (bothInt)         emitBytes(OpCode::GREATER_INT, OpCode::NOT);
+            else if (bothDouble) emitBytes(OpCode::GREATER_DOUBLE, OpCode::NOT);
+            else                 emitBytes(OpCode::GREATER, OpCode::NOT);
+            exprType = StaticType::BOOL;
+            break;
+
+        case TokenType::SLASH:   emitByte(OpCode::DIVIDE);              exprType = StaticType::UNKNOWN; break;
+        case TokenType::BANG_EQ: emitBytes(OpCode::EQUAL, OpCode::NOT); exprType = StaticType::BOOL;    break;
+        case TokenType::EQ_EQ:   emitByte(OpCode::EQUAL);               exprType = StaticType::BOOL;    break;
+        case TokenType::LSHIFT:  emitByte(OpCode::LEFTSHIFT);           exprType = StaticType::INT;     break;
+        case TokenType::RSHIFT:  emitByte(OpCode::RIGHTSHIFT);          exprType = StaticType::INT;     break;
+        case TokenType::PERCENT:
+            emitByte(OpCode::MODULO);
+            exprType = bothNumbers ? StaticType::DOUBLE : StaticType::UNKNOWN;
+            break;
         default: return; // Unreachable
     }
     // clang-format on
@@ -722,9 +1530,9 @@ void Compiler::literal(bool) {
     // @formatter:off
     // clang-format off
     switch (parser.previous.type) {
-        case TokenType::FALSE: emitByte(OpCode::FALSE); break;
-        case TokenType::TRUE:  emitByte(OpCode::TRUE);  break;
-        case TokenType::NONE:  emitByte(OpCode::NONE);  break;
+        case TokenType::FALSE: emitByte(OpCode::FALSE); exprType = StaticType::BOOL; break;
+        case TokenType::TRUE:  emitByte(OpCode::TRUE);  exprType = StaticType::BOOL; break;
+        case TokenType::NONE:  emitByte(OpCode::NONE);  exprType = StaticType::NONE; break;
         default: return; // Unreachable
     }
     // clang-format on
@@ -732,13 +1540,44 @@ void Compiler::literal(bool) {
 }
 
 void Compiler::string(bool) {
-    const ObjString* str = ObjString::Create(parser.previous.lexeme, {1, -1});
+    const ObjString* str = ObjString::Create(vm, parser.previous.lexeme, {1, -1});
     emitConstant(Value::ObjectVal(str));
+    exprType = StaticType::STRING;
+}
+
+// f"a{x}b{y}" arrives as FSTR "a", x, FSTR "b", y, STR "", and becomes one BUILD_STRING.
+void Compiler::interpolation(bool) {
+    uint32_t parts = 0;
+
+    do {
+        if (parser.previous.lexeme.size() > 2) {
+            string(false);
+            parts++;
+        }
+        expression();
+        parts++;
+    } while (match(TokenType::FSTR));
+
+    consume(TokenType::STR, "Expected '}' after interpolated expression.");
+    if (parser.previous.lexeme.size() > 2) {
+        string(false);
+        parts++;
+    }
+
+    if (parts > UINT8_MAX) {
+        errorAt(parser.previous, "Too many parts in one interpolated string.");
+        return;
+    }
+
+    emitBytes(OpCode::BUILD_STRING, static_cast<uint8_t>(parts));
+    exprType = StaticType::STRING;
 }
 
 void Compiler::variable(const bool canAssign) { namedVariable(parser.previous, canAssign); }
 
 void Compiler::number(bool) {
+    exprType = StaticType::UNKNOWN;
+
     if (parser.previous.lexeme == "Nan") {
         emitConstant(Value::Nan(true));
         return;
@@ -752,10 +1591,12 @@ void Compiler::number(bool) {
     if (parser.previous.lexeme.find('.') != std::string::npos) {
         const double value = std::stod(parser.previous.lexeme);
         emitConstant(Value::DoubleVal(value));
+        exprType = StaticType::DOUBLE;
     }
     else {
         const int value = std::stoi(parser.previous.lexeme);
         emitConstant(Value::IntegerVal(value));
+        exprType = StaticType::INT;
     }
 }
 
@@ -764,17 +1605,180 @@ void Compiler::grouping(bool) {
     consume(TokenType::RPAREN, "Expected ')' after expression.");
 }
 
+void Compiler::call(bool) {
+    uint32_t argCount = 0;
+
+    if (parser.current.type != TokenType::RPAREN) {
+        do {
+            expression();
+            if (++argCount > UINT8_MAX) errorAt(parser.previous, "Can't have more than 255 arguments.");
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RPAREN, "Expected ')' after arguments.");
+
+    lastCall = chunk.code.size();
+    emitBytes(OpCode::CALL, static_cast<uint8_t>(argCount));
+    exprType = StaticType::UNKNOWN;
+}
+
+// `fiber(f, a, b)` makes a fiber that calls f(a, b) when first resumed.
+void Compiler::fiber(bool) {
+    consume(TokenType::LPAREN, "Expected '(' after 'fiber'.");
+    expression();
+
+    uint32_t argCount = 0;
+    while (match(TokenType::COMMA)) {
+        expression();
+        if (++argCount > UINT8_MAX) errorAt(parser.previous, "Can't have more than 255 arguments.");
+    }
+    consume(TokenType::RPAREN, "Expected ')' after fiber arguments.");
+
+    emitBytes(OpCode::FIBER, static_cast<uint8_t>(argCount));
+    exprType = StaticType::UNKNOWN;
+}
+
+// `resume f` is whatever the fiber yields next, or what its function returns.
+void Compiler::resume(bool) {
+    parsePrecedence(Precedence::UNARY);
+    emitByte(OpCode::RESUME);
+    exprType = StaticType::UNKNOWN;
+}
+
+
+void Compiler::useBranchProfile(std::vector<BranchCounts> profile) {
+    branchProfile = std::move(profile);
+}
+
+void Compiler::setSourceName(std::string name) { sourceName = std::move(name); }
+
+void Compiler::setLazyFunctions(const bool lazy) { lazyFunctions = lazy; }
+
+void Compiler::setInlineThreshold(const uint32_t tokens) { inlineThreshold = tokens; }
+
+void Compiler::enableStats() {
+    statsEnabled = true;
+    lazyFunctions = false;
+}
+
+// Sizes of the finished chunk and of every function chunk in its constants.
+void Compiler::recordChunkStats(const Chunk& chunk) {
+    stats->chunks++;
+    stats->codeBytes += chunk.code.size();
+    stats->constants += chunk.constants.size();
+
+    for (size_t offset = 0; offset < chunk.code.size(); offset += chunk.instructionSize(offset)) {
+        switch (chunk.code[offset]) {
+            case OpCode::CONSTANT:
+            case OpCode::GET_GLOBAL:
+            case OpCode::DEF_GLOBAL:
+            case OpCode::SET_GLOBAL: stats->shortConstantOperands++; break;
+
+            case OpCode::CONSTANT_LONG:
+            case OpCode::GET_GLOBAL_LONG:
+            case OpCode::DEF_GLOBAL_LONG:
+            case OpCode::SET_GLOBAL_LONG: stats->longConstantOperands++; break;
+
+            default: break;
+        }
+    }
+
+    for (const Value& constant : chunk.constants) {
+        if (constant.isObjectType(ObjType::FUNCTION) && constant.object()->asFunction()->chunk)
+            recordChunkStats(*constant.object()->asFunction()->chunk);
+    }
+}
+
+CompileStats& CompileStats::operator+=(const CompileStats& other) {
+    scanTime += other.scanTime;
+    compileTime += other.compileTime;
+    emitTime += other.emitTime;
+    tokens += other.tokens;
+    passes += other.passes;
+    inlinedCalls += other.inlinedCalls;
+    locals += other.locals;
+    globals += other.globals;
+    functions += other.functions;
+    chunks += other.chunks;
+    codeBytes += other.codeBytes;
+    constants += other.constants;
+    shortConstantOperands += other.shortConstantOperands;
+    longConstantOperands += other.longConstantOperands;
+    return *this;
+}
+
+bool Compiler::CompileLazy(VM& vm, ObjFunction* function) {
+    const std::unique_ptr<LazyFunction> lazy(function->lazy);
+    function->lazy = nullptr;
+
+    Compiler compiler(vm);
+    compiler.source = lazy->source;
+    compiler.lazyFunctions = true;
+    compiler.stats = lazy->stats;
+    const uint32_t inlinedBefore = compiler.stats->inlinedCalls;
+
+    do {
+        compiler.needsRecompile = false;
+        compiler.state = CompilerState();
+        compiler.globalTypes = lazy->globalTypes;
+        compiler.inlineCandidates = *lazy->inlineCandidates;
+        std::erase_if(compiler.inlineCandidates, [&](const auto& candidate) {
+            return compiler.notInlinable.contains(candidate.first);
+        });
+        compiler.stats->inlinedCalls = inlinedBefore;
+        compiler.scanner = Scanner(*lazy->source, lazy->start, lazy->line);
+
+        compiler.advance();
+        compiler.compileFunction(function);
+    } while (compiler.needsRecompile && !compiler.parser.hadError);
+
+    return !compiler.parser.hadError;
+}
 
 std::pair<InterpretResult, Chunk> Compiler::compile(const std::string& source) {
-    chunk = Chunk();
-    scanner = Scanner(source);
+    this->source = std::make_shared<const std::string>(source);
+    const CompilerState initialState = state;
+    earlierUnguarded = globalTypes->unguarded;
+    const auto initialInlineCandidates = inlineCandidates;
+    const CompileStats initialStats = *stats;
+    const auto compileStart = std::chrono::steady_clock::now();
+    dynamicLocals.clear();
+    notInlinable.clear();
+
+    // Each pass can only demote locals, so this settles after at most one pass per local.
+    do {
+        needsRecompile = false;
+        branchCount = 0;
+        coldBlocks.clear();
+        coldArmStart = -1;
+        state = initialState;
+        passGlobals.clear();
+        inlineCandidates = initialInlineCandidates;
+        std::erase_if(inlineCandidates, [this](const auto& candidate) {
+            return notInlinable.contains(candidate.first);
+        });
+        inlineCandidatesSnapshot.reset();
+        stats->inlinedCalls = initialStats.inlinedCalls;
+        stats->locals = initialStats.locals;
+        stats->globals = initialStats.globals;
+        stats->functions = initialStats.functions;
+        stats->passes++;
+        chunk = Chunk();
+        scanner = Scanner(*this->source);
 
-    advance();
+        advance();
 
-    while (!match(TokenType::EOF)) { declaration(); }
+        while (!match(TokenType::EOF)) { declaration(); }
+        stats->tokens += scanner.tokenCount();
+    } while (needsRecompile && !parser.hadError);
 
     endCompiler();
 
+    if (statsEnabled) {
+        stats->compileTime += std::chrono::steady_clock::now() - compileStart -
+            (stats->scanTime - initialStats.scanTime);
+        if (!parser.hadError) recordChunkStats(chunk);
+    }
+
     InterpretResult result = parser.hadError ? InterpretResult::COMPILE_ERROR : InterpretResult::OK;
     return {result, chunk};
 }
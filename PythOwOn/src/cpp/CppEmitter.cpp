@@ -0,0 +1,444 @@
+#include "CppEmitter.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.hpp"
+#include "Object.hpp"
+#include "Value.hpp"
+
+
+namespace {
+// A chunk to translate: the script's, as number 0, or a function's.
+struct Unit {
+    const Chunk* chunk;
+    const ObjFunction* function; // nullptr for the script
+};
+
+class CppEmitter {
+public:
+    explicit CppEmitter(const Chunk& script) { collect(script, nullptr); }
+
+    std::string emit(const std::string& sourceName);
+
+private:
+    std::vector<Unit> units;
+    std::unordered_map<const ObjFunction*, size_t> unitOf;
+    std::string out;
+
+    template <typename... Ts>
+    void line(const std::string& format, Ts&&... args) {
+        fmt::format_to(std::back_inserter(out), fmt::runtime(format), std::forward<Ts>(args)...);
+        out += '\n';
+    }
+
+    void collect(const Chunk& chunk, const ObjFunction* function);
+    [[nodiscard]] std::string constant(Value value) const;
+    void emitConstants();
+    void emitUnit(size_t index);
+    void emitInstruction(const Unit& unit, size_t index, size_t offset, int32_t depth);
+};
+
+// Numbers the script and each function in the order they are found.
+void CppEmitter::collect(const Chunk& chunk, const ObjFunction* function) {
+    units.push_back({&chunk, function});
+    if (function != nullptr) unitOf[function] = units.size() - 1;
+
+    for (const Value& constant : chunk.constants) {
+        if (!constant.isObjectType(ObjType::FUNCTION)) continue;
+
+        const ObjFunction* inner = constant.object()->asFunction();
+        if (inner->chunk != nullptr && !unitOf.contains(inner)) collect(*inner->chunk, inner);
+    }
+}
+
+// Escapes every byte that isn't plainly printable, so that any string survives.
+std::string stringLiteral(const std::string& str) {
+    std::string literal = "\"";
+    for (const char c : str) {
+        const auto byte = static_cast<uint8_t>(c);
+        if (byte >= 0x20 && byte < 0x7f && c != '"' && c != '\\') literal += c;
+        else literal += FMT_FORMAT("\\{:03o}", byte);
+    }
+    return literal + "\"";
+}
+
+std::string CppEmitter::constant(const Value value) const {
+    switch (value.valueType()) {
+        case ValueType::NONE: return "Value::NoneVal()";
+        case ValueType::BOOL:
+            return value.boolean() ? "Value::BoolVal(true)" : "Value::BoolVal(false)";
+        case ValueType::INT:
+            if (value.integer() == INTMAX_MIN) return "Value::IntegerVal(INTMAX_MIN)";
+            return FMT_FORMAT("Value::IntegerVal({})", value.integer());
+        case ValueType::DOUBLE:
+            return FMT_FORMAT("Value::DoubleVal(std::bit_cast<double>(0x{:016x}ull))",
+                              std::bit_cast<uint64_t>(value.decimal()));
+        case ValueType::INFINITY: return FMT_FORMAT("Value::Infinity({})", value.boolean());
+        case ValueType::NAN: return FMT_FORMAT("Value::Nan({})", value.boolean());
+        case ValueType::OBJECT: break;
+    }
+
+    if (value.isObjectType(ObjType::FUNCTION))
+        return FMT_FORMAT("Value::ObjectVal(fn{})", unitOf.at(value.object()->asFunction()));
+
+    const std::string& str = value.object()->asString()->str;
+    return FMT_FORMAT("Value::ObjectVal(ObjString::Create(vm, std::string({}, {})))",
+                      stringLiteral(str), str.size());
+}
+
+// Functions are all created first, since any chunk's constants may refer to any of them.
+void CppEmitter::emitConstants() {
+    line("void loadConstants(VM& vm) {{");
+    for (size_t i = 1; i < units.size(); i++) {
+        const ObjFunction* function = units[i].function;
+        line("    ObjFunction* fn{} = ObjFunction::Create(vm, ObjString::Create(vm, {}));", i,
+             stringLiteral(function->name->str));
+        line("    fn{}->arity = {};", i, function->arity);
+        line("    fn{}->native = f{};", i, i);
+    }
+
+    for (size_t i = 0; i < units.size(); i++) {
+        const std::vector<Value>& constants = units[i].chunk->constants;
+        for (size_t k = 0; k < constants.size(); k++)
+            line("    k{}[{}] = {};", i, k, constant(constants[k]));
+    }
+    line("}}");
+}
+
+void CppEmitter::emitUnit(const size_t index) {
+    const Unit& unit = units[index];
+    const Chunk& chunk = *unit.chunk;
+    const int32_t entryDepth = unit.function != nullptr ? unit.function->arity + 1 : 0;
+
+    // Jumps only go to instructions the compiler started a block at, and reach them with
+    // the depth found the way Chunk::stackDepthAt finds it.
+    std::set<size_t> targets;
+    for (size_t offset = 0; offset < chunk.code.size(); offset += chunk.instructionSize(offset)) {
+        const size_t next = offset + chunk.instructionSize(offset);
+        switch (chunk.code[offset]) {
+            case OpCode::JUMP:
+            case OpCode::JUMP_FALSE:
+            case OpCode::JUMP_TRUE:
+                targets.insert(next + (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]));
+                break;
+            case OpCode::LOOP:
+            case OpCode::JUMP_BACK:
+                targets.insert(next - (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]));
+                break;
+            case OpCode::FOR_RANGE:
+                targets.insert(next + (chunk.code[offset + 2] << 8 | chunk.code[offset + 3]));
+                break;
+            default: break;
+        }
+    }
+
+    line("");
+    if (unit.function == nullptr) line("// The script.");
+    else line("// fwunction {}, {} argument(s).", unit.function->name->str, unit.function->arity);
+    line("bool f{}(AotRuntime& rt, Value* s) {{", index);
+    line("    [[maybe_unused]] VM& vm = rt.vm;");
+
+    std::unordered_map<size_t, int32_t> targetDepths;
+    int32_t depth = entryDepth;
+    size_t sourceLine = 0;
+    for (size_t offset = 0; offset < chunk.code.size(); offset += chunk.instructionSize(offset)) {
+        if (const auto target = targetDepths.find(offset); target != targetDepths.end())
+            depth = target->second;
+
+        if (targets.contains(offset)) line("L{}:;", offset);
+        if (chunk.lines[offset] != sourceLine) {
+            sourceLine = chunk.lines[offset];
+            line("    // line {}", sourceLine);
+        }
+
+        switch (chunk.code[offset]) {
+            case OpCode::JUMP:
+            case OpCode::JUMP_FALSE:
+            case OpCode::JUMP_TRUE: {
+                const size_t jump = chunk.code[offset + 1] << 8 | chunk.code[offset + 2];
+                targetDepths.try_emplace(offset + 3 + jump, depth);
+                break;
+            }
+
+            case OpCode::FOR_RANGE: {
+                const size_t jump = chunk.code[offset + 2] << 8 | chunk.code[offset + 3];
+                targetDepths.try_emplace(offset + 4 + jump, depth);
+                break;
+            }
+
+            default: break;
+        }
+
+        emitInstruction(unit, index, offset, depth);
+        depth += chunk.stackEffect(offset);
+    }
+
+    line("}}");
+}
+
+std::string doubleBinary(const int32_t d, const char* op) {
+    return FMT_FORMAT("    s[{0}] = Value::DoubleVal(s[{0}].real() {1} s[{2}].real());", d - 2, op,
+                      d - 1);
+}
+
+// `d` is the depth of the stack before the instruction. Errors are reported at the line
+// of what follows the instruction, which is where VM::Run's ip points by then.
+void CppEmitter::emitInstruction(const Unit& unit, const size_t index, const size_t offset,
+                                 const int32_t d) {
+    const Chunk& chunk = *unit.chunk;
+    const size_t size = chunk.instructionSize(offset);
+    const size_t next = offset + size;
+    const size_t at = chunk.lines[std::min(next, chunk.code.size() - 1)];
+    const uint32_t operand = size == 1 ? 0
+                             : size != 5 ? chunk.code[offset + 1]
+                             : static_cast<uint32_t>(chunk.code[offset + 1]) << 24 |
+                             chunk.code[offset + 2] << 16 | chunk.code[offset + 3] << 8 |
+                             chunk.code[offset + 4];
+    const size_t jump = size < 3 ? 0 : chunk.code[offset + 1] << 8 | chunk.code[offset + 2];
+
+    const auto binary = [&](const char* op) {
+        line("    if (const char* e = Operators::applyBinary<Operators::{}>(vm, s + {})) "
+             "return rt.error({}, e);", op, d, at);
+    };
+    const auto intBinary = [&](const char* op) {
+        line("    if (const std::optional<Value> r = Value::{0}Integers(s[{1}].integer(), "
+             "s[{2}].integer())) s[{1}] = *r;", op, d - 2, d - 1);
+        line("    else return rt.error({}, Operators::overflowError);", at);
+    };
+    const auto global = [&] {
+        line("    if (g{0}_{1} == nullptr && (g{0}_{1} = rt.global(k{0}[{1}], {2})) == nullptr) "
+             "return false;", index, operand, at);
+    };
+    const auto step = [&](const char* name, const char* by) {
+        line("    if (const char* e = Operators::step(s[{}], {}, \"Can only {} numbers.\")) "
+             "return rt.error({}, e);", d - 1, by, name, at);
+    };
+
+    switch (chunk.code[offset]) {
+        case OpCode::CONSTANT:
+        case OpCode::CONSTANT_LONG: line("    s[{}] = k{}[{}];", d, index, operand);
+            break;
+        case OpCode::NONE: line("    s[{}] = Value::NoneVal();", d);
+            break;
+        case OpCode::TRUE: line("    s[{}] = Value::BoolVal(true);", d);
+            break;
+        case OpCode::FALSE: line("    s[{}] = Value::BoolVal(false);", d);
+            break;
+
+        case OpCode::POP:
+        case OpCode::POPN: break;
+
+        case OpCode::GET_LOCAL:
+        case OpCode::GET_LOCAL_LONG: line("    s[{}] = s[{}];", d, operand);
+            break;
+        case OpCode::SET_LOCAL:
+        case OpCode::SET_LOCAL_LONG: line("    s[{}] = s[{}];", operand, d - 1);
+            break;
+        case OpCode::DUP: line("    s[{}] = s[{}];", d, d - 1);
+            break;
+
+        case OpCode::GET_GLOBAL:
+        case OpCode::GET_GLOBAL_LONG: global();
+            line("    s[{}] = *g{}_{};", d, index, operand);
+            break;
+        case OpCode::SET_GLOBAL:
+        case OpCode::SET_GLOBAL_LONG: global();
+            line("    *g{}_{} = s[{}];", index, operand, d - 1);
+            break;
+        case OpCode::DEF_GLOBAL:
+        case OpCode::DEF_GLOBAL_LONG:
+            line("    vm.DefineGlobal(k{}[{}].object()->asString(), s[{}]);", index, operand,
+                 d - 1);
+            break;
+
+        case OpCode::EQUAL:
+            line("    s[{0}] = Value::BoolVal(s[{0}].isEqualTo(s[{1}]));", d - 2, d - 1);
+            break;
+        case OpCode::GREATER: binary("Greater");
+            break;
+        case OpCode::LESS: binary("Less");
+            break;
+        case OpCode::ADD: binary("Add");
+            break;
+        case OpCode::SUBTRACT:
+            line("    if (const char* e = Operators::negate(s[{}])) return rt.error({}, e);", d - 1,
+                 at);
+            binary("Add");
+            break;
+        case OpCode::MULTIPLY: binary("Multiply");
+            break;
+        case OpCode::DIVIDE: binary("Divide");
+            break;
+        case OpCode::LEFTSHIFT: binary("LeftShift");
+            break;
+        case OpCode::RIGHTSHIFT: binary("RightShift");
+            break;
+        case OpCode::MODULO: binary("Modulo");
+            break;
+        case OpCode::NEGATE:
+            line("    if (const char* e = Operators::negate(s[{}])) return rt.error({}, e);", d - 1,
+                 at);
+            break;
+        case OpCode::NOT: line("    s[{0}] = Value::BoolVal(s[{0}].isFalsey());", d - 1);
+            break;
+        case OpCode::INC: step("increment", "1");
+            break;
+        case OpCode::DEC: step("decrement", "-1");
+            break;
+
+        case OpCode::ADD_INT: intBinary("Add");
+            break;
+        case OpCode::ADD_DOUBLE: line(doubleBinary(d, "+"));
+            break;
+        case OpCode::SUBTRACT_INT: intBinary("Subtract");
+            break;
+        case OpCode::SUBTRACT_DOUBLE: line(doubleBinary(d, "-"));
+            break;
+        case OpCode::MULTIPLY_INT: intBinary("Multiply");
+            break;
+        case OpCode::MULTIPLY_DOUBLE: line(doubleBinary(d, "*"));
+            break;
+        case OpCode::LESS_INT:
+        case OpCode::LESS_DOUBLE:
+        case OpCode::GREATER_INT:
+        case OpCode::GREATER_DOUBLE: {
+            const uint8_t op = chunk.code[offset];
+            const bool isInt = op == OpCode::LESS_INT || op == OpCode::GREATER_INT;
+            const bool less = op == OpCode::LESS_INT || op == OpCode::LESS_DOUBLE;
+            line("    s[{0}] = Value::BoolVal(s[{0}].{1}() {2} s[{3}].{1}());", d - 2,
+                 isInt ? "integer" : "real", less ? "<" : ">", d - 1);
+            break;
+        }
+
+        case OpCode::CONCAT_STR:
+            line("    s[{0}] = Value::ObjectVal(ObjString::Create(vm, "
+                 "s[{0}].object()->asString()->str + s[{1}].object()->asString()->str));",
+                 d - 2, d - 1);
+            break;
+        case OpCode::BUILD_STRING:
+            line("    s[{}] = Operators::buildString(vm, s + {}, {});", d - operand, d, operand);
+            break;
+        case OpCode::CHECK_TYPE:
+            line("    if (!s[{}].isOfStaticType(static_cast<StaticType>({}))) "
+                 "return rt.error({}, \"Expected a value of type '{}'.\");", d - 1, operand, at,
+                 StaticTypeName(static_cast<StaticType>(operand)));
+            break;
+        case OpCode::PRINT:
+            line("    printValue(s[{}]);", d - 1);
+            line("    FMT_PRINT(\"\\n\");");
+            break;
+
+        case OpCode::JUMP: line("    goto L{};", next + jump);
+            break;
+        case OpCode::JUMP_FALSE: line("    if (s[{}].isFalsey()) goto L{};", d - 1, next + jump);
+            break;
+        case OpCode::JUMP_TRUE: line("    if (!s[{}].isFalsey()) goto L{};", d - 1, next + jump);
+            break;
+        case OpCode::LOOP:
+        case OpCode::JUMP_BACK: line("    goto L{};", next - jump);
+            break;
+        case OpCode::FOR_RANGE:
+            line("    {{");
+            line("        const char* error;");
+            line("        const Operators::RangeStep next = Operators::forRange(s + {}, error);",
+                 operand);
+            line("        if (next == Operators::RangeStep::DONE) goto L{};",
+                 next + (chunk.code[offset + 2] << 8 | chunk.code[offset + 3]));
+            line("        if (next == Operators::RangeStep::ERROR) return rt.error({}, error);",
+                 at);
+            line("    }}");
+            break;
+
+        case OpCode::CALL:
+            line("    if (!rt.call(s + {}, {}, {})) return false;", d - operand - 1, operand, at);
+            break;
+        case OpCode::TAIL_CALL:
+            line("    return rt.tailCall(s, s + {}, {}, {});", d - operand - 1, operand, at);
+            break;
+        case OpCode::RETURN:
+            if (unit.function == nullptr) {
+                if (d > 0) line("    printValue(s[{}]);", d - 1);
+                line("    FMT_PRINT(\"\\n\");");
+            } else line("    s[0] = s[{}];", d - 1);
+            line("    return true;");
+            break;
+
+        // A fiber would have to switch away from frames that live on the C++ stack.
+        case OpCode::FIBER:
+        case OpCode::RESUME:
+        case OpCode::YIELD:
+            line("    return rt.error({}, \"Fibers can't run in programs from --emit-cpp.\");", at);
+            break;
+
+        // VM::Run gives up on opcodes it doesn't run, without a message.
+        default: line("    return false;");
+            break;
+    }
+}
+
+std::string CppEmitter::emit(const std::string& sourceName) {
+    line("// Generated by PythOwOn --emit-cpp from {}.", stringLiteral(sourceName));
+    line("// Build it with the defines the PythOwOnRuntime library was built with, and link it");
+    line("// against that library and fmt.");
+    line("#include \"AotRuntime.hpp\"");
+    line("");
+    line("");
+    line("namespace {{");
+
+    for (size_t i = 0; i < units.size(); i++) {
+        const Chunk& chunk = *units[i].chunk;
+        if (!chunk.constants.empty()) line("Value k{}[{}];", i, chunk.constants.size());
+
+        // One cached address per global a unit reads or writes, as GET_GLOBAL_CACHED has.
+        std::set<uint32_t> globals;
+        const std::vector<uint8_t>& code = chunk.code;
+        for (size_t offset = 0; offset < code.size(); offset += chunk.instructionSize(offset)) {
+            switch (code[offset]) {
+                case OpCode::GET_GLOBAL:
+                case OpCode::SET_GLOBAL: globals.insert(code[offset + 1]);
+                    break;
+                case OpCode::GET_GLOBAL_LONG:
+                case OpCode::SET_GLOBAL_LONG:
+                    globals.insert(static_cast<uint32_t>(code[offset + 1]) << 24 |
+                                   code[offset + 2] << 16 | code[offset + 3] << 8 |
+                                   code[offset + 4]);
+                    break;
+                default: break;
+            }
+        }
+        for (const uint32_t global : globals) line("Value* g{}_{} = nullptr;", i, global);
+    }
+
+    line("");
+    for (size_t i = 0; i < units.size(); i++) line("bool f{}(AotRuntime& rt, Value* s);", i);
+    line("");
+    emitConstants();
+    for (size_t i = 0; i < units.size(); i++) emitUnit(i);
+    line("}} // namespace");
+
+    uint32_t functionDepth = 0;
+    for (size_t i = 1; i < units.size(); i++) {
+        functionDepth = std::max(functionDepth, units[i].chunk->maxStackDepth(
+                                     static_cast<int32_t>(units[i].function->arity) + 1));
+    }
+
+    line("");
+    line("int main() {{");
+    line("    VM vm;");
+    line("    AotRuntime runtime(vm);");
+    line("    loadConstants(vm);");
+    line("    return runtime.run(f0, {}, {});", units[0].chunk->maxStackDepth(0), functionDepth);
+    line("}}");
+    return std::move(out);
+}
+} // namespace
+
+std::string emitCpp(const Chunk& script, const std::string& sourceName) {
+    return CppEmitter(script).emit(sourceName);
+}
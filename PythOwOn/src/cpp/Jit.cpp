@@ -0,0 +1,561 @@
+#include "Jit.hpp"
+
+#if defined(HAS_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <optional>
+
+#include "Common.hpp"
+
+
+namespace {
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11 };
+enum Cond : uint8_t { OF = 0x0, EQ = 0x4, NE = 0x5, LT = 0xc, GE = 0xd, LE = 0xe, GT = 0xf };
+
+// [base + disp]. No base is ever RSP or R12, so none of them need a SIB byte.
+struct Mem {
+    Reg base;
+    int32_t disp;
+
+    [[nodiscard]] Mem operator+(const int32_t more) const { return {base, disp + more}; }
+};
+
+// Just enough of an x86-64 assembler for what LoopCompiler emits.
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    [[nodiscard]] size_t here() const { return code.size(); }
+
+    void load(const Reg dst, const Mem src) { op(true, 0x8b, dst, src); }
+    void store(const Mem dst, const Reg src) { op(true, 0x89, src, dst); }
+    void lea(const Reg dst, const Mem src) { op(true, 0x8d, dst, src); }
+    void storeByte(const Mem dst, const uint8_t imm) { op(false, 0xc6, RAX, dst), byte(imm); }
+    void cmpByte(const Mem m, const uint8_t imm) { op(false, 0x80, RDI, m), byte(imm); } // /7
+
+    void moveImm(const Reg dst, const uint64_t imm) {
+        rex(true, RAX, dst);
+        byte(0xb8 + (dst & 7));
+        bytes(imm, 8);
+    }
+
+    void moveImm32(const Reg dst, const uint32_t imm) {
+        rex(false, RAX, dst);
+        byte(0xb8 + (dst & 7));
+        bytes(imm, 4);
+    }
+
+    void move(const Reg dst, const Reg src) { regs(0x89, src, dst); }
+    void add(const Reg dst, const Reg src) { regs(0x01, src, dst); }
+    void sub(const Reg dst, const Reg src) { regs(0x29, src, dst); }
+    void bitOr(const Reg dst, const Reg src) { regs(0x09, src, dst); }
+    void cmp(const Reg a, const Reg b) { regs(0x39, b, a); }
+    void test(const Reg a, const Reg b) { regs(0x85, b, a); }
+
+    void imul(const Reg dst, const Reg src) {
+        rex(true, dst, src);
+        byte(0x0f), byte(0xaf), byte(0xc0 | (dst & 7) << 3 | (src & 7));
+    }
+
+    void shl(const Reg r, const uint8_t n) { shift(4, r, n); }
+    void shr(const Reg r, const uint8_t n) { shift(5, r, n); }
+    void sar(const Reg r, const uint8_t n) { shift(7, r, n); }
+
+    void cmpImm(const Reg r, const int32_t imm) {
+        rex(true, RAX, r);
+        byte(0x81), byte(0xc0 | 7 << 3 | (r & 7));
+        bytes(static_cast<uint32_t>(imm), 4);
+    }
+
+    // eax = the condition, as 0 or 1.
+    void setEax(const Cond cond) {
+        byte(0x0f), byte(0x90 + cond), byte(0xc0);
+        byte(0x0f), byte(0xb6), byte(0xc0);
+    }
+
+    // Both return where the rel32 is, for patch.
+    size_t jcc(const Cond cond) {
+        byte(0x0f), byte(0x80 + cond);
+        bytes(0, 4);
+        return here() - 4;
+    }
+
+    size_t jmp() {
+        byte(0xe9);
+        bytes(0, 4);
+        return here() - 4;
+    }
+
+    void patch(const size_t at, const size_t target) {
+        const auto rel = static_cast<int32_t>(static_cast<ptrdiff_t>(target) -
+                                              static_cast<ptrdiff_t>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+
+    void ret() { byte(0xc3); }
+
+private:
+    void byte(const uint8_t b) { code.push_back(b); }
+
+    void bytes(uint64_t value, const int count) {
+        for (int i = 0; i < count; i++, value >>= 8) byte(value & 0xff);
+    }
+
+    void rex(const bool wide, const Reg reg, const Reg rm) {
+        const uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+        if (prefix != 0x40) byte(prefix);
+    }
+
+    void op(const bool wide, const uint8_t opcode, const Reg reg, const Mem m) {
+        rex(wide, reg, m.base);
+        byte(opcode), byte(0x80 | (reg & 7) << 3 | (m.base & 7));
+        bytes(static_cast<uint32_t>(m.disp), 4);
+    }
+
+    void regs(const uint8_t opcode, const Reg reg, const Reg rm) {
+        rex(true, reg, rm);
+        byte(opcode), byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    void shift(const uint8_t ext, const Reg r, const uint8_t n) {
+        rex(true, RAX, r);
+        byte(0xc1), byte(0xc0 | ext << 3 | (r & 7)), byte(n);
+    }
+};
+
+// The generated code is entered as JitCode: RDI holds the frame's slots and RSI where
+// to leave the top of the stack. Neither is touched, and only caller-saved registers are
+// used, so no prologue is needed and any instruction can be an entry point. Stack depths
+// are known at every instruction, so values are addressed from RDI and the top is only
+// written on the way out.
+class LoopCompiler {
+public:
+    LoopCompiler(const Chunk& chunk, const std::unordered_map<ObjString, Value>& globals)
+        : chunk(chunk), globals(globals) {}
+
+    // Returns the code and the entry point's offset into it.
+    std::optional<std::pair<std::vector<uint8_t>, size_t>>
+    compile(size_t loopOffset, int32_t entryDepth, int32_t depth);
+
+private:
+#if defined(NAN_BOXING)
+    static constexpr int32_t VALUE_SIZE = 8;
+    static constexpr uint64_t INT_BITS = Value::QNAN | Value::TAG_INT;
+    static constexpr uint64_t BOOL_BITS = Value::QNAN | Value::TAG_BOOL;
+#else
+    static constexpr int32_t VALUE_SIZE = sizeof(Value);
+    static constexpr int32_t TYPE = offsetof(Value, type);
+    static constexpr int32_t PAYLOAD = offsetof(Value, as);
+#endif
+
+    const Chunk& chunk;
+    const std::unordered_map<ObjString, Value>& globals;
+    Assembler a;
+
+    size_t regionStart = 0;
+    size_t regionEnd = 0;
+    std::unordered_map<size_t, size_t> positions; // bytecode offset -> code offset
+    std::vector<std::pair<size_t, size_t>> forwardJumps; // rel32 to patch, bytecode target
+    std::map<std::pair<size_t, int32_t>, std::vector<size_t>> exits; // (offset, depth)
+    std::unordered_map<size_t, int32_t> targetDepths;
+
+    [[nodiscard]] static Mem slot(const int32_t index) { return {RDI, index * VALUE_SIZE}; }
+
+    [[nodiscard]] uint32_t operand(const size_t at, const bool wide) const {
+        if (!wide) return chunk.code[at];
+        return static_cast<uint32_t>(chunk.code[at]) << 24 | chunk.code[at + 1] << 16 |
+            chunk.code[at + 2] << 8 | chunk.code[at + 3];
+    }
+
+    [[nodiscard]] bool inRegion(const size_t offset) const {
+        return offset >= regionStart && offset < regionEnd;
+    }
+
+    // Hands back to the interpreter at `offset`, with `depth` values in the frame.
+    void exitIf(const Cond cond, const size_t offset, const int32_t depth) {
+        exits[{offset, depth}].push_back(a.jcc(cond));
+    }
+
+    void exitAlways(const size_t offset, const int32_t depth) {
+        exits[{offset, depth}].push_back(a.jmp());
+    }
+
+    void jumpTo(const std::optional<Cond> cond, const size_t target, const int32_t depth) {
+        if (!inRegion(target)) {
+            if (cond) exitIf(*cond, target, depth);
+            else exitAlways(target, depth);
+            return;
+        }
+
+        const size_t at = cond ? a.jcc(*cond) : a.jmp();
+        if (const auto known = positions.find(target); known != positions.end())
+            a.patch(at, known->second);
+        else forwardJumps.emplace_back(at, target);
+        targetDepths.try_emplace(target, depth);
+    }
+
+    void copy(const Mem dst, const Mem src) {
+        for (int32_t word = 0; word < VALUE_SIZE; word += 8) {
+            a.load(R10, src + word);
+            a.store(dst + word, R10);
+        }
+    }
+
+    void storeValue(const Mem dst, const Value value) {
+        uint64_t words[VALUE_SIZE / 8];
+        std::memcpy(words, &value, sizeof(words));
+        for (int32_t word = 0; word < VALUE_SIZE / 8; word++) {
+            a.moveImm(R10, words[word]);
+            a.store(dst + word * 8, R10);
+        }
+    }
+
+    void loadInt(const Reg dst, const Mem src) {
+#if defined(NAN_BOXING)
+        a.load(dst, src);
+        a.shl(dst, 16);
+        a.sar(dst, 16);
+#else
+        a.load(dst, src + PAYLOAD);
+#endif
+    }
+
+    // Clobbers `src` and RCX.
+    void storeInt(const Mem dst, const Reg src) {
+#if defined(NAN_BOXING)
+        a.shl(src, 16);
+        a.shr(src, 16);
+        a.moveImm(RCX, INT_BITS);
+        a.bitOr(src, RCX);
+        a.store(dst, src);
+#else
+        a.storeByte(dst + TYPE, static_cast<uint8_t>(ValueType::INT));
+        a.store(dst + PAYLOAD, src);
+#endif
+    }
+
+    void storeCondition(const Mem dst, const Cond cond) {
+        a.setEax(cond);
+#if defined(NAN_BOXING)
+        a.moveImm(RCX, BOOL_BITS);
+        a.bitOr(RAX, RCX);
+        a.store(dst, RAX);
+#else
+        a.storeByte(dst + TYPE, static_cast<uint8_t>(ValueType::BOOL));
+        a.store(dst + PAYLOAD, RAX);
+#endif
+    }
+
+    // Leaves an int result that doesn't fit in 48 bits, see Value::INTEGER_MAX, to the
+    // interpreter, which reports it. Clobbers RCX.
+    void guardFits(const Reg r, const size_t offset, const int32_t depth) {
+        a.move(RCX, r);
+        a.shl(RCX, 16);
+        a.sar(RCX, 16);
+        a.cmp(RCX, r);
+        exitIf(NE, offset, depth);
+    }
+
+    void guardInt(const Mem m, const size_t offset, const int32_t depth) {
+#if defined(NAN_BOXING)
+        a.load(RCX, m);
+        a.shr(RCX, 48);
+        a.cmpImm(RCX, static_cast<int32_t>(INT_BITS >> 48));
+#else
+        a.cmpByte(m + TYPE, static_cast<uint8_t>(ValueType::INT));
+#endif
+        exitIf(NE, offset, depth);
+    }
+
+    // Jumps when the bool at `m` is `when`. Anything but a bool goes back to the
+    // interpreter, which knows how truthy it is.
+    void branchOnBool(const Mem m, const bool when, const size_t target, const size_t offset,
+                      const int32_t depth) {
+#if defined(NAN_BOXING)
+        a.load(RAX, m);
+        a.moveImm(RCX, BOOL_BITS | when);
+        a.cmp(RAX, RCX);
+        jumpTo(EQ, target, depth);
+        a.moveImm(RCX, BOOL_BITS | !when);
+        a.cmp(RAX, RCX);
+        exitIf(NE, offset, depth);
+#else
+        a.cmpByte(m + TYPE, static_cast<uint8_t>(ValueType::BOOL));
+        exitIf(NE, offset, depth);
+        a.cmpByte(m + PAYLOAD, 0);
+        jumpTo(when ? NE : EQ, target, depth);
+#endif
+    }
+
+    void binary(uint8_t op, size_t offset, int32_t depth, bool guarded);
+    void forRange(size_t offset, int32_t depth);
+    [[nodiscard]] bool global(uint8_t op, size_t offset, int32_t depth);
+    void instruction(size_t offset, int32_t depth);
+};
+
+void LoopCompiler::binary(const uint8_t op, const size_t offset, const int32_t depth,
+                          const bool guarded) {
+    const Mem left = slot(depth - 2);
+    const Mem right = slot(depth - 1);
+    if (guarded) {
+        guardInt(left, offset, depth);
+        guardInt(right, offset, depth);
+    }
+
+    loadInt(RAX, left);
+    loadInt(R8, right);
+    switch (op) {
+        case OpCode::ADD:
+        case OpCode::ADD_INT:
+        case OpCode::ADD_INT_INT: a.add(RAX, R8);
+            guardFits(RAX, offset, depth);
+            storeInt(left, RAX);
+            break;
+        case OpCode::SUBTRACT:
+        case OpCode::SUBTRACT_INT: a.sub(RAX, R8);
+            guardFits(RAX, offset, depth);
+            storeInt(left, RAX);
+            break;
+        case OpCode::MULTIPLY:
+        case OpCode::MULTIPLY_INT: a.imul(RAX, R8);
+            exitIf(OF, offset, depth);
+            guardFits(RAX, offset, depth);
+            storeInt(left, RAX);
+            break;
+        case OpCode::LESS:
+        case OpCode::LESS_INT:
+        case OpCode::LESS_INT_INT: a.cmp(RAX, R8), storeCondition(left, LT);
+            break;
+        default: a.cmp(RAX, R8), storeCondition(left, GT);
+            break;
+    }
+}
+
+// Only the all-int form. A step of zero is left to the interpreter to report.
+void LoopCompiler::forRange(const size_t offset, const int32_t depth) {
+    const int32_t counter = chunk.code[offset + 1];
+    const size_t exit = offset + 4 + (chunk.code[offset + 2] << 8 | chunk.code[offset + 3]);
+
+    for (int32_t i = 0; i < 3; i++) guardInt(slot(counter + i), offset, depth);
+    loadInt(RAX, slot(counter));
+    loadInt(R8, slot(counter + 1));
+    loadInt(R9, slot(counter + 2));
+    a.test(R9, R9);
+    exitIf(EQ, offset, depth);
+
+    const size_t downwards = a.jcc(LT);
+    a.cmp(RAX, R8);
+    jumpTo(GE, exit, depth);
+    const size_t body = a.jmp();
+    a.patch(downwards, a.here());
+    a.cmp(RAX, R8);
+    jumpTo(LE, exit, depth);
+    a.patch(body, a.here());
+
+    a.add(RAX, R9);
+    guardFits(RAX, offset, depth);
+    copy(slot(counter + 3), slot(counter));
+    storeInt(slot(counter), RAX);
+}
+
+// Globals are never removed, so one that exists now keeps its address.
+bool LoopCompiler::global(const uint8_t op, const size_t offset, const int32_t depth) {
+    const Value* address;
+    if (op == OpCode::GET_GLOBAL_CACHED) address = chunk.globalSlots[chunk.code[offset + 1]];
+    else {
+        const bool wide = chunk.instructionSize(offset) == 5;
+        const Value name = chunk.constants[operand(offset + 1, wide)];
+        const auto found = globals.find(*name.object()->asString());
+        if (found == globals.end()) return false;
+        address = &found->second;
+    }
+
+    a.moveImm(RDX, reinterpret_cast<uintptr_t>(address));
+    if (op == OpCode::SET_GLOBAL || op == OpCode::SET_GLOBAL_LONG)
+        copy({RDX, 0}, slot(depth - 1));
+    else copy(slot(depth), {RDX, 0});
+    return true;
+}
+
+void LoopCompiler::instruction(const size_t offset, const int32_t depth) {
+    const uint8_t op = chunk.code[offset];
+    const size_t next = offset + chunk.instructionSize(offset);
+    const bool wide = chunk.instructionSize(offset) == 5;
+
+    switch (op) {
+        case OpCode::CONSTANT:
+        case OpCode::CONSTANT_LONG:
+            storeValue(slot(depth), chunk.constants[operand(offset + 1, wide)]);
+            break;
+        case OpCode::NONE: storeValue(slot(depth), Value::NoneVal());
+            break;
+        case OpCode::TRUE: storeValue(slot(depth), Value::BoolVal(true));
+            break;
+        case OpCode::FALSE: storeValue(slot(depth), Value::BoolVal(false));
+            break;
+
+        case OpCode::POP:
+        case OpCode::POPN: break;
+
+        case OpCode::GET_LOCAL:
+        case OpCode::GET_LOCAL_LONG:
+            copy(slot(depth), slot(static_cast<int32_t>(operand(offset + 1, wide))));
+            break;
+        case OpCode::SET_LOCAL:
+        case OpCode::SET_LOCAL_LONG:
+            copy(slot(static_cast<int32_t>(operand(offset + 1, wide))), slot(depth - 1));
+            break;
+        case OpCode::DUP: copy(slot(depth), slot(depth - 1));
+            break;
+
+        case OpCode::GET_GLOBAL:
+        case OpCode::GET_GLOBAL_LONG:
+        case OpCode::GET_GLOBAL_CACHED:
+        case OpCode::SET_GLOBAL:
+        case OpCode::SET_GLOBAL_LONG:
+            if (!global(op, offset, depth)) exitAlways(offset, depth);
+            break;
+
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::LESS:
+        case OpCode::GREATER:
+        case OpCode::ADD_INT_INT:
+        case OpCode::LESS_INT_INT:
+        case OpCode::GREATER_INT_INT: binary(op, offset, depth, true);
+            break;
+
+        // The compiler has proven these operands to be ints.
+        case OpCode::ADD_INT:
+        case OpCode::SUBTRACT_INT:
+        case OpCode::MULTIPLY_INT:
+        case OpCode::LESS_INT:
+        case OpCode::GREATER_INT: binary(op, offset, depth, false);
+            break;
+
+        case OpCode::JUMP:
+            jumpTo(std::nullopt, next + (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]),
+                   depth);
+            break;
+        case OpCode::JUMP_FALSE:
+        case OpCode::JUMP_TRUE:
+            branchOnBool(slot(depth - 1), op == OpCode::JUMP_TRUE,
+                         next + (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]), offset,
+                         depth);
+            break;
+        case OpCode::LOOP:
+        case OpCode::LOOP_JIT:
+            jumpTo(std::nullopt, next - (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]),
+                   depth);
+            break;
+        case OpCode::FOR_RANGE: forRange(offset, depth);
+            break;
+
+        default: exitAlways(offset, depth);
+            break;
+    }
+}
+
+std::optional<std::pair<std::vector<uint8_t>, size_t>>
+LoopCompiler::compile(const size_t loopOffset, const int32_t entryDepth, const int32_t depth) {
+    const auto backTarget = [this](const size_t offset) {
+        return offset + 3 - (chunk.code[offset + 1] << 8 | chunk.code[offset + 2]);
+    };
+
+    // The loop runs from where its LOOP jumps back to, and takes in any loop that jumps
+    // back further from inside it, like the increment clause of a for loop.
+    const size_t entry = backTarget(loopOffset);
+    regionStart = entry;
+    regionEnd = loopOffset + 3;
+    for (bool grew = true; grew;) {
+        grew = false;
+        for (size_t offset = regionStart; offset < regionEnd && !grew;
+             offset += chunk.instructionSize(offset)) {
+            const uint8_t op = chunk.code[offset];
+            if ((op == OpCode::LOOP || op == OpCode::LOOP_JIT) &&
+                backTarget(offset) < regionStart) {
+                regionStart = backTarget(offset);
+                grew = true;
+            }
+        }
+    }
+
+    // Depths are followed the way Chunk::stackDepthAt does.
+    int32_t at = chunk.stackDepthAt(regionStart, entryDepth);
+    for (size_t offset = regionStart; offset < regionEnd;
+         offset += chunk.instructionSize(offset)) {
+        if (const auto target = targetDepths.find(offset); target != targetDepths.end())
+            at = target->second;
+        if (offset == entry && at != depth) return std::nullopt;
+
+        positions[offset] = a.here();
+        instruction(offset, at);
+        at += chunk.stackEffect(offset);
+    }
+
+    for (const auto& [patchAt, target] : forwardJumps) {
+        const auto position = positions.find(target);
+        if (position == positions.end()) return std::nullopt;
+        a.patch(patchAt, position->second);
+    }
+
+    for (const auto& [where, jumps] : exits) {
+        for (const size_t jump : jumps) a.patch(jump, a.here());
+        a.lea(RAX, slot(where.second));
+        a.store({RSI, 0}, RAX);
+        a.moveImm32(RAX, static_cast<uint32_t>(where.first));
+        a.ret();
+    }
+
+    return std::pair{std::move(a.code), positions[entry]};
+}
+} // namespace
+
+Jit::~Jit() {
+    for (const auto& [memory, size] : mappings) munmap(memory, size);
+    if (perfMap != nullptr) std::fclose(perfMap);
+}
+
+JitCode Jit::compileLoop(const Chunk& chunk, const size_t loopOffset, const int32_t entryDepth,
+                         const int32_t depth,
+                         const std::unordered_map<ObjString, Value>& globals,
+                         const std::string& name) {
+    LoopCompiler compiler(chunk, globals);
+    const auto compiled = compiler.compile(loopOffset, entryDepth, depth);
+    if (!compiled) return nullptr;
+    const auto& [code, entry] = *compiled;
+
+    // Written while writable, then made executable, never both at once.
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t size = (code.size() + page - 1) / page * page;
+    void* memory =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    mappings.emplace_back(memory, size);
+
+    // perf reads this to name the code it finds samples in.
+    if (perfMap == nullptr)
+        perfMap = std::fopen(FMT_FORMAT("/tmp/perf-{}.map", getpid()).c_str(), "a");
+    if (perfMap != nullptr) {
+        const std::string line = FMT_FORMAT("{:x} {:x} PythOwOn loop at {} in {}\n",
+                                            reinterpret_cast<uintptr_t>(memory), code.size(),
+                                            loopOffset, name);
+        std::fwrite(line.data(), 1, line.size(), perfMap);
+        std::fflush(perfMap);
+    }
+
+    return reinterpret_cast<JitCode>(static_cast<uint8_t*>(memory) + entry);
+}
+
+#endif
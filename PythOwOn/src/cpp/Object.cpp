@@ -1,5 +1,7 @@
 #include "Object.hpp"
 
+#include <algorithm>
+
 #include "Value.hpp"
 #include "VirtualMachine.hpp"
 
@@ -10,6 +12,9 @@ bool Obj::operator==(const Obj& other) const {
     switch (other.type) {
         case ObjType::STRING: return asString()->str == other.asString()->str;
 
+        case ObjType::FUNCTION:
+        case ObjType::FIBER: return this == &other;
+
         case ObjType::NONE:
         default: return false;
     }
@@ -22,22 +27,35 @@ std::ostream& Obj::operator<<(std::ostream& os) const {
     switch (type) {
         case ObjType::STRING: return os << asString()->str;
 
+        case ObjType::FUNCTION: return os << "<fn " << asFunction()->name->str << ">";
+
+        case ObjType::FIBER: return os << "<fiber " << asFiber()->function->name->str << ">";
+
         case ObjType::NONE:
         default: return os << std::string("None");
     }
 }
 
 
-const ObjString* ObjString::Create(const std::string& newStr) {
-    if (VM::HasString(newStr)) return VM::GetString(newStr);
+const ObjString* ObjString::Create(VM& vm, const std::string& newStr) {
+    if (const ObjString* existing = vm.GetString(newStr)) return existing;
 
-    auto* string = VM::NewObject<ObjString>(ObjType::STRING);
+    auto* string = vm.NewObject<ObjString>(ObjType::STRING);
     string->str = newStr;
-    VM::AddString(string);
+    vm.AddString(string);
+    return string;
+}
+
+const ObjString* ObjString::Create(VM& vm, std::string&& newStr) {
+    if (const ObjString* existing = vm.GetString(newStr)) return existing;
+
+    auto* string = vm.NewObject<ObjString>(ObjType::STRING);
+    string->str = std::move(newStr);
+    vm.AddString(string);
     return string;
 }
 
-const ObjString* ObjString::Create(const std::string& newStr,
+const ObjString* ObjString::Create(VM& vm, const std::string& newStr,
                                    std::tuple<int32_t, int32_t> slice) {
     if (std::get<0>(slice) < 0)
         std::get<0>(slice) =
@@ -46,5 +64,34 @@ const ObjString* ObjString::Create(const std::string& newStr,
         std::get<1>(slice) =
             static_cast<signed>(newStr.size()) + std::get<1>(slice) - 1;
 
-    return Create(newStr.substr(std::get<0>(slice), std::get<1>(slice)));
+    return Create(vm, newStr.substr(std::get<0>(slice), std::get<1>(slice)));
+}
+
+ObjFunction* ObjFunction::Create(VM& vm, const ObjString* name) {
+    auto* function = vm.NewObject<ObjFunction>(ObjType::FUNCTION);
+    function->arity = 0;
+    function->chunk = nullptr;
+    function->lazy = nullptr;
+    function->native = nullptr;
+    function->name = name;
+    return function;
+}
+
+ObjFiber* ObjFiber::Create(VM& vm, const Value* call, const uint8_t argCount) {
+    const ObjFunction* function = call->object()->asFunction();
+
+    auto* fiber = vm.NewObject<ObjFiber>(ObjType::FIBER);
+    fiber->status = Status::SUSPENDED;
+    fiber->function = function;
+    fiber->resumer = nullptr;
+
+    // Laid out as CallValue lays out a call, in a frame at the bottom of the fiber's stack.
+    ExecutionContext& context = fiber->context;
+    context.stack = Stack<Value>(function->chunk->maxDepth);
+    std::copy(call, call + argCount + 1, context.stack.begin());
+    context.stack.resize(argCount + 1);
+    context.frames.resize(VM::FIBER_FRAMES);
+    context.frames[0] = CallFrame{function, function->chunk, function->chunk->code.data(), 0};
+    context.frameCount = 1;
+    return fiber;
 }
@@ -0,0 +1,97 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Common.hpp"
+
+
+namespace {
+constexpr size_t HOT_LINES = 20;
+constexpr size_t BAR_WIDTH = 30;
+constexpr size_t LINE_WIDTH = 50; // of the source quoted
+
+double percent(const uint64_t part, const uint64_t total) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+}
+
+// The text of each line of `source`, without its indentation, cut short for the report.
+std::vector<std::string_view> sourceLines(const std::string_view source) {
+    std::vector<std::string_view> lines{""}; // lines count from 1
+    if (source.empty()) return lines;
+
+    size_t start = 0;
+    while (start <= source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string_view::npos) end = source.size();
+
+        std::string_view line = source.substr(start, end - start);
+        while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+            line.remove_prefix(1);
+        line = line.substr(0, LINE_WIDTH);
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.remove_suffix(1);
+        lines.push_back(line);
+        start = end + 1;
+    }
+
+    return lines;
+}
+} // namespace
+
+std::string Profiler::report(const std::string_view source) const {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    for (const Counts& op : ops) {
+        instructions += op.count;
+        cycles += op.cycles;
+    }
+
+    std::string out = FMT_FORMAT("== profile: {} instructions, {} cycles ==\n", instructions,
+                                 cycles);
+
+    std::vector<size_t> hotLines;
+    for (size_t line = 0; line < lines.size(); line++)
+        if (lines[line].count != 0) hotLines.push_back(line);
+    std::ranges::stable_sort(hotLines, [this](const size_t a, const size_t b) {
+        return lines[a].cycles > lines[b].cycles;
+    });
+
+    const std::vector<std::string_view> text = sourceLines(source);
+    out += FMT_FORMAT("{:>6} {:>14} {:>7} {:>12} {:>10}\n", "line", "cycles", "%", "runs",
+                      "cycles/run");
+    for (size_t i = 0; i < std::min(hotLines.size(), HOT_LINES); i++) {
+        const size_t line = hotLines[i];
+        const Counts& counts = lines[line];
+        out += FMT_FORMAT("{:>6} {:>14} {:>6.1f}% {:>12} {:>10.1f}", line, counts.cycles,
+                          percent(counts.cycles, cycles), counts.count,
+                          static_cast<double>(counts.cycles) / static_cast<double>(counts.count));
+        if (line < text.size() && !text[line].empty()) out += FMT_FORMAT("  {}", text[line]);
+        out += '\n';
+    }
+    if (hotLines.size() > HOT_LINES)
+        out += FMT_FORMAT("{:>6} more lines\n", hotLines.size() - HOT_LINES);
+
+    std::vector<size_t> hotOps;
+    for (size_t op = 0; op < ops.size(); op++)
+        if (ops[op].count != 0) hotOps.push_back(op);
+    std::ranges::stable_sort(hotOps, [this](const size_t a, const size_t b) {
+        return ops[a].cycles > ops[b].cycles;
+    });
+
+    out += FMT_FORMAT("\n{:<22} {:>12} {:>6} {:>14} {:>6}\n", "opcode", "count", "%", "cycles",
+                      "%");
+    for (const size_t op : hotOps) {
+        const Counts& counts = ops[op];
+        const double share = percent(counts.cycles, cycles);
+        const auto bar = static_cast<size_t>(share / 100.0 * BAR_WIDTH + 0.5);
+        out += FMT_FORMAT("{:<22} {:>12} {:>5.1f}% {:>14} {:>5.1f}%",
+                          OpCode::name(static_cast<OpCode::Code>(op)), counts.count,
+                          percent(counts.count, instructions), counts.cycles, share);
+        if (bar != 0) out += "  " + std::string(bar, '#');
+        out += '\n';
+    }
+
+    return out;
+}
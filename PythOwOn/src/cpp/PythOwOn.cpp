@@ -1,22 +1,69 @@
 #include <cxxopts.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <ostream>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#if defined(GCCBUILD)
+#include <sys/resource.h>
+#elif defined(MSVCBUILD)
+#include <windows.h>
+#include <psapi.h>
+#endif
 
 #include "Common.hpp"
 #include "Compiler.hpp"
+#include "CppEmitter.hpp"
 #include "VirtualMachine.hpp"
 
 using namespace std::string_literals;
 
 
+struct RunOptions {
+    std::string profileOut; // write branch counts here after running
+    std::string profileUse; // lay out code using branch counts from here
+    std::optional<uint32_t> inlineThreshold;
+    std::optional<std::string> compileStats; // report format, "text" or "json"
+    std::optional<uint32_t> jitThreshold; // compile loops once they run this often
+    bool profile = false; // report where the run spent its time
+    std::string traceOut; // dump the last instructions run here if the run fails
+    std::optional<uint64_t> fuel; // loop iterations and calls each script may make
+};
+
+// What scripts found in directories are picked up by, and what they compile to.
+constexpr const char* SCRIPT_EXTENSION = ".pwn";
+constexpr const char* COMPILED_EXTENSION = ".powon";
+
+// The trace of the script being run, if any, for signalHandler to dump.
+std::atomic<const Trace*> g_signalTrace = nullptr;
+
 uint8_t printVersion();
 uint8_t repl();
-uint8_t runFile(std::string path);
-uint8_t compileFile(std::string path, std::string outFile);
+uint8_t runFile(std::string path, const RunOptions& runOptions, VM* vm = nullptr);
+uint8_t runBatch(const std::string& input, uint32_t jobs, const RunOptions& runOptions);
+#if defined(HAS_JIT)
+uint8_t checkJit(const std::string& path, RunOptions runOptions);
+#endif
+// With `totals`, the file is one of several: its stats are added to them, and its errors
+// name it, as other files may be reporting theirs at the same time.
+uint8_t compileFile(std::string path, std::string outFile, const RunOptions& runOptions,
+                    CompileStats* totals = nullptr);
+uint8_t compileFiles(const std::vector<std::string>& inputs, const std::string& outDir,
+                     uint32_t jobs, const RunOptions& runOptions);
+uint8_t emitCppFile(const std::string& path, const std::string& outFile,
+                    const RunOptions& runOptions);
+uint8_t decodeTrace(const std::string& tracePath, const std::string& path,
+                    const RunOptions& runOptions);
 [[noreturn]] void signalHandler(int sigNum);
 
 
@@ -30,15 +77,102 @@ int main(const int argc, char** argv) {
 
     cxxopts::Options options("PythOwOn", "A simple programming language.");
 
-    options.add_option("", {"file", "", cxxopts::value<std::string>()});
+    options.add_option("", {"file", "", cxxopts::value<std::vector<std::string>>()});
     options.add_option("", {"r,Run", "Runs a given PythOwOn file."});
-    options.add_option("", {"c,compile", "Compile a PythOwOn file into bytecode."});
+    options.add_option("", {
+                           "c,compile",
+                           "Compile PythOwOn files, or the .pwn scripts in directories, into "
+                           "bytecode."
+                       });
     options.add_option("", {
                            "o,output",
-                           "Output file for compiled bytecode.",
+                           "Output file for compiled bytecode, or directory for several files.",
+                           cxxopts::value<std::string>()
+                       });
+    options.add_option("", {
+                           "j,jobs",
+                           "How many files to compile or run at once (default: one per core).",
+                           cxxopts::value<uint32_t>()
+                       });
+
+    options.add_option("", {
+                           "batch",
+                           "Run the scripts listed in a file, or the .pwn scripts in a "
+                           "directory, and print each one's output, exit status and time in "
+                           "order.",
+                           cxxopts::value<std::string>()
+                       });
+
+    options.add_option("", {
+                           "emit-cpp",
+                           "Translate a PythOwOn file, source or compiled, into a C++ program "
+                           "written to the given file.",
+                           cxxopts::value<std::string>()
+                       });
+
+    options.add_option("", {
+                           "profile-out",
+                           "Record how often each branch is taken into the given file.",
+                           cxxopts::value<std::string>()
+                       });
+    options.add_option("", {
+                           "profile-use",
+                           "Move rarely run code out of line using a --profile-out file.",
+                           cxxopts::value<std::string>()
+                       });
+
+    options.add_option("", {
+                           "profile",
+                           "Count and time each opcode and source line run, and report the "
+                           "hottest when done."
+                       });
+
+    options.add_option("", {
+                           "trace",
+                           "Keep the last instructions run, and write them to the given file "
+                           "if the script fails or is interrupted.",
+                           cxxopts::value<std::string>()
+                       });
+    options.add_option("", {
+                           "trace-decode",
+                           "Print the instructions in a --trace file, disassembled from the "
+                           "script given, compiled with the same options.",
                            cxxopts::value<std::string>()
                        });
 
+    options.add_option("", {
+                           "fuel",
+                           "Stop a script once it has made this many loop iterations and "
+                           "calls.",
+                           cxxopts::value<uint64_t>()
+                       });
+
+    options.add_option("", {
+                           "inline-threshold",
+                           "Inline calls to functions that return at most this many tokens.",
+                           cxxopts::value<uint32_t>()
+                       });
+
+    options.add_option("", {
+                           "compile-stats",
+                           "Report compile times and output sizes, as text or json.",
+                           cxxopts::value<std::string>()->implicit_value("text")
+                       });
+
+#if defined(HAS_JIT)
+    options.add_option("", {
+                           "jit",
+                           "Compile loops to machine code once they have run this many times "
+                           "(default: 1000).",
+                           cxxopts::value<uint32_t>()->implicit_value(
+                               std::to_string(Jit::DEFAULT_THRESHOLD))
+                       });
+    options.add_option("", {
+                           "jit-check",
+                           "Run a file with and without --jit and compare what it prints."
+                       });
+#endif
+
     options.add_option("", {"i,interpret", "Start PythOwOn in interactive mode"});
     options.add_option("", {"h,help", "Print usage"});
     options.add_option("", {"v,version", "Display the version of PythOwOn"});
@@ -55,15 +189,61 @@ int main(const int argc, char** argv) {
     if (result.count("version")) return printVersion();
     if (result.count("interpret")) return repl();
 
+    RunOptions runOptions;
+    if (result.count("profile-out")) runOptions.profileOut = result["profile-out"].as<std::string>();
+    if (result.count("profile-use")) runOptions.profileUse = result["profile-use"].as<std::string>();
+    runOptions.profile = result.count("profile") != 0;
+    if (result.count("trace")) runOptions.traceOut = result["trace"].as<std::string>();
+    if (result.count("fuel")) runOptions.fuel = result["fuel"].as<uint64_t>();
+    if (result.count("inline-threshold"))
+        runOptions.inlineThreshold = result["inline-threshold"].as<uint32_t>();
+    if (result.count("compile-stats")) {
+        runOptions.compileStats = result["compile-stats"].as<std::string>();
+        if (runOptions.compileStats != "text" && runOptions.compileStats != "json") {
+            FMT_PRINTLN("Unknown --compile-stats format \"{}\".", *runOptions.compileStats);
+            return 1;
+        }
+    }
+
+#if defined(HAS_JIT)
+    if (result.count("jit")) runOptions.jitThreshold = std::max(result["jit"].as<uint32_t>(), 1u);
+#endif
+
+    const uint32_t jobs = result.count("jobs") ? result["jobs"].as<uint32_t>()
+                                               : std::thread::hardware_concurrency();
+
+    if (result.count("batch"))
+        return runBatch(result["batch"].as<std::string>(), std::max(jobs, 1u), runOptions);
+
     if (result.count("Run")) {
         if (result.count("file") == 0) {
             FMT_PRINTLN("You must provide a file to Run.");
             return 1;
         }
 
-        return runFile(result["file"].as<std::string>());
+        const auto& files = result["file"].as<std::vector<std::string>>();
+        if (files.size() > 1) {
+            FMT_PRINTLN("You can only Run one file at a time.");
+            return 1;
+        }
+
+        return runFile(files.front(), runOptions);
     }
 
+#if defined(HAS_JIT)
+    if (result.count("jit-check")) {
+        if (result.count("file") == 0) {
+            FMT_PRINTLN("You must provide a file to check.");
+            return 1;
+        }
+
+        uint8_t status = 0;
+        for (const auto& file : result["file"].as<std::vector<std::string>>())
+            status = std::max(status, checkJit(file, runOptions));
+        return status;
+    }
+#endif
+
     if (result.count("compile")) {
         if (result.count("file") == 0) {
             FMT_PRINTLN("You must provide a file to compile.");
@@ -75,8 +255,32 @@ int main(const int argc, char** argv) {
             return 1;
         }
 
-        return compileFile(result["file"].as<std::string>(),
-                           result["output"].as<std::string>());
+        const auto& files = result["file"].as<std::vector<std::string>>();
+        const auto& output = result["output"].as<std::string>();
+        if (files.size() == 1 && !std::filesystem::is_directory(files.front()))
+            return compileFile(files.front(), output, runOptions);
+
+        return compileFiles(files, output, std::max(jobs, 1u), runOptions);
+    }
+
+    if (result.count("trace-decode")) {
+        if (result.count("file") != 1) {
+            FMT_PRINTLN("You must provide the one file that was traced.");
+            return 1;
+        }
+
+        return decodeTrace(result["trace-decode"].as<std::string>(),
+                           result["file"].as<std::vector<std::string>>().front(), runOptions);
+    }
+
+    if (result.count("emit-cpp")) {
+        if (result.count("file") != 1) {
+            FMT_PRINTLN("You must provide one file to translate.");
+            return 1;
+        }
+
+        return emitCppFile(result["file"].as<std::vector<std::string>>().front(),
+                           result["emit-cpp"].as<std::string>(), runOptions);
     }
 
     FMT_PRINTLN(options.help());
@@ -84,6 +288,7 @@ int main(const int argc, char** argv) {
 }
 
 [[noreturn]] void signalHandler(int sigNum) {
+    if (const Trace* trace = g_signalTrace.load()) (void)trace->dump();
     FMT_PRINTLN("Recieved signal number {0}, exiting...", sigNum);
 
     std::quick_exit(sigNum);
@@ -137,8 +342,9 @@ uint8_t repl() {
     std::string tmp;
     InterpretResult result;
 
-    VM::InitVM();
-    const auto compiler = std::make_unique<Compiler>();
+    VM vm;
+    const auto compiler = std::make_unique<Compiler>(vm);
+    compiler->setLazyFunctions(true);
 
     while (true) {
         FMT_PRINT("PythOwOn <<< ");
@@ -156,8 +362,8 @@ uint8_t repl() {
             result = compileResult;
             if (compileResult != InterpretResult::OK) break;
 
-            VM::SetChunk(codeChunk);
-            const InterpretResult runResult = VM::Run();
+            vm.SetChunk(codeChunk);
+            const InterpretResult runResult = vm.Run();
             result = runResult;
 
             if (runResult == InterpretResult::RUNTIME_ERROR) break;
@@ -165,8 +371,6 @@ uint8_t repl() {
         line = "";
     }
 
-    VM::ShutdownVM();
-
     if (result == InterpretResult::COMPILE_ERROR)
         FMT_PRINTLN("Compile error.");
     if (result == InterpretResult::RUNTIME_ERROR)
@@ -175,66 +379,304 @@ uint8_t repl() {
     return result;
 }
 
-uint8_t runInterpretedFile(std::ifstream& file) {
+using ChunkBranchCounts = std::unordered_map<const Chunk*, std::vector<BranchCounts>>;
+
+// Gather the counts of every branch in `chunk` and the functions in its constants, by
+// branch number.
+void collectBranches(const Chunk& chunk, const ChunkBranchCounts& counts,
+                     std::vector<BranchCounts>& branches) {
+    const auto chunkCounts = counts.find(&chunk);
+
+    for (const auto& [branch, offset] : chunk.branches) {
+        if (branch >= branches.size()) branches.resize(branch + 1);
+        if (chunkCounts != counts.end()) branches[branch] = chunkCounts->second[offset];
+    }
+
+    for (const Value& constant : chunk.constants) {
+        if (constant.isObjectType(ObjType::FUNCTION))
+            collectBranches(*constant.object()->asFunction()->chunk, counts, branches);
+    }
+}
+
+// Branch profiles are keyed by the number each chunk records for its branches, which is
+// the order the compiler emits them in regardless of how it lays out blocks.
+bool writeBranchProfile(const std::string& path, const Chunk& chunk,
+                        const ChunkBranchCounts& counts) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        FMT_PRINTLN("Could not open file \"{}\".", path);
+        return false;
+    }
+
+    out << "# PythOwOn branch profile: <branch> <taken> <fallthrough>\n";
+
+    std::vector<BranchCounts> branches;
+    collectBranches(chunk, counts, branches);
+    for (size_t branch = 0; branch < branches.size(); branch++) {
+        const auto [taken, fallthrough] = branches[branch];
+        out << FMT_FORMAT("{} {} {}\n", branch, taken, fallthrough);
+    }
+
+    return true;
+}
+
+std::optional<std::vector<BranchCounts>> readBranchProfile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        FMT_PRINTLN("Could not open file \"{}\".", path);
+        return std::nullopt;
+    }
+
+    std::vector<BranchCounts> profile;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        size_t branch = 0;
+        BranchCounts counts;
+        if (!(fields >> branch >> counts.taken >> counts.fallthrough)) {
+            FMT_PRINTLN("File \"{}\" is not a valid branch profile.", path);
+            return std::nullopt;
+        }
+
+        if (branch >= profile.size()) profile.resize(branch + 1);
+        profile[branch] = counts;
+    }
+
+    return profile;
+}
+
+// The most memory the process has held so far, or 0 where that isn't known.
+size_t peakMemoryBytes() {
+#if defined(GCCBUILD)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#elif defined(MSVCBUILD)
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+#endif
+    return 0;
+}
+
+// Written to stderr, so that it doesn't mix with the output of the script being run.
+void printCompileStats(const CompileStats& stats, const std::string& format, const size_t files) {
+    const auto ms = [](const CompileStats::Duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+
+    if (format == "json") {
+        std::cerr << FMT_FORMAT(
+            "{{\"files\": {}, \"passes\": {}, \"scan_ms\": {:.3f}, \"parse_ms\": {:.3f}, "
+            "\"emit_ms\": {:.3f}, \"tokens\": {}, \"chunks\": {}, \"bytecode_bytes\": {}, "
+            "\"constants\": {}, \"short_constant_operands\": {}, "
+            "\"long_constant_operands\": {}, \"locals\": {}, \"globals\": {}, "
+            "\"functions\": {}, \"inlined_calls\": {}, \"peak_memory_bytes\": {}}}\n",
+            files, stats.passes, ms(stats.scanTime), ms(stats.compileTime), ms(stats.emitTime),
+            stats.tokens, stats.chunks, stats.codeBytes, stats.constants,
+            stats.shortConstantOperands, stats.longConstantOperands, stats.locals, stats.globals,
+            stats.functions, stats.inlinedCalls, peakMemoryBytes());
+        return;
+    }
+
+    std::cerr << FMT_FORMAT(
+        "== compile stats ({} file{}, {} pass{}) ==\n"
+        "scanning   {:10.3f} ms\n"
+        "parsing    {:10.3f} ms  (with code generation)\n"
+        "emission   {:10.3f} ms  (writing compiled files)\n"
+        "tokens     {:10}\n"
+        "bytecode   {:10} bytes in {} chunks\n"
+        "constants  {:10}  ({} short operands, {} long)\n"
+        "locals     {:10}\n"
+        "globals    {:10}\n"
+        "functions  {:10}  ({} call sites inlined)\n"
+        "peak memory{:10.1f} MiB\n",
+        files, files == 1 ? "" : "s", stats.passes, stats.passes == 1 ? "" : "es",
+        ms(stats.scanTime), ms(stats.compileTime), ms(stats.emitTime), stats.tokens,
+        stats.codeBytes, stats.chunks, stats.constants, stats.shortConstantOperands,
+        stats.longConstantOperands, stats.locals, stats.globals, stats.functions,
+        stats.inlinedCalls, static_cast<double>(peakMemoryBytes()) / (1024 * 1024));
+}
+
+// Sets up a compiler according to the given options. Returns nullptr on failure.
+// Branch profiles number branches in compile order, and traces number chunks, so they
+// need every function compiled up front.
+std::unique_ptr<Compiler> makeCompiler(VM& vm, const RunOptions& runOptions,
+                                       const bool lazyFunctions) {
+    auto compiler = std::make_unique<Compiler>(vm);
+    compiler->setLazyFunctions(lazyFunctions && runOptions.profileOut.empty() &&
+                               runOptions.profileUse.empty() && runOptions.traceOut.empty());
+    if (runOptions.inlineThreshold) compiler->setInlineThreshold(*runOptions.inlineThreshold);
+    if (runOptions.compileStats) compiler->enableStats();
+
+    if (!runOptions.profileUse.empty()) {
+        auto profile = readBranchProfile(runOptions.profileUse);
+        if (!profile) return nullptr;
+        compiler->useBranchProfile(std::move(*profile));
+    }
+
+    return compiler;
+}
+
+uint8_t runInterpretedFile(std::ifstream& file, const RunOptions& runOptions, VM& vm) {
     file.seekg(0, std::ifstream::beg);
     std::stringstream ss;
     ss << file.rdbuf();
     const std::string source = ss.str();
 
-    VM::InitVM();
-    const auto compiler = std::make_unique<Compiler>();
+    const auto compiler = makeCompiler(vm, runOptions, true);
+    if (!compiler) return 74;
 
     auto [compileResult, codeChunk] = compiler->compile(source);
     if (compileResult != InterpretResult::OK) { return InterpretResult::COMPILE_ERROR; }
+    if (runOptions.compileStats) printCompileStats(compiler->compileStats(), *runOptions.compileStats, 1);
 
-    VM::SetChunk(codeChunk);
-    const InterpretResult result = VM::Run();
-    VM::ShutdownVM();
+    vm.state.profileBranches = !runOptions.profileOut.empty();
+    vm.SetChunk(codeChunk);
+    const InterpretResult result = vm.Run();
+
+    if (vm.state.profileBranches &&
+        !writeBranchProfile(runOptions.profileOut, vm.state.chunk, vm.state.branchCounts)) {
+        return 74;
+    }
 
     return result;
 }
 
-Value readConstant(std::ifstream& file, const std::vector<std::string>& strTable) {
-    auto val = Value();
+template <typename T>
+T readBE(std::ifstream& file) {
+    char bytes[sizeof(T)];
+    file.read(bytes, sizeof(T));
+    return BEStrToLE<T>(bytes);
+}
+
+// Whether `count` items of `size` bytes each could still be in the file, so that a corrupt
+// count is caught before anything is allocated for it.
+bool fitsInFile(std::ifstream& file, const uint64_t count, const uint64_t size) {
+    const std::streamoff at = file.tellg();
+    file.seekg(0, std::ifstream::end);
+    const std::streamoff end = file.tellg();
+    file.seekg(at);
+    return at >= 0 && count * size <= static_cast<uint64_t>(end - at);
+}
+
+// Anything wrong with the constant is left in `problem`.
+Value readConstant(std::ifstream& file, const std::vector<std::string>& strTable,
+                   std::string& problem) {
+    auto val = Value::NoneVal();
 
-    val.type = static_cast<ValueType>(file.get());
+    switch (static_cast<ValueType>(file.get())) {
+        case ValueType::NONE: break;
 
-    switch (val.type) {
-        case ValueType::NONE: {
-            val.as.obj = nullptr;
+        case ValueType::INFINITY: {
+            val = Value::Infinity(file.get());
             break;
         }
-        case ValueType::INFINITY:
-        case ValueType::NAN:
+
+        case ValueType::NAN: {
+            val = Value::Nan(file.get());
+            break;
+        }
+
         case ValueType::BOOL: {
-            val.as.boolean = file.get();
+            val = Value::BoolVal(file.get());
             break;
         }
 
         case ValueType::INT: {
-            file.read(reinterpret_cast<char*>(&val.as.integer),
-                      sizeof(val.as.integer));
-            val.as.integer = BEStrToLE<int64_t>(reinterpret_cast<char*>(&val.as.integer));
+            const auto integer = static_cast<ssize_t>(readBE<int64_t>(file));
+            if (!Value::FitsInteger(integer)) {
+                problem = "integer constant out of range";
+                break;
+            }
+            val = Value::IntegerVal(integer);
             break;
         }
 
         case ValueType::DOUBLE: {
-            file.read(reinterpret_cast<char*>(&val.as.decimal),
-                      sizeof(val.as.decimal));
-            val.as.decimal = BEStrToLE<double>(reinterpret_cast<char*>(&val.as.decimal));
+            val = Value::DoubleVal(readBE<double>(file));
             break;
         }
         case ValueType::OBJECT: {
             switch (static_cast<ObjType>(file.get())) {
                 case ObjType::STRING: {
-                    val.as.obj = reinterpret_cast<Obj*>(new ObjString());
-                    val.as.obj->type = ObjType::STRING;
+                    auto* string = new ObjString();
+                    string->object.type = ObjType::STRING;
+                    val = Value::ObjectVal(string);
 
                     uint32_t strIndex = 0;
                     file.read(reinterpret_cast<char*>(&strIndex), sizeof(uint32_t));
                     strIndex = BEStrToLE<uint32_t>(reinterpret_cast<char*>(&strIndex));
-                    const_cast<std::string&>(val.as.obj->asString()->str) = strTable[strIndex];
+                    if (strIndex >= strTable.size()) {
+                        problem = "string index out of range";
+                        break;
+                    }
+                    string->str = strTable[strIndex];
+                    break;
                 }
+
+                case ObjType::FUNCTION: {
+                    auto* function = new ObjFunction();
+                    function->object.type = ObjType::FUNCTION;
+                    val = Value::ObjectVal(function);
+
+                    auto* name = new ObjString();
+                    name->object.type = ObjType::STRING;
+                    function->name = name;
+                    if (const uint32_t nameIndex = readBE<uint32_t>(file);
+                        nameIndex < strTable.size()) {
+                        name->str = strTable[nameIndex];
+                    }
+                    else {
+                        problem = "string index out of range";
+                        break;
+                    }
+                    function->arity = readBE<uint32_t>(file);
+                    if (function->arity > UINT8_MAX) {
+                        problem = "too many parameters";
+                        break;
+                    }
+
+                    function->chunk = new Chunk();
+                    Chunk& chunk = *function->chunk;
+                    const uint32_t numLines = readBE<uint32_t>(file);
+                    const uint32_t numConstants = readBE<uint32_t>(file);
+                    if (!fitsInFile(file, numLines, sizeof(size_t)) ||
+                        !fitsInFile(file, numConstants, 1)) {
+                        problem = "unexpected end of file";
+                        break;
+                    }
+                    chunk.lines.resize(numLines);
+                    chunk.constants.resize(numConstants);
+                    for (auto& constant : chunk.constants) {
+                        constant = readConstant(file, strTable, problem);
+                        if (!problem.empty()) break;
+                    }
+                    if (!problem.empty()) break;
+                    for (auto& line : chunk.lines) line = readBE<size_t>(file);
+                    const uint32_t codeSize = readBE<uint32_t>(file);
+                    if (!fitsInFile(file, codeSize, 1)) {
+                        problem = "unexpected end of file";
+                        break;
+                    }
+                    chunk.code.resize(codeSize);
+                    file.read(reinterpret_cast<char*>(chunk.code.data()),
+                              static_cast<std::streamsize>(chunk.code.size()));
+                    if (!file) {
+                        problem = "unexpected end of file";
+                        break;
+                    }
+
+                    const int32_t entryDepth = static_cast<int32_t>(function->arity + 1);
+                    if (auto verifyProblem = chunk.verify(entryDepth, chunk.maxDepth)) {
+                        problem = FMT_FORMAT("in {}(): {}", name->str, *verifyProblem);
+                        break;
+                    }
+                    chunk.demoteTypedOps();
+                    break;
+                }
+
                 case ObjType::NONE:
                     [[fallthrough]];
                 default: break;
@@ -249,8 +691,9 @@ Value readConstant(std::ifstream& file, const std::vector<std::string>& strTable
     return val;
 }
 
-uint8_t runCompiledFile(std::ifstream& file, const size_t fileLen,
-                        const std::string& fileName) {
+// Reads a compiled file's chunk, after its magic, or says what is wrong with the file.
+std::optional<Chunk> loadCompiledFile(std::ifstream& file, const size_t fileLen,
+                                      const std::string& fileName) {
     char temp32[sizeof(uint32_t)];
 
     // read 4 bytes for number line indices, 4 bytes for number of constants, 4 bytes for number of strings in string table
@@ -261,19 +704,37 @@ uint8_t runCompiledFile(std::ifstream& file, const size_t fileLen,
     file.read(temp32, 4);
     const uint32_t numStrings = BEStrToLE<uint32_t>(temp32);
 
+    if (!fitsInFile(file, numStrings, 4) || !fitsInFile(file, numConstants, 1) ||
+        !fitsInFile(file, numLines, sizeof(size_t))) {
+        FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file.", fileName);
+        return std::nullopt;
+    }
+
     // read string table
     std::vector<std::string> strTable(numStrings);
     for (uint32_t i = 0; i < numStrings; ++i) {
         file.read(temp32, 4);
         const uint32_t strSize = BEStrToLE<uint32_t>(temp32);
+        if (!fitsInFile(file, strSize, 1)) {
+            FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file.", fileName);
+            return std::nullopt;
+        }
         strTable[i].resize(strSize);
         file.read(strTable[i].data(), strSize);
     }
 
     // read constants
     std::vector<Value> constants(numConstants);
-    for (uint32_t i = 0; i < numConstants; ++i) { constants[i] = readConstant(file, strTable); }
+    std::string problem;
+    for (uint32_t i = 0; i < numConstants && problem.empty(); ++i) {
+        constants[i] = readConstant(file, strTable, problem);
+    }
 
+    if (!problem.empty() || !file || file.tellg() > static_cast<std::streamoff>(fileLen)) {
+        FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file: {}.", fileName,
+                    problem.empty() ? "unexpected end of file" : problem);
+        return std::nullopt;
+    }
 
     // read line indices
     std::vector<size_t> lines(numLines);
@@ -284,13 +745,17 @@ uint8_t runCompiledFile(std::ifstream& file, const size_t fileLen,
     }
 
     // read code
+    if (!file) {
+        FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file.", fileName);
+        return std::nullopt;
+    }
     std::vector<uint8_t> code(fileLen - file.tellg());
     for (auto& i : code) file.read(reinterpret_cast<char*>(&i), 1);
 
 
     if (file.tellg() != fileLen) {
         FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file.", fileName);
-        return 74;
+        return std::nullopt;
     }
 
     auto chunk = Chunk{};
@@ -298,15 +763,31 @@ uint8_t runCompiledFile(std::ifstream& file, const size_t fileLen,
     chunk.constants = std::move(constants);
     chunk.code = std::move(code);
 
-    VM::InitVM();
-    VM::SetChunk(chunk);
-    const InterpretResult result = VM::Run();
-    VM::ShutdownVM();
+    // Run trusts the code it is given, so anything loaded from a file is checked first.
+    // The depth the stack is sized by comes from the same check, as maxStackDepth would
+    // underestimate it for control flow the compiler never emits. Nothing proves the
+    // operand types the typed instructions rely on, so those become generic again.
+    if (const auto verifyProblem = chunk.verify(0, chunk.maxDepth)) {
+        FMT_PRINTLN("File \"{}\" is not a valid PythOwOn compiled file: {}.", fileName,
+                    *verifyProblem);
+        return std::nullopt;
+    }
+    chunk.demoteTypedOps();
 
-    return result;
+    return chunk;
 }
 
-uint8_t runFile(std::string path) {
+uint8_t runCompiledFile(std::ifstream& file, const size_t fileLen,
+                        const std::string& fileName, VM& vm) {
+    std::optional<Chunk> chunk = loadCompiledFile(file, fileLen, fileName);
+    if (!chunk) return 74;
+
+    vm.SetChunk(std::move(*chunk));
+    return vm.Run();
+}
+
+// Without `vm`, the file is run on a VM of its own.
+uint8_t runFile(std::string path, const RunOptions& runOptions, VM* vm) {
     std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
     if (!file.is_open()) {
         FMT_PRINTLN("Could not open file \"{}\".", path);
@@ -325,54 +806,231 @@ uint8_t runFile(std::string path) {
     std::string magic(7, '\0');
     file.read(magic.data(), 7);
 
-    return magic == "POWON\0\0"s
-               ? runCompiledFile(file, length, path)
-               : runInterpretedFile(file);
+    std::optional<VM> ownVM;
+    if (vm == nullptr) vm = &ownVM.emplace();
+#if defined(HAS_JIT)
+    // Loops that run as machine code record no branch counts, times or trace, and use no
+    // fuel, so runs that need those go without.
+    const bool observed = !runOptions.profileOut.empty() || runOptions.profile ||
+                          !runOptions.traceOut.empty() || runOptions.fuel;
+    if (runOptions.jitThreshold && !observed)
+        vm->state.jit = std::make_unique<Jit>(*runOptions.jitThreshold);
+#endif
+    if (runOptions.fuel) vm->state.fuel = *runOptions.fuel;
+    if (runOptions.profile) vm->state.profiler = std::make_unique<Profiler>();
+    if (!runOptions.traceOut.empty()) {
+        vm->state.trace = std::make_unique<Trace>(runOptions.traceOut);
+        g_signalTrace = vm->state.trace.get();
+    }
+
+    const bool compiled = magic == "POWON\0\0"s;
+    const uint8_t status = compiled ? runCompiledFile(file, length, path, *vm)
+                                    : runInterpretedFile(file, runOptions, *vm);
+
+    // Written to stderr, like the compile stats, quoting the source when there is one.
+    if (vm->state.profiler) {
+        std::string source;
+        if (!compiled) {
+            file.clear();
+            file.seekg(0, std::ifstream::beg);
+            std::stringstream ss;
+            ss << file.rdbuf();
+            source = ss.str();
+        }
+
+        vm->state.profiler->stop();
+        std::cerr << vm->state.profiler->report(source);
+    }
+
+    if (status == InterpretResult::OUT_OF_FUEL)
+        FMT_PRINTLN("Stopped after {} loop iterations and calls.", *runOptions.fuel);
+
+    if (vm->state.trace) {
+        g_signalTrace = nullptr;
+        if (status == InterpretResult::RUNTIME_ERROR && !vm->state.trace->dump())
+            FMT_PRINTLN("Could not write the trace to \"{}\".", runOptions.traceOut);
+    }
+
+    return status;
 }
 
+// Loads a compiled file, or compiles a source file with every function up front. Returns
+// nullopt, having reported why and set `status`, if it can't.
+std::optional<Chunk> loadScript(const std::string& path, VM& vm, const RunOptions& runOptions,
+                                uint8_t& status) {
+    std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+    if (!file.is_open()) {
+        FMT_PRINTLN("Could not open file \"{}\".", path);
+        status = 74;
+        return std::nullopt;
+    }
+
+    file.seekg(0, std::ifstream::end);
+    const size_t length = file.tellg();
+    file.seekg(0, std::ifstream::beg);
+
+    std::string magic(7, '\0');
+    file.read(magic.data(), 7);
+
+    std::optional<Chunk> chunk;
+    if (length >= 20 && magic == "POWON\0\0"s) {
+        chunk = loadCompiledFile(file, length, path);
+        if (!chunk) status = 74;
+        return chunk;
+    }
+
+    file.clear();
+    file.seekg(0, std::ifstream::beg);
+    std::stringstream ss;
+    ss << file.rdbuf();
+
+    const auto compiler = makeCompiler(vm, runOptions, false);
+    if (!compiler) {
+        status = 74;
+        return std::nullopt;
+    }
+
+    auto [compileResult, codeChunk] = compiler->compile(ss.str());
+    if (compileResult != InterpretResult::OK) {
+        status = InterpretResult::COMPILE_ERROR;
+        return std::nullopt;
+    }
+
+    return std::move(codeChunk);
+}
+
+// Every function is compiled up front, as the C++ has no compiler to fall back on.
+uint8_t emitCppFile(const std::string& path, const std::string& outFile,
+                    const RunOptions& runOptions) {
+    VM vm;
+    uint8_t status = 0;
+    const std::optional<Chunk> chunk = loadScript(path, vm, runOptions, status);
+    if (!chunk) return status;
+
+    std::ofstream out(outFile, std::ofstream::out | std::ofstream::trunc);
+    if (!out.is_open()) {
+        FMT_PRINTLN("Could not open file \"{}\" for writing.", outFile);
+        return 74;
+    }
+
+    out << emitCpp(*chunk, path);
+    return 0;
+}
 
 namespace {
-[[nodiscard]] std::pair<std::unique_ptr<uint8_t[]>, uint8_t> ValueToBytes(
-    const Value& value, std::vector<std::string>& strTable) {
-    std::unique_ptr<uint8_t[]> byteArray(new uint8_t[sizeof(Value)]{});
-    byteArray[0] = static_cast<uint8_t>(value.type);
-    uint8_t size = 1;
+const char* traceTopName(const uint8_t top) {
+    if (top == TraceEvent::EMPTY) return "-";
+
+    switch (static_cast<ValueType>(top)) {
+        case ValueType::NONE: return "none";
+        case ValueType::BOOL: return "bool";
+        case ValueType::INT: return "int";
+        case ValueType::DOUBLE: return "double";
+        case ValueType::INFINITY: return "inf";
+        case ValueType::NAN: return "nan";
+        case ValueType::OBJECT: return "object";
+    }
 
-    switch (value.type) {
+    return "?";
+}
+} // namespace
+
+// Each event's stack depth, top of stack type, opcode as it ran and function, followed by
+// its instruction as the compiled code has it.
+uint8_t decodeTrace(const std::string& tracePath, const std::string& path,
+                    const RunOptions& runOptions) {
+    const std::optional<Trace::Dump> dump = Trace::Read(tracePath);
+    if (!dump) return 74;
+
+    VM vm;
+    uint8_t status = 0;
+    const std::optional<Chunk> chunk = loadScript(path, vm, runOptions, status);
+    if (!chunk) return status;
+
+    const std::vector<Trace::Unit> units = Trace::Chunks(*chunk);
+    FMT_PRINTLN("== last {} of {} instructions run, oldest first ==", dump->events.size(),
+                dump->recorded);
+    FMT_PRINTLN("{:>6} {:<6} {:<22} {:<16} offset line instruction", "depth", "top", "ran as",
+                "in");
+
+    for (const TraceEvent& event : dump->events) {
+        const Trace::Unit* unit = event.chunk < units.size() ? &units[event.chunk] : nullptr;
+        const std::string name = unit == nullptr ? "?"
+                                 : unit->function == nullptr ? "script"
+                                 : unit->function->name->str + "()";
+        FMT_PRINT("{:>6} {:<6} {:<22} {:<16} ", event.depth, traceTopName(event.top),
+                  OpCode::name(static_cast<OpCode::Code>(event.op)), name);
+
+        const Chunk* code = unit != nullptr ? unit->chunk : nullptr;
+        if (code == nullptr || event.offset >= code->code.size() ||
+            event.offset + code->instructionSize(event.offset) > code->code.size()) {
+            FMT_PRINTLN("{:04} not in the script given", event.offset);
+            continue;
+        }
+        (void)code->disassembleInstruction(event.offset);
+    }
+
+    return 0;
+}
+
+namespace {
+template <typename T>
+void appendBE(std::vector<uint8_t>& bytes, const T& value) {
+    const char* valueBytes = LEtoBEStr<T>(value);
+    bytes.insert(bytes.end(), valueBytes, valueBytes + sizeof(T));
+}
+
+[[nodiscard]] std::vector<uint8_t> ValueToBytes(const Value& value,
+                                                std::vector<std::string>& strTable) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(1 + sizeof(Value));
+    bytes.push_back(static_cast<uint8_t>(value.valueType()));
+
+    switch (value.valueType()) {
         case ValueType::NONE: break;
         case ValueType::INFINITY:
         case ValueType::NAN:
         case ValueType::BOOL: {
-            byteArray[1] = value.as.boolean;
-            size += 1;
+            bytes.push_back(value.boolean());
             break;
         }
         case ValueType::INT: {
-            const char* integerBytes =
-                LEtoBEStr<decltype(value.as.integer)>(value.as.integer);
-            std::copy_n(integerBytes, sizeof(value.as.integer), &byteArray[1]);
-
-            size += 8;
+            appendBE(bytes, static_cast<int64_t>(value.integer()));
             break;
         }
         case ValueType::DOUBLE: {
-            const char* decimalBytes =
-                LEtoBEStr<decltype(value.as.decimal)>(value.as.decimal);
-            std::copy_n(decimalBytes, sizeof(value.as.decimal), &byteArray[1]);
-
-            size += 8;
+            appendBE(bytes, value.decimal());
             break;
         }
         case ValueType::OBJECT: {
-            const Obj* object = value.as.obj;
+            const Obj* object = value.object();
             switch (object->type) {
                 case ObjType::STRING: {
-                    byteArray[1] = static_cast<uint8_t>(ObjType::STRING);
+                    bytes.push_back(static_cast<uint8_t>(ObjType::STRING));
                     strTable.push_back(object->asString()->str);
-                    const uint32_t strTableIndex = static_cast<uint32_t>(strTable.size()) - 1;
-                    std::copy_n(LEtoBEStr<uint32_t>(strTableIndex), 4, &byteArray[2]);
+                    appendBE(bytes, static_cast<uint32_t>(strTable.size()) - 1);
+                    break;
+                }
 
-                    size += 5;
+                // Name, arity, then the function's chunk laid out like the script's,
+                // except that the code is prefixed with its length.
+                case ObjType::FUNCTION: {
+                    const ObjFunction* function = object->asFunction();
+                    const Chunk& chunk = *function->chunk;
+
+                    bytes.push_back(static_cast<uint8_t>(ObjType::FUNCTION));
+                    strTable.push_back(function->name->str);
+                    appendBE(bytes, static_cast<uint32_t>(strTable.size()) - 1);
+                    appendBE(bytes, function->arity);
+                    appendBE(bytes, static_cast<uint32_t>(chunk.lines.size()));
+                    appendBE(bytes, static_cast<uint32_t>(chunk.constants.size()));
+                    for (const auto& constant : chunk.constants) {
+                        const std::vector<uint8_t> constantBytes = ValueToBytes(constant, strTable);
+                        bytes.insert(bytes.end(), constantBytes.begin(), constantBytes.end());
+                    }
+                    for (const size_t line : chunk.lines) appendBE(bytes, line);
+                    appendBE(bytes, static_cast<uint32_t>(chunk.code.size()));
+                    bytes.insert(bytes.end(), chunk.code.begin(), chunk.code.end());
                     break;
                 }
 
@@ -388,13 +1046,13 @@ namespace {
     }
 
 
-    return std::pair{std::move(byteArray), size};
+    return bytes;
 }
 }
 
 std::ostream& operator<<(std::ostream& os, const std::vector<Value>& values) {
     std::vector<std::string> strTable;
-    std::vector<std::pair<std::unique_ptr<uint8_t[]>, uint8_t>> valueBytes;
+    std::vector<std::vector<uint8_t>> valueBytes;
 
     // first pass
     valueBytes.reserve(values.size());
@@ -414,14 +1072,16 @@ std::ostream& operator<<(std::ostream& os, const std::vector<Value>& values) {
     }
 
     // write constants
-    for (const auto& [val, size] : valueBytes)
-        os.write(reinterpret_cast<const char*>(val.get()),
-                 size);
+    for (const auto& bytes : valueBytes)
+        os.write(reinterpret_cast<const char*>(bytes.data()),
+                 static_cast<std::streamsize>(bytes.size()));
 
     return os;
 }
 
-uint8_t compileFile(std::string path, std::string outFile) {
+// With `totals`, stats are added to it rather than printed.
+uint8_t compileFile(std::string path, std::string outFile, const RunOptions& runOptions,
+                    CompileStats* totals) {
     std::ifstream file(path);
     if (!file.is_open()) {
         FMT_PRINTLN("Could not open file \"{}\".", path);
@@ -432,11 +1092,15 @@ uint8_t compileFile(std::string path, std::string outFile) {
                        (std::istreambuf_iterator<char>()));
     file.close();
 
-    auto compiler = std::make_unique<Compiler>();
+    VM vm;
+    const auto compiler = makeCompiler(vm, runOptions, false);
+    if (!compiler) return 74;
+    if (totals) compiler->setSourceName(path);
 
     auto [compileResult, codeChunk] = compiler->compile(source);
     if (compileResult != InterpretResult::OK) { return InterpretResult::COMPILE_ERROR; }
 
+    const auto emitStart = std::chrono::steady_clock::now();
     std::ofstream out(outFile, std::ios::binary);
     if (!out.is_open()) {
         FMT_PRINTLN("Could not open file \"{}\".", outFile);
@@ -455,5 +1119,207 @@ uint8_t compileFile(std::string path, std::string outFile) {
     out.flush();
     out.close();
 
+    if (runOptions.compileStats) {
+        CompileStats stats = compiler->compileStats();
+        stats.emitTime = std::chrono::steady_clock::now() - emitStart;
+
+        if (totals) *totals += stats;
+        else printCompileStats(stats, *runOptions.compileStats, 1);
+    }
+
     return 0;
 }
+
+// Compile each input into `outDir`, on up to `jobs` threads. Directories are searched
+// recursively, and the files in them keep their place relative to the directory.
+uint8_t compileFiles(const std::vector<std::string>& inputs, const std::string& outDir,
+                     const uint32_t jobs, const RunOptions& runOptions) {
+    namespace fs = std::filesystem;
+
+    if (!runOptions.profileUse.empty()) {
+        FMT_PRINTLN("A branch profile can only be used when compiling a single file.");
+        return 1;
+    }
+
+    std::vector<std::pair<fs::path, fs::path>> work;
+    std::error_code error;
+    for (const auto& input : inputs) {
+        if (!fs::is_directory(input)) {
+            fs::path out = fs::path(outDir) / fs::path(input).filename();
+            work.emplace_back(input, out.replace_extension(COMPILED_EXTENSION));
+            continue;
+        }
+
+        for (fs::recursive_directory_iterator it(input, error), end; !error && it != end;
+             it.increment(error)) {
+            if (!it->is_regular_file() || it->path().extension() != SCRIPT_EXTENSION) continue;
+
+            fs::path out = fs::path(outDir) / fs::relative(it->path(), input);
+            work.emplace_back(it->path(), out.replace_extension(COMPILED_EXTENSION));
+        }
+
+        if (error) {
+            FMT_PRINTLN("Could not read directory \"{}\".", input);
+            return 74;
+        }
+    }
+
+    for (const auto& [in, out] : work) {
+        if (fs::create_directories(out.parent_path(), error); error) {
+            FMT_PRINTLN("Could not create directory \"{}\".", out.parent_path().string());
+            return 74;
+        }
+    }
+
+    // Every file gets a VM and a compiler of its own, so the workers share nothing.
+    std::atomic<size_t> next = 0;
+    std::atomic<uint8_t> result = 0;
+    std::mutex totalsLock;
+    CompileStats totals;
+    const auto worker = [&] {
+        CompileStats workerTotals;
+        for (size_t i = next++; i < work.size(); i = next++) {
+            const auto& [in, out] = work[i];
+            if (const uint8_t status =
+                compileFile(in.string(), out.string(), runOptions, &workerTotals)) {
+                FMT_PRINT("Failed to compile \"{}\".\n", in.string());
+                result = status;
+            }
+        }
+
+        const std::scoped_lock lock(totalsLock);
+        totals += workerTotals;
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < std::min<size_t>(jobs, work.size()); i++) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+
+    if (runOptions.compileStats) printCompileStats(totals, *runOptions.compileStats, work.size());
+    return result;
+}
+
+// Run each script listed in `input`, one path per line, or found under it if it is a
+// directory, on up to `jobs` threads. A worker runs all of its scripts on the same VM,
+// reset in between; their output is held back and printed in order at the end.
+uint8_t runBatch(const std::string& input, const uint32_t jobs, const RunOptions& runOptions) {
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+
+    if (!runOptions.profileOut.empty()) {
+        FMT_PRINTLN("A branch profile can only be recorded when running a single file.");
+        return 1;
+    }
+    if (runOptions.profile || !runOptions.traceOut.empty()) {
+        FMT_PRINTLN("Only a single file can be run with --profile or --trace.");
+        return 1;
+    }
+
+    std::vector<fs::path> scripts;
+    if (fs::is_directory(input)) {
+        std::error_code error;
+        for (fs::recursive_directory_iterator it(input, error), end; !error && it != end;
+             it.increment(error)) {
+            if (it->is_regular_file() && it->path().extension() == SCRIPT_EXTENSION)
+                scripts.push_back(it->path());
+        }
+
+        if (error) {
+            FMT_PRINTLN("Could not read directory \"{}\".", input);
+            return 74;
+        }
+
+        std::ranges::sort(scripts);
+    } else {
+        std::ifstream list(input);
+        if (!list.is_open()) {
+            FMT_PRINTLN("Could not open file \"{}\".", input);
+            return 74;
+        }
+
+        for (std::string line; std::getline(list, line);) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) scripts.emplace_back(line);
+        }
+    }
+
+    struct Outcome {
+        std::string output;
+        uint8_t status = 0;
+        Clock::duration time{};
+    };
+
+    std::vector<Outcome> outcomes(scripts.size());
+    std::atomic<size_t> next = 0;
+    const auto worker = [&] {
+        VM vm;
+        for (size_t i = next++; i < scripts.size(); i = next++) {
+            Outcome& outcome = outcomes[i];
+            g_outputCapture = &outcome.output;
+            const auto start = Clock::now();
+            outcome.status = runFile(scripts[i].string(), runOptions, &vm);
+            outcome.time = Clock::now() - start;
+            g_outputCapture = nullptr;
+            vm.Reset();
+        }
+    };
+
+    const auto start = Clock::now();
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < std::min<size_t>(jobs, scripts.size()); i++) pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool) thread.join();
+    const auto wallTime = Clock::now() - start;
+
+    uint8_t result = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < scripts.size(); i++) {
+        const auto& [output, status, time] = outcomes[i];
+        FMT_PRINTLN("==> {} (exit {}, {:.3f} ms)", scripts[i].string(), status,
+                    std::chrono::duration<double, std::milli>(time).count());
+        FMT_PRINT("{}", output);
+
+        if (status != 0) {
+            failed++;
+            if (result == 0) result = status;
+        }
+    }
+
+    FMT_PRINTLN("==> {} scripts, {} failed, {:.3f} ms", scripts.size(), failed,
+                std::chrono::duration<double, std::milli>(wallTime).count());
+    return result;
+}
+
+#if defined(HAS_JIT)
+// Runs `path` on the interpreter alone, then again with each loop compiled the first time
+// it comes round, and reports whether both runs print the same and exit the same way.
+uint8_t checkJit(const std::string& path, RunOptions runOptions) {
+    // Any of these would keep the JIT off.
+    runOptions.profile = false;
+    runOptions.traceOut.clear();
+    runOptions.fuel.reset();
+    const auto run = [&](const std::optional<uint32_t> threshold) {
+        runOptions.jitThreshold = threshold;
+        std::string output;
+        g_outputCapture = &output;
+        const uint8_t status = runFile(path, runOptions);
+        g_outputCapture = nullptr;
+        return std::pair{status, output};
+    };
+
+    const auto [interpretedStatus, interpreted] = run(std::nullopt);
+    const auto [compiledStatus, compiled] = run(1);
+    if (interpretedStatus == compiledStatus && interpreted == compiled) {
+        FMT_PRINTLN("{}: the JIT agrees with the interpreter.", path);
+        return 0;
+    }
+
+    FMT_PRINTLN("{}: the JIT disagrees with the interpreter.", path);
+    FMT_PRINTLN("==> interpreted (exit {})", interpretedStatus);
+    FMT_PRINT("{}", interpreted);
+    FMT_PRINTLN("==> with --jit 1 (exit {})", compiledStatus);
+    FMT_PRINT("{}", compiled);
+    return 1;
+}
+#endif
@@ -13,8 +13,8 @@
     (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_')
 
 
-Scanner::Scanner(std::string source)
-    : source(std::move(source)), start(0), current(0), line(1) {}
+Scanner::Scanner(const std::string_view source, const size_t offset, const size_t line)
+    : source(source), start(offset), current(offset), line(line), tokens(0) {}
 
 
 char Scanner::advance() {
@@ -70,6 +70,7 @@ TokenType Scanner::identifierType() const {
         case 'f': if (current - start > 1) {
                 switch (source[start + 1]) {
                     case 'a': return checkKeyword(2, 3, "lse", TokenType::FALSE);
+                    case 'i': return checkKeyword(2, 3, "ber", TokenType::FIBER);
                     case 'o': return checkKeyword(2, 1, "r", TokenType::FOR);
                     case 'w': return checkKeyword(2, 7, "unction", TokenType::DEF);
                     default: break;
@@ -83,6 +84,8 @@ TokenType Scanner::identifierType() const {
                     default: break;
                 }
             }
+            if (current - start > 1 && source[start + 1] == 'n')
+                return checkKeyword(1, 1, "n", TokenType::IN);
             return checkKeyword(1, 1, "f", TokenType::IF);
 
         case 'l': return checkKeyword(1, 2, "et", TokenType::LET);
@@ -107,7 +110,14 @@ TokenType Scanner::identifierType() const {
 
         case 'o': return checkKeyword(1, 1, "r", TokenType::OR);
         case 'p': return checkKeyword(1, 4, "rint", TokenType::PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TokenType::RETURN);
+        case 'r': if (current - start > 2 && source[start + 1] == 'e') {
+                switch (source[start + 2]) {
+                    case 't': return checkKeyword(3, 3, "urn", TokenType::RETURN);
+                    case 's': return checkKeyword(3, 3, "ume", TokenType::RESUME);
+                    default: break;
+                }
+            }
+            break;
         case 's': if (current - start > 1) {
                 switch (source[start + 1]) {
                     case 'u': return checkKeyword(2, 3, "per", TokenType::SUPER);
@@ -127,6 +137,7 @@ TokenType Scanner::identifierType() const {
             break;
 
         case 'w': return checkKeyword(1, 4, "hile", TokenType::WHILE);
+        case 'y': return checkKeyword(1, 4, "ield", TokenType::YIELD);
 
         default: return TokenType::IDENTIFIER;
     }
@@ -200,6 +211,37 @@ Token Scanner::multiString() {
     return makeToken(TokenType::STR, '"' + str + '"');
 }
 
+// Scans f-string text up to the next interpolation (FSTR) or the closing quote (STR).
+// Entered after the opening `f"` and again after the `}` ending each interpolation.
+// `{{` and `}}` stand for literal braces.
+Token Scanner::fString() {
+    std::string str;
+
+    while (true) {
+        if (AT_END)
+            return errorToken(
+                FMT_FORMAT("Unterminated string at line {}.", std::to_string(line)));
+
+        char c = advance();
+        if (c == '"') break;
+        if (c == '\n') line++;
+
+        if (c == '{' && !match('{')) {
+            interpolations.push_back(0);
+            return makeToken(TokenType::FSTR, '"' + str + '"');
+        }
+        if (c == '}') match('}');
+
+        if (c == '\\') {
+            c = escapeSequence(advance());
+            if (c == -1) return errorToken("Unknown escape sequence");
+        }
+        str += c;
+    }
+
+    return makeToken(TokenType::STR, '"' + str + '"');
+}
+
 // no dot after e, no dot after dot, BUT e after dot is ok
 Token Scanner::number() {
     while (IS_DIGIT(peek(0))) advance();
@@ -257,12 +299,14 @@ std::optional<Token> Scanner::skipWhitespace() {
 }
 
 Token Scanner::scanToken() {
+    tokens++;
     if (auto token = skipWhitespace()) return token.value();
     start = current;
 
     if (AT_END) return makeToken(TokenType::EOF, "");
 
     const char c = advance();
+    if (c == 'f' && match('"')) return fString();
     if (IS_ALPHA(c)) return identifier();
     if (IS_DIGIT(c)) return number();
 
@@ -273,12 +317,22 @@ Token Scanner::scanSymbol(const char c) {
     switch (c) {
         case '(': return makeToken(TokenType::LPAREN);
         case ')': return makeToken(TokenType::RPAREN);
-        case '{': return makeToken(TokenType::LBRACE);
-        case '}': return makeToken(TokenType::RBRACE);
+        case '{':
+            if (!interpolations.empty()) interpolations.back()++;
+            return makeToken(TokenType::LBRACE);
+        case '}':
+            if (!interpolations.empty()) {
+                if (interpolations.back() == 0) {
+                    interpolations.pop_back();
+                    return fString();
+                }
+                interpolations.back()--;
+            }
+            return makeToken(TokenType::RBRACE);
         case '[': return makeToken(TokenType::LBRACK);
         case ']': return makeToken(TokenType::RBRACK);
         case ',': return makeToken(TokenType::COMMA);
-        case '.': return makeToken(TokenType::DOT);
+        case '.': return makeToken(match('.') ? TokenType::DOTDOT : TokenType::DOT);
 
         case '-': return handleMinus();
         case '+': return handlePlus();
@@ -299,7 +353,7 @@ Token Scanner::scanSymbol(const char c) {
 }
 
 Token Scanner::makeToken(const TokenType type) const {
-    return Token{type, source.substr(start, current - start), line};
+    return Token{type, std::string(source.substr(start, current - start)), line};
 }
 
 Token Scanner::makeToken(const TokenType type, const std::string& token) const {
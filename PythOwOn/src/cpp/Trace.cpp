@@ -0,0 +1,140 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#if defined(MSVCBUILD)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Common.hpp"
+
+
+namespace {
+constexpr char MAGIC[8] = "PWTRACE";
+constexpr uint32_t VERSION = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t eventSize;
+    uint64_t recorded;
+    uint64_t count; // events that follow
+};
+
+void addFunctions(const Chunk& chunk, std::vector<Trace::Unit>& units) {
+    for (const Value& constant : chunk.constants) {
+        if (!constant.isObjectType(ObjType::FUNCTION)) continue;
+
+        const ObjFunction* function = constant.object()->asFunction();
+        if (function->chunk == nullptr ||
+            std::ranges::any_of(units, [&](const Trace::Unit& unit) {
+                return unit.chunk == function->chunk;
+            })) {
+            continue;
+        }
+
+        units.push_back({function->chunk, function});
+        addFunctions(*function->chunk, units);
+    }
+}
+
+// write() may stop short; keeps going until all of it is out.
+bool writeAll(const int fd, const void* data, size_t size) {
+    const auto* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+#if defined(MSVCBUILD)
+        const int written = _write(fd, bytes, static_cast<unsigned>(size));
+#else
+        const ssize_t written = write(fd, bytes, size);
+#endif
+        if (written <= 0) return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+
+    return true;
+}
+} // namespace
+
+Trace::Trace(std::string path) : path(std::move(path)), events(EVENTS) {}
+
+std::vector<Trace::Unit> Trace::Chunks(const Chunk& script) {
+    std::vector<Unit> units{{&script, nullptr}};
+    addFunctions(script, units);
+    return units;
+}
+
+void Trace::setScript(const Chunk& script) {
+    chunkIds.clear();
+    const std::vector<Unit> units = Chunks(script);
+    for (size_t i = 0; i < units.size() && i < TraceEvent::UNKNOWN_CHUNK; i++)
+        chunkIds.emplace(units[i].chunk, static_cast<uint16_t>(i));
+
+    lastChunk = nullptr;
+}
+
+// The slot after the newest event is left out: the run may have been interrupted while
+// writing it over the oldest.
+bool Trace::dump() const {
+    const uint64_t recorded = head.load(std::memory_order_acquire);
+    const uint64_t count = std::min<uint64_t>(recorded, EVENTS - 1);
+    const size_t start = (recorded - count) & (EVENTS - 1);
+    const size_t beforeWrap = std::min<size_t>(count, EVENTS - start);
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.eventSize = sizeof(TraceEvent);
+    header.recorded = recorded;
+    header.count = count;
+
+#if defined(MSVCBUILD)
+    const int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) return false;
+
+    const bool written = writeAll(fd, &header, sizeof(header)) &&
+                         writeAll(fd, events.data() + start, beforeWrap * sizeof(TraceEvent)) &&
+                         writeAll(fd, events.data(), (count - beforeWrap) * sizeof(TraceEvent));
+#if defined(MSVCBUILD)
+    return _close(fd) == 0 && written;
+#else
+    return close(fd) == 0 && written;
+#endif
+}
+
+std::optional<Trace::Dump> Trace::Read(const std::string& path) {
+    std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+    if (!file.is_open()) {
+        FMT_PRINTLN("Could not open file \"{}\".", path);
+        return std::nullopt;
+    }
+
+    Header header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.version != VERSION || header.eventSize != sizeof(TraceEvent) ||
+        header.count > EVENTS || header.count > header.recorded) {
+        FMT_PRINTLN("File \"{}\" is not a valid trace.", path);
+        return std::nullopt;
+    }
+
+    Dump dump{header.recorded, std::vector<TraceEvent>(header.count)};
+    file.read(reinterpret_cast<char*>(dump.events.data()),
+              static_cast<std::streamsize>(header.count * sizeof(TraceEvent)));
+    if (!file) {
+        FMT_PRINTLN("File \"{}\" is not a valid trace.", path);
+        return std::nullopt;
+    }
+
+    return dump;
+}
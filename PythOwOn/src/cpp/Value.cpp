@@ -1,12 +1,24 @@
 #include "Value.hpp"
 
+#include <algorithm>
+#include <string_view>
+
 #include "Common.hpp"
+#include "VirtualMachine.hpp"
 
 
 void printObject(const Value value) {
-    switch (Obj::TypeOf(value.as.obj)) {
+    switch (Obj::TypeOf(value.object())) {
         case ObjType::STRING:
-            FMT_PRINT("\"{}\"", Value::ToObjString(value)->str);
+            FMT_PRINT("\"{}\"", value.object()->asString()->str);
+            break;
+
+        case ObjType::FUNCTION:
+            FMT_PRINT("<fn {}>", value.object()->asFunction()->name->str);
+            break;
+
+        case ObjType::FIBER:
+            FMT_PRINT("<fiber {}>", value.object()->asFiber()->function->name->str);
             break;
 
         case ObjType::NONE:
@@ -18,18 +30,52 @@ void printObject(const Value value) {
 // @formatter:off
 // clang-format off
 void printValue(Value value) {
-    switch (value.type) {
+    switch (value.valueType()) {
         case ValueType::NONE:     FMT_PRINT("None");                                  break;
-        case ValueType::BOOL:     FMT_PRINT("{}", value.as.boolean);                  break;
-        case ValueType::DOUBLE:   FMT_PRINT("{}", value.as.decimal);                  break;
-        case ValueType::INT:      FMT_PRINT("{}", value.as.integer);                  break;
-        case ValueType::INFINITY: FMT_PRINT("{}", value.as.boolean ? "inf" : "-inf"); break;
-        case ValueType::NAN:      FMT_PRINT("{}", value.as.boolean ? "nan" : "-nan"); break;
+        case ValueType::BOOL:     FMT_PRINT("{}", value.boolean());                  break;
+        case ValueType::DOUBLE:   FMT_PRINT("{}", value.decimal());                  break;
+        case ValueType::INT:      FMT_PRINT("{}", value.integer());                  break;
+        case ValueType::INFINITY: FMT_PRINT("{}", value.boolean() ? "inf" : "-inf"); break;
+        case ValueType::NAN:      FMT_PRINT("{}", value.boolean() ? "nan" : "-nan"); break;
         case ValueType::OBJECT:   printObject(value);                                 break;
     }
 }
 
-#if defined(TRACE_EXECUTION) || defined(_DEBUG)
+namespace {
+std::string_view fixedText(const Value value) {
+    switch (value.valueType()) {
+        case ValueType::NONE:     return "None";
+        case ValueType::BOOL:     return value.boolean() ? "true" : "false";
+        case ValueType::INFINITY: return value.boolean() ? "inf" : "-inf";
+        case ValueType::NAN:      return value.boolean() ? "nan" : "-nan";
+        case ValueType::OBJECT:   return value.isObjectType(ObjType::STRING)
+                                           ? std::string_view(value.object()->asString()->str)
+                                           : "<Unprintable Object Type>";
+        default:                  return {};
+    }
+}
+} // namespace
+
+// Doubles use {:f} so the text matches std::to_string, which `+` goes through.
+size_t stringifiedSize(const Value value) {
+    switch (value.valueType()) {
+        case ValueType::INT:    return fmt::formatted_size("{}", value.integer());
+        case ValueType::DOUBLE: return fmt::formatted_size("{:f}", value.decimal());
+        default:                return fixedText(value).size();
+    }
+}
+
+char* stringifyValue(char* out, const Value value) {
+    switch (value.valueType()) {
+        case ValueType::INT:    return fmt::format_to(out, "{}", value.integer());
+        case ValueType::DOUBLE: return fmt::format_to(out, "{:f}", value.decimal());
+        default: {
+            const std::string_view text = fixedText(value);
+            return std::copy(text.begin(), text.end(), out);
+        }
+    }
+}
+
 std::string unEscape(const std::string& str) {
     std::string result;
     for (const char c : str) {
@@ -53,9 +99,17 @@ std::string unEscape(const std::string& str) {
 }
 
 void Debug_printObject(const Value value) {
-    switch (Obj::TypeOf(value.as.obj)) {
+    switch (Obj::TypeOf(value.object())) {
         case ObjType::STRING:
-            FMT_PRINT("\"{}\"", unEscape(Value::ToObjString(value)->str));
+            FMT_PRINT("\"{}\"", unEscape(value.object()->asString()->str));
+            break;
+
+        case ObjType::FUNCTION:
+            FMT_PRINT("<fn {}>", value.object()->asFunction()->name->str);
+            break;
+
+        case ObjType::FIBER:
+            FMT_PRINT("<fiber {}>", value.object()->asFiber()->function->name->str);
             break;
 
         case ObjType::NONE:
@@ -65,16 +119,15 @@ void Debug_printObject(const Value value) {
 }
 
 void Debug_printValue(Value value) {
-    switch (value.type) {
+    switch (value.valueType()) {
         case ValueType::NONE:      FMT_PRINT("None"); break;
-        case ValueType::BOOL:     FMT_PRINT("{}", value.as.boolean); break;
-        case ValueType::DOUBLE:   FMT_PRINT("{}", value.as.decimal); break;
-        case ValueType::INT:      FMT_PRINT("{}", value.as.integer); break;
-        case ValueType::INFINITY: FMT_PRINT("{}", value.as.boolean ? "inf" : "-inf"); break;
-        case ValueType::NAN:      FMT_PRINT("{}", value.as.boolean ? "nan" : "-nan"); break;
+        case ValueType::BOOL:     FMT_PRINT("{}", value.boolean()); break;
+        case ValueType::DOUBLE:   FMT_PRINT("{}", value.decimal()); break;
+        case ValueType::INT:      FMT_PRINT("{}", value.integer()); break;
+        case ValueType::INFINITY: FMT_PRINT("{}", value.boolean() ? "inf" : "-inf"); break;
+        case ValueType::NAN:      FMT_PRINT("{}", value.boolean() ? "nan" : "-nan"); break;
         case ValueType::OBJECT:   Debug_printObject(value); break;
     }
 }
-#endif
 // clang-format on
 // @formatter:on
@@ -1,361 +1,1075 @@
 #include "VirtualMachine.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <iterator>
 #include <string>
 #include <utility>
 
 #include "Common.hpp"
+#include "Compiler.hpp"
+#include "Operators.hpp"
 #include "Value.hpp"
 #include "Utils/Stack.hpp"
 
 
-VM::State VM::VMstate;
+
+// Computed-goto dispatch: every handler ends in its own indirect jump through a table of
+// label addresses, instead of all of them sharing the switch's bounds check and jump.
+// Traced builds keep the switch, as the trace is printed at the top of its loop, and so do
+// builds defining SWITCH_DISPATCH, to compare the two with benchmarks/run.sh.
+#if defined(GCCBUILD) && !defined(TRACE_EXECUTION) && !defined(SWITCH_DISPATCH)
+#define COMPUTED_GOTO
+#define OP(name) op_##name: case OpCode::name
+#define DISPATCH() goto *dispatch[READ_BYTE()]
+#else
+#define OP(name) case OpCode::name
+#define DISPATCH() break
+#endif
 
 
 void VM::InitVM() {
-    VMstate.stack = Stack<Value>();
-    VMstate.strings = std::unordered_set<ObjString>();
-    VMstate.globals = std::unordered_map<ObjString, Value>();
-    VMstate.objects = LinkedList::Single<Obj*>();
-    VMstate.ip = nullptr;
+    state.stack = Stack<Value>();
+    state.scriptDepth = 0;
+    state.functionDepth = 0;
+    state.frames.assign(FRAMES_MAX, CallFrame{});
+    state.frameCount = 0;
+    state.frame = nullptr;
+    state.fiber = nullptr;
+    state.strings = std::unordered_map<std::string_view, const ObjString*>();
+    state.globals = std::unordered_map<ObjString, Value>();
+    state.objects = LinkedList::Single<Obj*>();
+    state.ip = nullptr;
+    state.fuel = UNLIMITED_FUEL;
+    state.profileBranches = false;
+    state.branchCounts.clear();
 }
 
 void VM::ShutdownVM() {
-    VMstate.stack.reset();
-    VMstate.objects.clear();
-    VMstate.strings.clear();
-    VMstate.globals.clear();
-    VMstate.ip = nullptr;
+    FreeObjects();
+    state.stack.reset();
+    state.objects.clear();
+    state.strings.clear();
+    state.globals.clear();
+    state.profiler.reset();
+    state.trace.reset();
+#if defined(HAS_JIT)
+    state.jit.reset();
+#endif
+    state.frameCount = 0;
+    state.frame = nullptr;
+    state.ip = nullptr;
+}
+
+void VM::Reset() {
+    // Left in a fiber by running out of fuel, the stack and frames in use are the fiber's.
+    if (state.fiber != nullptr) SwitchTo(nullptr);
+    FreeObjects();
+    state.strings.clear();
+    state.globals.clear();
+    state.branchCounts.clear();
+    state.profileBranches = false;
+    state.fuel = UNLIMITED_FUEL;
+    state.profiler.reset();
+    state.trace.reset();
+#if defined(HAS_JIT)
+    state.jit.reset();
+#endif
+    state.chunk = Chunk();
+    state.stack.reset();
+    state.frameCount = 0;
+    state.frame = nullptr;
+    state.ip = nullptr;
+}
+
+// Objects are allocated as their own type, so they must be deleted as it too.
+void VM::FreeObjects() {
+    while (const std::optional<Obj*> object = state.objects.pop()) {
+        switch ((*object)->type) {
+            case ObjType::STRING: delete (*object)->asString(); break;
+            case ObjType::FUNCTION: {
+                const ObjFunction* function = (*object)->asFunction();
+                delete function->chunk;
+                delete function->lazy;
+                delete function;
+                break;
+            }
+            case ObjType::FIBER: delete (*object)->asFiber(); break;
+            case ObjType::NONE: break;
+        }
+    }
+}
+
+namespace {
+// The deepest frame of any function compiled into the chunk, nested ones included.
+uint32_t deepestFunction(const Chunk& chunk) {
+    uint32_t depth = 0;
+    for (const Value& constant : chunk.constants) {
+        if (!constant.isObjectType(ObjType::FUNCTION)) continue;
+
+        const ObjFunction* function = constant.object()->asFunction();
+        if (function->chunk == nullptr) continue;
+        depth = std::max({depth, function->chunk->maxDepth, deepestFunction(*function->chunk)});
+    }
+
+    return depth;
+}
+} // namespace
+
+// Only ever grows the stack, keeping what is on it. Nothing may hold a pointer into the
+// old stack across a call that can get here.
+void VM::ReserveStack(const uint32_t scriptDepth, const uint32_t functionDepth) {
+    if (scriptDepth <= state.scriptDepth && functionDepth <= state.functionDepth) return;
+
+    state.scriptDepth = std::max(state.scriptDepth, scriptDepth);
+    state.functionDepth = std::max(state.functionDepth, functionDepth);
+
+    GrowStack(state.scriptDepth + static_cast<size_t>(FRAMES_MAX) * state.functionDepth);
+}
+
+void VM::GrowStack(const size_t capacity) {
+    Stack<Value> stack(capacity);
+    std::copy(state.stack.begin(), state.stack.end(), stack.begin());
+    stack.resize(state.stack.size());
+    state.stack = std::move(stack);
 }
 
 void VM::SetChunk(Chunk chunk) {
-    VMstate.chunk = std::move(chunk);
-    VMstate.ip = VMstate.chunk.code.data();
+    state.chunk = std::move(chunk);
+    ReserveStack(state.chunk.maxDepth, deepestFunction(state.chunk));
+    state.ip = state.chunk.code.data();
+
+    state.frames[0] = CallFrame{nullptr, &state.chunk, state.ip, 0};
+    if (state.trace) state.trace->setScript(state.chunk);
+    state.frameCount = 1;
+    state.frame = &state.frames[0];
 }
 
+// Arguments are left in place: they become slots 1..n of the new frame, after the callee.
+InterpretResult VM::CallValue(const Value callee, const uint8_t argCount, const bool tailCall) {
+    if (!callee.isObjectType(ObjType::FUNCTION)) {
+        RuntimeError("Can only call functions.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    ObjFunction* function = callee.object()->asFunction();
+    if (argCount != function->arity) {
+        RuntimeError("Expected {} arguments but got {}.", function->arity, argCount);
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    if (!tailCall && state.frameCount == FRAMES_MAX) {
+        RuntimeError("Stack overflow.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    if (function->lazy != nullptr) [[unlikely]] {
+        if (!Compiler::CompileLazy(*this, function)) return InterpretResult::COMPILE_ERROR;
+    }
+
+    // The script's stack is sized up front for what was compiled by then; a fiber's starts
+    // out with room for its first frame only. Frames that don't fit grow the stack.
+    const size_t base = tailCall ? state.frame->base : state.stack.size() - argCount - 1;
+    if (base + function->chunk->maxDepth > state.stack.capacity()) [[unlikely]]
+        GrowStack(std::max(base + function->chunk->maxDepth, 2 * state.stack.capacity()));
+
+    if (tailCall) {
+        // Slide the callee and its arguments down over the frame being given up.
+        const auto callStart = state.stack.end() - argCount - 1;
+        std::move(callStart, state.stack.end(), state.stack.begin() + state.frame->base);
+        state.stack.resize(state.frame->base + argCount + 1);
+    }
+    else {
+        state.frame->ip = state.ip;
+        if (state.frameCount == state.frames.size()) [[unlikely]]
+            state.frames.resize(std::min<size_t>(2 * state.frames.size(), FRAMES_MAX));
+        state.frame = &state.frames[state.frameCount++];
+        state.frame->base = base;
+    }
+
+    state.frame->function = function;
+    state.frame->chunk = function->chunk;
+    state.ip = function->chunk->code.data();
+    return InterpretResult::OK;
+}
+
+InterpretResult VM::NewFiber(const Value callee, const uint8_t argCount) {
+    if (!callee.isObjectType(ObjType::FUNCTION)) {
+        RuntimeError("Can only make fibers of functions.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    ObjFunction* function = callee.object()->asFunction();
+    if (argCount != function->arity) {
+        RuntimeError("Expected {} arguments but got {}.", function->arity, argCount);
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    if (function->lazy != nullptr) [[unlikely]] {
+        if (!Compiler::CompileLazy(*this, function)) return InterpretResult::COMPILE_ERROR;
+    }
+
+    const ObjFiber* fiber = ObjFiber::Create(*this, state.stack.end() - argCount - 1, argCount);
+    state.stack.resize(state.stack.size() - argCount - 1);
+    state.stack.push(Value::ObjectVal(fiber));
+    return InterpretResult::OK;
+}
+
+InterpretResult VM::Resume(const Value target) {
+    if (!target.isObjectType(ObjType::FIBER)) {
+        RuntimeError("Can only resume fibers.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    ObjFiber* fiber = target.object()->asFiber();
+    if (fiber->status == ObjFiber::Status::DONE) {
+        RuntimeError("Can't resume a fiber that has finished.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    if (fiber->status == ObjFiber::Status::RUNNING) {
+        RuntimeError("Can't resume a fiber that is running.");
+        return InterpretResult::RUNTIME_ERROR;
+    }
+
+    // What the fiber yields or returns is pushed in its place.
+    state.stack.pop();
+    fiber->status = ObjFiber::Status::RUNNING;
+    fiber->resumer = state.fiber;
+    SwitchTo(fiber);
+    return InterpretResult::OK;
+}
+
+void VM::LeaveFiber(const ObjFiber::Status status, const Value value) {
+    ObjFiber* fiber = state.fiber;
+    fiber->status = status;
+    SwitchTo(fiber->resumer);
+    fiber->resumer = nullptr;
+    // A finished fiber never runs again, so its stack and frames can go.
+    if (status == ObjFiber::Status::DONE) fiber->context = ExecutionContext();
+
+    state.stack.push(value);
+}
+
+// Only moves the stacks' and frame arrays' storage, never copying their contents.
+void VM::SwitchTo(ObjFiber* fiber) {
+    state.frame->ip = state.ip;
+    ExecutionContext& from = state.fiber != nullptr ? state.fiber->context : state.script;
+    from.stack = std::move(state.stack);
+    from.frames = std::move(state.frames);
+    from.frameCount = state.frameCount;
+
+    ExecutionContext& to = fiber != nullptr ? fiber->context : state.script;
+    state.stack = std::move(to.stack);
+    state.frames = std::move(to.frames);
+    state.frameCount = to.frameCount;
+    state.frame = &state.frames[state.frameCount - 1];
+    state.ip = state.frame->ip;
+    state.fiber = fiber;
+}
+
+void VM::RecordBranch(const bool taken) {
+    const Chunk* chunk = state.frame->chunk;
+    std::vector<BranchCounts>& chunkCounts = state.branchCounts[chunk];
+    if (chunkCounts.empty()) chunkCounts.resize(chunk->code.size());
+
+    // The jump's operands have already been read.
+    const size_t offset = static_cast<size_t>(state.ip - chunk->code.data()) - 3;
+    BranchCounts& counts = chunkCounts[offset];
+    (taken ? counts.taken : counts.fallthrough)++;
+}
+
+void VM::ObserveInstruction(const uint8_t* instruction, const Value* top) {
+    const Chunk& chunk = *state.frame->chunk;
+    const auto offset = static_cast<size_t>(instruction - chunk.code.data());
+    if (state.profiler) state.profiler->enter(*instruction, chunk.lines[offset]);
+    if (state.trace) state.trace->record(chunk, offset, *instruction, state.stack.begin(), top);
+}
+
+#if defined(HAS_JIT)
+bool VM::CompileLoop(const size_t loopOffset, const int32_t depth) {
+    Chunk& chunk = *state.frame->chunk;
+    const ObjFunction* function = state.frame->function;
+    const int32_t entryDepth = function != nullptr ? function->arity + 1 : 0;
+    const std::string name = function != nullptr ? function->name->str : "script";
+
+    const JitCode code =
+        state.jit->compileLoop(chunk, loopOffset, entryDepth, depth, state.globals, name);
+    if (code == nullptr) return false;
+
+    chunk.jitLoops[loopOffset] = code;
+    chunk.code[loopOffset] = OpCode::LOOP_JIT;
+    return true;
+}
+#endif
+
+namespace {
+void printFrames(const std::vector<CallFrame>& frames, const uint32_t frameCount) {
+    for (uint32_t i = frameCount; i > 0; i--) {
+        const CallFrame& frame = frames[i - 1];
+        const size_t instructionIdx = static_cast<size_t>(frame.ip - frame.chunk->code.data());
+        const size_t line = frame.chunk->lines[instructionIdx];
+
+        if (frame.function == nullptr) { FMT_PRINTLN("[line {}] in script", line); }
+        else { FMT_PRINTLN("[line {}] in {}()", line, frame.function->name->str); }
+    }
+}
+} // namespace
+
+// An error in a fiber ends it and every fiber waiting on it, going back to the script.
 template <AllPrintable... Ts>
 void VM::RuntimeError(const std::string& message, Ts... args) {
     FMT_PRINT(message + "\n", args...);
 
-    const uint8_t instructionIdx =
-        static_cast<uint8_t>(VMstate.ip - VMstate.chunk.code.data());
-    size_t line = VMstate.chunk.lines[instructionIdx];
-    FMT_PRINTLN("[line {}] in script", line);
-    VMstate.stack.reset();
+    state.frame->ip = state.ip;
+    printFrames(state.frames, state.frameCount);
+    for (ObjFiber* fiber = state.fiber; fiber != nullptr; fiber = fiber->resumer) {
+        const ExecutionContext& resumer =
+            fiber->resumer != nullptr ? fiber->resumer->context : state.script;
+        printFrames(resumer.frames, resumer.frameCount);
+        fiber->status = ObjFiber::Status::DONE;
+    }
+    if (state.fiber != nullptr) SwitchTo(nullptr);
+
+    state.stack.reset();
 }
 
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>(ip[-2] << 8 | ip[-1]))
+#define READ_LONG() \
+    (ip += 4, static_cast<uint32_t>(ip[-4] << 24 | ip[-3] << 16 | ip[-2] << 8 | ip[-1]))
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_CONSTANT_LONG() (constants[READ_LONG()])
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - static_cast<ptrdiff_t>(distance)])
+
+#define STORE_STATE() (state.ip = ip, state.stack.setTop(sp))
+#define LOAD_STATE()                                                                    \
+    (ip = state.ip, sp = state.stack.top(),                                         \
+     slots = state.stack.begin() + state.frame->base,                               \
+     constants = state.frame->chunk->constants.data())
+
+#define BINARY_OP(op)                                                                   \
+    const char* error = Operators::applyBinary<Operators::op>(*this, sp);               \
+    if (error != nullptr) [[unlikely]] {                                                \
+        STORE_STATE();                                                                  \
+        RuntimeError(error);                                                            \
+        return InterpretResult::RUNTIME_ERROR;                                          \
+    }                                                                                   \
+    sp--
+
+// The compiler has proven both operands ints, but the result can still overflow.
+#define INT_OP(checked)                                                                 \
+    const std::optional<Value> result =                                                 \
+        Value::checked(PEEK(1).integer(), PEEK(0).integer());                           \
+    if (!result) [[unlikely]] {                                                         \
+        STORE_STATE();                                                                  \
+        RuntimeError(Operators::overflowError);                                         \
+        return InterpretResult::RUNTIME_ERROR;                                          \
+    }                                                                                   \
+    sp[-2] = *result;                                                                   \
+    sp--
+
+// Loop iterations and calls use fuel. Once it is spent, the run stops before the
+// instruction just read, to run it first thing when Run is called again.
+#define USE_FUEL()                                                                      \
+    if (state.fuel == 0) [[unlikely]] {                                                 \
+        ip--;                                                                           \
+        STORE_STATE();                                                                  \
+        return InterpretResult::OUT_OF_FUEL;                                            \
+    }                                                                                   \
+    state.fuel--
+
+// Quickening: the generic instruction just read is rewritten in place into its int or
+// double form once it sees two ints or two doubles.
+#define QUICKEN_BINARY(intOp, doubleOp)                                                 \
+    if (PEEK(0).isInteger() && PEEK(1).isInteger()) ip[-1] = OpCode::intOp;             \
+    else if (PEEK(0).isDouble() && PEEK(1).isDouble()) ip[-1] = OpCode::doubleOp
+
+// A quickened form whose operands fail `check` puts the generic opcode back and runs it.
+#define QUICKENED_BINARY(generic, check, result)                                        \
+    const Value b = PEEK(0);                                                            \
+    const Value a = PEEK(1);                                                            \
+    if (!a.check() || !b.check()) [[unlikely]] {                                        \
+        *--ip = OpCode::generic;                                                        \
+        DISPATCH();                                                                     \
+    }                                                                                   \
+    sp[-2] = (result);                                                                  \
+    sp--
+
 InterpretResult VM::Run() {
+#if defined(COMPUTED_GOTO)
+    // Indexed by opcode, so it has to list them in the order OpCode::Code declares them.
+    static const void* const dispatchTable[] = {
+        &&op_CONSTANT,
+        &&op_CONSTANT_LONG,
+        &&op_NONE,
+        &&op_TRUE,
+        &&op_FALSE,
+        &&op_POP,
+        &&op_POPN,
+        &&op_GET_LOCAL,
+        &&op_GET_LOCAL_LONG,
+        &&op_SET_LOCAL,
+        &&op_SET_LOCAL_LONG,
+        &&op_GET_GLOBAL,
+        &&op_GET_GLOBAL_LONG,
+        &&op_DEF_GLOBAL,
+        &&op_DEF_GLOBAL_LONG,
+        &&op_SET_GLOBAL,
+        &&op_SET_GLOBAL_LONG,
+        &&op_EQUAL,
+        &&op_GREATER,
+        &&op_LESS,
+        &&op_ADD,
+        &&op_SUBTRACT,
+        &&op_MULTIPLY,
+        &&op_DIVIDE,
+        &&op_LEFTSHIFT,
+        &&op_RIGHTSHIFT,
+        &&op_MODULO,
+        &&op_NEGATE,
+        &&op_ADD_INT,
+        &&op_ADD_DOUBLE,
+        &&op_SUBTRACT_INT,
+        &&op_SUBTRACT_DOUBLE,
+        &&op_MULTIPLY_INT,
+        &&op_MULTIPLY_DOUBLE,
+        &&op_LESS_INT,
+        &&op_LESS_DOUBLE,
+        &&op_GREATER_INT,
+        &&op_GREATER_DOUBLE,
+        &&op_ADD_INT_INT,
+        &&op_ADD_DOUBLE_DOUBLE,
+        &&op_LESS_INT_INT,
+        &&op_LESS_DOUBLE_DOUBLE,
+        &&op_GREATER_INT_INT,
+        &&op_GREATER_DOUBLE_DOUBLE,
+        &&op_GET_GLOBAL_CACHED,
+#if defined(HAS_JIT)
+        &&op_LOOP_JIT,
+#else
+        &&op_UNKNOWN, // LOOP_JIT
+#endif
+        &&op_CONCAT_STR,
+        &&op_CHECK_TYPE,
+        &&op_BUILD_STRING,
+        &&op_UNKNOWN, // AND
+        &&op_UNKNOWN, // OR
+        &&op_NOT,
+        &&op_PRINT,
+        &&op_JUMP,
+        &&op_JUMP_FALSE,
+        &&op_UNKNOWN, // JUMP_LONG
+        &&op_UNKNOWN, // JUMP_FALSE_LONG
+        &&op_LOOP,
+        &&op_UNKNOWN, // LOOP_LONG
+        &&op_JUMP_TRUE,
+        &&op_JUMP_BACK,
+        &&op_FOR_RANGE,
+        &&op_DUP,
+        &&op_INC,
+        &&op_DEC,
+        &&op_CALL,
+        &&op_TAIL_CALL,
+        &&op_FIBER,
+        &&op_RESUME,
+        &&op_YIELD,
+        &&op_RETURN,
+    };
+    static_assert(std::size(dispatchTable) == OpCode::RETURN + 1);
+
+    // Profiling and tracing send every opcode through op_OBSERVE on its way to the handler,
+    // so that runs without them don't even pay for a branch.
+    const void* observeTable[std::size(dispatchTable)];
+    const void* const* dispatch = dispatchTable;
+    if (state.profiler || state.trace) {
+        std::ranges::fill(observeTable, &&op_OBSERVE);
+        dispatch = observeTable;
+    }
+#endif
+
+    // The hot state lives in locals so that it can stay in registers. It is written back
+    // with STORE_STATE before anything else may look at it: calls, errors and returns.
+    uint8_t* ip;
+    Value* sp;
+    Value* slots;
+    const Value* constants;
+    LOAD_STATE();
+
     while (true) {
 #if defined(TRACE_EXECUTION)
+        STORE_STATE();
         FMT_PRINT("          ");
-        for (auto& value : VMstate.stack) {
+        for (auto& value : state.stack) {
             FMT_PRINT("[ ");
             Debug_printValue(value);
             FMT_PRINT(" ]");
         }
         FMT_PRINT("\n");
 
-        VMstate.chunk.disassembleInstruction(
-            static_cast<size_t>(VMstate.ip - VMstate.chunk.code.data()));
+        state.frame->chunk->disassembleInstruction(
+            static_cast<size_t>(state.ip - state.frame->chunk->code.data()));
 #endif
 
-        switch (ReadByte()) {
-            case OpCode::CONSTANT: {
-                Value constant = ReadConstant();
-                VMstate.stack.push(constant);
-                break;
+        // Under computed gotos, only the first instruction comes through here.
+        if (state.profiler || state.trace) [[unlikely]] ObserveInstruction(ip, sp);
+
+        switch (READ_BYTE()) {
+            OP(CONSTANT): {
+                Value constant = READ_CONSTANT();
+                PUSH(constant);
+                DISPATCH();
             }
 
-            case OpCode::FALSE: {
-                VMstate.stack.push(Value::BoolVal(false));
-                break;
+            OP(FALSE): {
+                PUSH(Value::BoolVal(false));
+                DISPATCH();
             }
 
-            case OpCode::TRUE: {
-                VMstate.stack.push(Value::BoolVal(true));
-                break;
+            OP(TRUE): {
+                PUSH(Value::BoolVal(true));
+                DISPATCH();
             }
 
-            case OpCode::POP: {
-                VMstate.stack.pop();
-                break;
+            OP(POP): {
+                sp--;
+                DISPATCH();
             }
 
-            case OpCode::GET_LOCAL: {
-                uint8_t slot = ReadByte();
-                VMstate.stack.push(VMstate.stack[slot]);
-                break;
+            OP(POPN): {
+                sp -= READ_BYTE();
+                DISPATCH();
             }
 
-            case OpCode::GET_LOCAL_LONG: {
-                uint32_t slot = ReadLong();
-                VMstate.stack.push(VMstate.stack[slot]);
-                break;
+            OP(GET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                PUSH(slots[slot]);
+                DISPATCH();
             }
 
-            case OpCode::SET_LOCAL: {
-                uint8_t slot = ReadByte();
-                VMstate.stack[slot] = VMstate.stack.peek(0);
-                break;
+            OP(GET_LOCAL_LONG): {
+                uint32_t slot = READ_LONG();
+                PUSH(slots[slot]);
+                DISPATCH();
             }
 
-            case OpCode::SET_LOCAL_LONG: {
-                uint32_t slot = ReadLong();
-                VMstate.stack[slot] = VMstate.stack.peek(0);
-                break;
+            OP(SET_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                slots[slot] = PEEK(0);
+                DISPATCH();
             }
 
-            case OpCode::GET_GLOBAL: {
-                const ObjString* name = Value::AsObject(ReadConstant())->asString();
-                if (!VMstate.globals.contains(*name)) {
+            OP(SET_LOCAL_LONG): {
+                uint32_t slot = READ_LONG();
+                slots[slot] = PEEK(0);
+                DISPATCH();
+            }
+
+            OP(GET_GLOBAL): {
+                const uint8_t index = READ_BYTE();
+                const ObjString* name = Value::AsObject(constants[index])->asString();
+                const auto global = state.globals.find(*name);
+                if (global == state.globals.end()) {
+                    STORE_STATE();
                     RuntimeError("Undefined variable '{}'.", name->str);
                     return InterpretResult::RUNTIME_ERROR;
                 }
 
-                VMstate.stack.push(VMstate.globals[*name]);
-                break;
+                // Once defined, a global keeps its slot in the map for good.
+                Chunk* chunk = state.frame->chunk;
+                if (chunk->globalSlots.empty()) chunk->globalSlots.resize(chunk->constants.size());
+                chunk->globalSlots[index] = &global->second;
+                ip[-2] = OpCode::GET_GLOBAL_CACHED;
+
+                PUSH(global->second);
+                DISPATCH();
             }
 
-            case OpCode::GET_GLOBAL_LONG: {
-                const ObjString* name = Value::AsObject(ReadConstantLong())->asString();
-                if (!VMstate.globals.contains(*name)) {
+            OP(GET_GLOBAL_CACHED): {
+                PUSH(*state.frame->chunk->globalSlots[READ_BYTE()]);
+                DISPATCH();
+            }
+
+            OP(GET_GLOBAL_LONG): {
+                const ObjString* name = Value::AsObject(READ_CONSTANT_LONG())->asString();
+                if (!state.globals.contains(*name)) {
+                    STORE_STATE();
                     RuntimeError("Undefined variable '{}'.", name->str);
                     return InterpretResult::RUNTIME_ERROR;
                 }
 
-                VMstate.stack.push(VMstate.globals[*name]);
-                break;
+                PUSH(state.globals[*name]);
+                DISPATCH();
             }
 
-            case OpCode::SET_GLOBAL: {
-                const ObjString* name = Value::AsObject(ReadConstant())->asString();
-                if (!VMstate.globals.contains(*name)) {
+            OP(SET_GLOBAL): {
+                const ObjString* name = Value::AsObject(READ_CONSTANT())->asString();
+                if (!state.globals.contains(*name)) {
+                    STORE_STATE();
                     RuntimeError("Undefined variable '{}'.", name->str);
                     return InterpretResult::RUNTIME_ERROR;
                 }
 
-                VMstate.globals[*name] = VMstate.stack.peek(0);
-                break;
+                state.globals[*name] = PEEK(0);
+                DISPATCH();
             }
 
-            case OpCode::SET_GLOBAL_LONG: {
-                const ObjString* name = Value::AsObject(ReadConstantLong())->asString();
-                if (!VMstate.globals.contains(*name)) {
+            OP(SET_GLOBAL_LONG): {
+                const ObjString* name = Value::AsObject(READ_CONSTANT_LONG())->asString();
+                if (!state.globals.contains(*name)) {
+                    STORE_STATE();
                     RuntimeError("Undefined variable '{}'.", name->str);
                     return InterpretResult::RUNTIME_ERROR;
                 }
 
-                VMstate.globals[*name] = VMstate.stack.peek(0);
-                break;
+                state.globals[*name] = PEEK(0);
+                DISPATCH();
             }
 
-            case OpCode::DEF_GLOBAL: {
-                const ObjString* name = Value::AsObject(ReadConstant())->asString();
-                DefineGlobal(name, VMstate.stack.pop());
-                break;
+            OP(DEF_GLOBAL): {
+                const ObjString* name = Value::AsObject(READ_CONSTANT())->asString();
+                DefineGlobal(name, POP());
+                DISPATCH();
             }
 
-            case OpCode::DEF_GLOBAL_LONG: {
-                const ObjString* name = Value::AsObject(ReadConstantLong())->asString();
-                DefineGlobal(name, VMstate.stack.pop());
-                break;
+            OP(DEF_GLOBAL_LONG): {
+                const ObjString* name = Value::AsObject(READ_CONSTANT_LONG())->asString();
+                DefineGlobal(name, POP());
+                DISPATCH();
             }
 
-            case OpCode::NONE: VMstate.stack.push(Value::NoneVal());
-                break;
+            OP(NONE): PUSH(Value::NoneVal());
+                DISPATCH();
 
-            case OpCode::CONSTANT_LONG: {
-                Value constant = ReadConstantLong();
-                VMstate.stack.push(constant);
-                break;
+            OP(CONSTANT_LONG): {
+                Value constant = READ_CONSTANT_LONG();
+                PUSH(constant);
+                DISPATCH();
             }
 
-            case OpCode::DUP: {
-                VMstate.stack.push(VMstate.stack.peek(0));
-                break;
+            OP(DUP): {
+                const Value top = PEEK(0);
+                PUSH(top);
+                DISPATCH();
+            }
+
+            OP(INC): {
+                const char* error = Operators::step(PEEK(0), 1, "Can only increment numbers.");
+                if (error != nullptr) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError(error);
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                DISPATCH();
             }
 
-            case OpCode::INC: {
-                if (!VMstate.stack.peek(0).isNumber()) {
-                    RuntimeError("Can only increment numbers.");
+            OP(DEC): {
+                const char* error = Operators::step(PEEK(0), -1, "Can only decrement numbers.");
+                if (error != nullptr) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError(error);
                     return InterpretResult::RUNTIME_ERROR;
                 }
+                DISPATCH();
+            }
 
-                Value a = VMstate.stack.pop();
-                double val = Value::AsDouble(a).as.decimal + 1;
-                VMstate.stack.push(Value::NumberVal(val, a.isDouble()));
+            OP(EQUAL): {
+                Value firstVal = POP();
+                Value secondVal = POP();
+                PUSH(Value::BoolVal(secondVal.isEqualTo(firstVal)));
+                DISPATCH();
+            }
 
-                break;
+            OP(GREATER): {
+                QUICKEN_BINARY(GREATER_INT_INT, GREATER_DOUBLE_DOUBLE);
+                BINARY_OP(Greater);
+                DISPATCH();
+            }
+
+            OP(LESS): {
+                QUICKEN_BINARY(LESS_INT_INT, LESS_DOUBLE_DOUBLE);
+                BINARY_OP(Less);
+                DISPATCH();
+            }
+
+            OP(ADD): {
+                QUICKEN_BINARY(ADD_INT_INT, ADD_DOUBLE_DOUBLE);
+                BINARY_OP(Add);
+                DISPATCH();
             }
 
-            case OpCode::DEC: {
-                if (!VMstate.stack.peek(0).isNumber()) {
-                    RuntimeError("Can only decrement numbers.");
+            OP(SUBTRACT): {
+                if (const char* error = Operators::negate(PEEK(0))) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError(error);
                     return InterpretResult::RUNTIME_ERROR;
                 }
+                BINARY_OP(Add);
+                DISPATCH();
+            }
 
-                Value a = VMstate.stack.pop();
-                double val = Value::AsDouble(a).as.decimal - 1;
-                VMstate.stack.push(Value::NumberVal(val, a.isDouble()));
+            OP(MULTIPLY): {
+                BINARY_OP(Multiply);
+                DISPATCH();
+            }
 
-                break;
+            OP(DIVIDE): {
+                BINARY_OP(Divide);
+                DISPATCH();
             }
 
-            case OpCode::EQUAL: {
-                Value firstVal = VMstate.stack.pop();
-                Value secondVal = VMstate.stack.pop();
-                VMstate.stack.push(Value::BoolVal(secondVal.isEqualTo(firstVal)));
-                break;
+            OP(NOT): {
+                PEEK(0) = Value::BoolVal(PEEK(0).isFalsey());
+                DISPATCH();
             }
 
-            case OpCode::GREATER: {
-                if (auto a = BinaryOp<std::greater<Value>>(&VM::DigitChecker)) return a.value();
-                break;
+            OP(NEGATE): {
+                if (const char* error = Operators::negate(PEEK(0))) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError(error);
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                DISPATCH();
             }
 
-            case OpCode::LESS: {
-                if (auto a = BinaryOp<std::less<Value>>(&VM::DigitChecker))
-                    return a.
-                        value();
-                break;
+            OP(LEFTSHIFT): {
+                BINARY_OP(LeftShift);
+                DISPATCH();
             }
 
-            case OpCode::ADD: {
-                if (auto a = BinaryOp<std::plus<Value>>(&VM::AddableChecker))
-                    return a
-                        .value();
-                break;
+            OP(RIGHTSHIFT): {
+                BINARY_OP(RightShift);
+                DISPATCH();
             }
 
-            case OpCode::MULTIPLY: {
-                if (auto a = BinaryOp<std::multiplies<Value>>(
-                    &VM::MultiplicableChecker))
-                    return a.value();
-                break;
+            OP(MODULO): {
+                BINARY_OP(Modulo);
+                DISPATCH();
             }
 
-            case OpCode::DIVIDE: {
-                if (auto a = BinaryOp<std::divides<Value>>(&VM::DigitChecker)) return a.value();
-                break;
+            OP(ADD_INT): {
+                INT_OP(AddIntegers);
+                DISPATCH();
             }
 
-            case OpCode::NOT: {
-                VMstate.stack.push(Value::BoolVal(VMstate.stack.pop().isFalsey()));
-                break;
+            OP(ADD_DOUBLE): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::DoubleVal(a.real() + b.real()));
+                DISPATCH();
             }
 
-            case OpCode::NEGATE: {
-                if (!VMstate.stack.peek(0).isNumber() &&
-                    !VMstate.stack.peek(0).isSpecialNumber()) {
-                    RuntimeError("Operand must be a number.");
+            OP(SUBTRACT_INT): {
+                INT_OP(SubtractIntegers);
+                DISPATCH();
+            }
+
+            OP(SUBTRACT_DOUBLE): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::DoubleVal(a.real() - b.real()));
+                DISPATCH();
+            }
+
+            OP(MULTIPLY_INT): {
+                INT_OP(MultiplyIntegers);
+                DISPATCH();
+            }
+
+            OP(MULTIPLY_DOUBLE): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::DoubleVal(a.real() * b.real()));
+                DISPATCH();
+            }
+
+            OP(LESS_INT): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::BoolVal(a.integer() < b.integer()));
+                DISPATCH();
+            }
+
+            OP(LESS_DOUBLE): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::BoolVal(a.real() < b.real()));
+                DISPATCH();
+            }
+
+            OP(GREATER_INT): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::BoolVal(a.integer() > b.integer()));
+                DISPATCH();
+            }
+
+            OP(GREATER_DOUBLE): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::BoolVal(a.real() > b.real()));
+                DISPATCH();
+            }
+
+            OP(ADD_INT_INT): {
+                // A sum that overflows goes back to ADD as well, which reports it.
+                const ssize_t sum = PEEK(1).integer() + PEEK(0).integer();
+                if (!Value::FitsInteger(sum)) [[unlikely]] {
+                    *--ip = OpCode::ADD;
+                    DISPATCH();
+                }
+                QUICKENED_BINARY(ADD, isInteger, Value::IntegerVal(sum));
+                DISPATCH();
+            }
+
+            OP(ADD_DOUBLE_DOUBLE): {
+                QUICKENED_BINARY(ADD, isDouble, Value::DoubleVal(a.decimal() + b.decimal()));
+                DISPATCH();
+            }
+
+            OP(LESS_INT_INT): {
+                QUICKENED_BINARY(LESS, isInteger, Value::BoolVal(a.integer() < b.integer()));
+                DISPATCH();
+            }
+
+            OP(LESS_DOUBLE_DOUBLE): {
+                QUICKENED_BINARY(LESS, isDouble, Value::BoolVal(a.decimal() < b.decimal()));
+                DISPATCH();
+            }
+
+            OP(GREATER_INT_INT): {
+                QUICKENED_BINARY(GREATER, isInteger, Value::BoolVal(a.integer() > b.integer()));
+                DISPATCH();
+            }
+
+            OP(GREATER_DOUBLE_DOUBLE): {
+                QUICKENED_BINARY(GREATER, isDouble, Value::BoolVal(a.decimal() > b.decimal()));
+                DISPATCH();
+            }
+
+            OP(CONCAT_STR): {
+                const Value b = POP();
+                const Value a = POP();
+                PUSH(Value::ObjectVal(ObjString::Create(
+                    *this, a.object()->asString()->str + b.object()->asString()->str)));
+                DISPATCH();
+            }
+
+            OP(BUILD_STRING): {
+                const uint8_t count = READ_BYTE();
+                const Value str = Operators::buildString(*this, sp, count);
+                sp -= count;
+                PUSH(str);
+                DISPATCH();
+            }
+
+            OP(CHECK_TYPE): {
+                const auto expected = static_cast<StaticType>(READ_BYTE());
+                if (!PEEK(0).isOfStaticType(expected)) {
+                    STORE_STATE();
+                    RuntimeError("Expected a value of type '{}'.", StaticTypeName(expected));
                     return InterpretResult::RUNTIME_ERROR;
                 }
+                DISPATCH();
+            }
+
+            OP(PRINT): {
+                printValue(POP());
+                FMT_PRINT("\n");
+                DISPATCH();
+            }
+
+            OP(JUMP): {
+                uint16_t offset = READ_SHORT();
+                ip += offset;
+                DISPATCH();
+            }
 
-                auto a = VMstate.stack.pop();
-                if (a.isSpecialNumber()) {
-                    a.as.boolean = !a.as.boolean;
-                    VMstate.stack.push(a);
-                    break;
+            OP(JUMP_FALSE): {
+                uint16_t offset = READ_SHORT();
+                const bool taken = PEEK(0).isFalsey();
+                if (state.profileBranches) [[unlikely]] {
+                    state.ip = ip;
+                    RecordBranch(taken);
                 }
+                if (taken) ip += offset;
+                DISPATCH();
+            }
 
-                bool isDouble = a.isDouble();
-                double val = -Value::AsDouble(a).as.decimal;
-                VMstate.stack.push(Value::NumberVal(val, isDouble));
-                break;
+            OP(JUMP_TRUE): {
+                uint16_t offset = READ_SHORT();
+                const bool taken = !PEEK(0).isFalsey();
+                // Counted as the JUMP_FALSE it was compiled from.
+                if (state.profileBranches) [[unlikely]] {
+                    state.ip = ip;
+                    RecordBranch(!taken);
+                }
+                if (taken) ip += offset;
+                DISPATCH();
             }
 
-            case OpCode::LEFTSHIFT: {
-                if (auto a = BinaryOp<lshift<Value>>(&VM::IntegerChecker)) return a.value();
-                break;
+            OP(LOOP): {
+                USE_FUEL();
+                uint32_t offset = READ_SHORT();
+#if defined(HAS_JIT)
+                if (state.jit) [[unlikely]] {
+                    Chunk& chunk = *state.frame->chunk;
+                    const size_t at = static_cast<size_t>(ip - chunk.code.data()) - 3;
+                    if (chunk.loopCounts.empty()) chunk.loopCounts.resize(chunk.code.size());
+                    if (++chunk.loopCounts[at] == state.jit->threshold &&
+                        CompileLoop(at, static_cast<int32_t>(sp - slots))) {
+                        ip -= 3;
+                        DISPATCH();
+                    }
+                }
+#endif
+                ip -= offset;
+                DISPATCH();
             }
 
-            case OpCode::RIGHTSHIFT: {
-                if (auto a = BinaryOp<rshift<Value>>(&VM::IntegerChecker)) return a.value();
-                break;
+#if defined(HAS_JIT)
+            OP(LOOP_JIT): {
+                // The compiled loop starts where the LOOP jumps back to.
+                Chunk& chunk = *state.frame->chunk;
+                const size_t at = static_cast<size_t>(ip - chunk.code.data()) - 1;
+                ip = chunk.code.data() + chunk.jitLoops.at(at)(slots, &sp);
+                DISPATCH();
             }
+#endif
 
-            case OpCode::MODULO: {
-                if (auto a = BinaryOp<std::modulus<Value>>(&VM::DigitChecker)) return a.value();
-                break;
+            OP(JUMP_BACK): {
+                uint16_t offset = READ_SHORT();
+                ip -= offset;
+                DISPATCH();
             }
 
-            case OpCode::PRINT: {
-                printValue(VMstate.stack.pop());
-                FMT_PRINT("\n");
-                break;
+            // The operand slot holds the counter, see Operators::forRange.
+            OP(FOR_RANGE): {
+                const uint8_t slot = READ_BYTE();
+                const uint16_t offset = READ_SHORT();
+                const char* error;
+                const Operators::RangeStep next = Operators::forRange(slots + slot, error);
+                if (next == Operators::RangeStep::DONE) ip += offset;
+                else if (next == Operators::RangeStep::ERROR) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError(error);
+                    return InterpretResult::RUNTIME_ERROR;
+                }
+                DISPATCH();
             }
 
-            case OpCode::JUMP: {
-                uint16_t offset = ReadShort();
-                VMstate.ip += offset;
-                break;
+            OP(CALL): {
+                USE_FUEL();
+                const uint8_t argCount = READ_BYTE();
+                STORE_STATE();
+                if (const InterpretResult result = CallValue(PEEK(argCount), argCount);
+                    result != InterpretResult::OK)
+                    return result;
+                LOAD_STATE();
+                DISPATCH();
             }
 
-            case OpCode::JUMP_FALSE: {
-                uint16_t offset = ReadShort();
-                if (VMstate.stack.peek(0).isFalsey()) VMstate.ip += offset;
-                break;
+            OP(TAIL_CALL): {
+                USE_FUEL();
+                const uint8_t argCount = READ_BYTE();
+                STORE_STATE();
+                if (const InterpretResult result = CallValue(PEEK(argCount), argCount, true);
+                    result != InterpretResult::OK)
+                    return result;
+                LOAD_STATE();
+                DISPATCH();
             }
 
-            case OpCode::LOOP: {
-                uint32_t offset = ReadShort();
-                VMstate.ip -= offset;
-                break;
+            OP(FIBER): {
+                const uint8_t argCount = READ_BYTE();
+                STORE_STATE();
+                if (const InterpretResult result = NewFiber(PEEK(argCount), argCount);
+                    result != InterpretResult::OK)
+                    return result;
+                LOAD_STATE();
+                DISPATCH();
             }
 
-            case OpCode::RETURN: {
-                if (!VMstate.stack.empty()) printValue(VMstate.stack.pop());
-                FMT_PRINT("\n");
-                return InterpretResult::OK;
+            OP(RESUME): {
+                USE_FUEL();
+                STORE_STATE();
+                if (const InterpretResult result = Resume(PEEK(0));
+                    result != InterpretResult::OK)
+                    return result;
+                LOAD_STATE();
+                DISPATCH();
             }
 
-            default: return InterpretResult::RUNTIME_ERROR;
-        }
-    }
-}
+            OP(YIELD): {
+                if (state.fiber == nullptr) [[unlikely]] {
+                    STORE_STATE();
+                    RuntimeError("Can only yield inside a fiber.");
+                    return InterpretResult::RUNTIME_ERROR;
+                }
 
-InterpretResult VM::DigitChecker() {
-    if (!VMstate.stack.peek(0).isNumber() || !VMstate.stack.peek(1).isNumber()) {
-        RuntimeError("Operands must be numbers.");
-        return InterpretResult::RUNTIME_ERROR;
-    }
-    return InterpretResult::OK;
-}
+                const Value value = POP();
+                STORE_STATE();
+                LeaveFiber(ObjFiber::Status::SUSPENDED, value);
+                LOAD_STATE();
+                DISPATCH();
+            }
 
-InterpretResult VM::IntegerChecker() {
-    if (!VMstate.stack.peek(0).isInteger() || !VMstate.stack.peek(1).isInteger()) {
-        RuntimeError("Operands must be integers.");
-        return InterpretResult::RUNTIME_ERROR;
-    }
-    return InterpretResult::OK;
-}
+            OP(RETURN): {
+                if (state.frameCount == 1) {
+                    // The bottom frame of a fiber is its function's: the fiber is done.
+                    if (state.fiber != nullptr) {
+                        const Value result = POP();
+                        STORE_STATE();
+                        LeaveFiber(ObjFiber::Status::DONE, result);
+                        LOAD_STATE();
+                        DISPATCH();
+                    }
+
+                    if (sp != state.stack.begin()) printValue(POP());
+                    FMT_PRINT("\n");
+                    STORE_STATE();
+                    return InterpretResult::OK;
+                }
 
-InterpretResult VM::StringChecker() {
-    if (!VMstate.stack.peek(0).isObjectType(ObjType::STRING) ||
-        !VMstate.stack.peek(1).isObjectType(ObjType::STRING)) {
-        RuntimeError("Operands must be strings.");
-        return InterpretResult::RUNTIME_ERROR;
-    }
-    return InterpretResult::OK;
-}
+                // Drop the callee, its arguments and locals, leaving the result in their place.
+                const Value result = POP();
+                sp = slots;
+                PUSH(result);
 
-InterpretResult VM::AddableChecker() {
-    if ((VMstate.stack.peek(0).isNumber() ||
-            VMstate.stack.peek(0).isObjectType(ObjType::STRING)) &&
-        (VMstate.stack.peek(1).isNumber() ||
-            VMstate.stack.peek(1).isObjectType(ObjType::STRING))) { return InterpretResult::OK; }
+                state.frame = &state.frames[--state.frameCount - 1];
+                state.ip = state.frame->ip;
+                state.stack.setTop(sp);
+                LOAD_STATE();
+                DISPATCH();
+            }
 
-    RuntimeError("Can only add numbers or strings.");
-    return InterpretResult::RUNTIME_ERROR;
-}
+#if defined(COMPUTED_GOTO)
+            op_OBSERVE:
+                ObserveInstruction(ip - 1, sp);
+                goto *dispatchTable[ip[-1]];
 
-InterpretResult VM::MultiplicableChecker() {
-    if ((VMstate.stack.peek(0).isNumber() && VMstate.stack.peek(1).isNumber()) ||
-        (VMstate.stack.peek(0).isNumber() &&
-            VMstate.stack.peek(1).isObjectType(ObjType::STRING)) ||
-        (VMstate.stack.peek(0).isObjectType(ObjType::STRING) &&
-            VMstate.stack.peek(1).isNumber())) { return InterpretResult::OK; }
+            op_UNKNOWN:
+#endif
+            default: return InterpretResult::RUNTIME_ERROR;
+        }
+    }
 
-    RuntimeError("Can only multiply numbers.");
-    return InterpretResult::RUNTIME_ERROR;
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_LONG
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_STATE
+#undef LOAD_STATE
+#undef BINARY_OP
+#undef INT_OP
+#undef USE_FUEL
+#undef QUICKEN_BINARY
+#undef QUICKENED_BINARY
 }
@@ -0,0 +1,58 @@
+#ifndef AOT_RUNTIME_HPP
+#define AOT_RUNTIME_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+#include "Object.hpp"
+#include "Operators.hpp"
+#include "Value.hpp"
+#include "VirtualMachine.hpp"
+
+
+// What the C++ from --emit-cpp runs on: a VM for its heap, strings and globals, and
+// calls and errors that behave as VM::Run's do. Each emitted function works on its own
+// frame's slots, with the callee in slot 0, and returns false once it has reported an
+// error. Calls keep to the VM's frame limit, and tail calls reuse the caller's frame.
+class AotRuntime {
+public:
+    explicit AotRuntime(VM& vm) : vm(vm) {}
+
+    AotRuntime(const AotRuntime&) = delete;
+    AotRuntime& operator=(const AotRuntime&) = delete;
+
+    // Runs the script on a stack sized for the given frame depths. Returns the exit status
+    // the interpreter would have.
+    [[nodiscard]] uint8_t run(AotFunction script, uint32_t scriptDepth, uint32_t functionDepth);
+
+    // `callee` is followed by its arguments, and is replaced by the result.
+    [[nodiscard]] bool call(Value* callee, uint8_t argCount, size_t line);
+    // Moves the callee and its arguments down to `slots` and has the caller's caller run it
+    // there once the caller returns.
+    [[nodiscard]] bool tailCall(Value* slots, const Value* callee, uint8_t argCount,
+                                size_t line);
+
+    // Where the global named by `name` is kept, or nullptr, reported, if it is undefined.
+    [[nodiscard]] Value* global(Value name, size_t line);
+
+    // Reports a runtime error the way VM::RuntimeError does, with the innermost frame at
+    // `line`. Always returns false.
+    bool error(size_t line, const std::string& message);
+
+    VM& vm;
+
+private:
+    struct Frame {
+        const ObjFunction* function; // nullptr for the script
+        size_t line; // where the frame is calling from
+    };
+
+    std::vector<Frame> frames;
+    const ObjFunction* tailCallee = nullptr;
+
+    [[nodiscard]] bool runFrame(AotFunction code, Value* slots);
+};
+
+#endif
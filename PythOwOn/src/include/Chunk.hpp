@@ -1,7 +1,9 @@
 #ifndef CHUNK_HPP
 #define CHUNK_HPP
 
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -10,6 +12,7 @@
 
 class OpCode {
 public:
+    // The computed-goto dispatch table in VM::Run follows this order, with RETURN last.
     enum Code : uint8_t {
         CONSTANT,
         CONSTANT_LONG,
@@ -17,7 +20,7 @@ public:
         TRUE,
         FALSE,
         POP,
-        POPN, // TODO: implement (pops n values from stack, useful for end of scope)
+        POPN, // pops n values from the stack
         GET_LOCAL,
         GET_LOCAL_LONG,
         SET_LOCAL,
@@ -32,12 +35,39 @@ public:
         GREATER,
         LESS,
         ADD,
+        SUBTRACT, // what NEGATE then ADD do; the loader's stand-in for SUBTRACT_INT/_DOUBLE
         MULTIPLY,
         DIVIDE,
         LEFTSHIFT,
         RIGHTSHIFT,
         MODULO,
         NEGATE,
+        // Type-specialized forms, only emitted when the compiler has proven the operand
+        // types. They perform no checks of their own, so the loader demotes them.
+        ADD_INT,
+        ADD_DOUBLE,
+        SUBTRACT_INT,
+        SUBTRACT_DOUBLE,
+        MULTIPLY_INT,
+        MULTIPLY_DOUBLE,
+        LESS_INT,
+        LESS_DOUBLE,
+        GREATER_INT,
+        GREATER_DOUBLE,
+        // Quickened forms that VM::Run writes over ADD, LESS, GREATER and GET_GLOBAL after
+        // running them. The binary ones check their operands and go back to the generic
+        // opcode when the types don't match.
+        ADD_INT_INT,
+        ADD_DOUBLE_DOUBLE,
+        LESS_INT_INT,
+        LESS_DOUBLE_DOUBLE,
+        GREATER_INT_INT,
+        GREATER_DOUBLE_DOUBLE,
+        GET_GLOBAL_CACHED, // reads the global through Chunk::globalSlots
+        LOOP_JIT, // a LOOP whose loop runs as Chunk::jitLoops' machine code
+        CONCAT_STR,
+        CHECK_TYPE,
+        BUILD_STRING, // concatenates the top n values, converting non-strings
         AND,
         OR,
         NOT,
@@ -48,10 +78,17 @@ public:
         JUMP_FALSE_LONG,
         LOOP,
         LOOP_LONG,
+        JUMP_TRUE,
+        JUMP_BACK, // unconditional backward jump that isn't a loop (cold block exits)
+        FOR_RANGE, // tests and advances the counter of a range loop, jumping out once done
         DUP,
         INC,
         DEC,
         CALL,
+        TAIL_CALL, // a CALL whose result is returned straight away; reuses the frame
+        FIBER,  // wraps a callee and its n arguments into a fiber that has yet to run
+        RESUME, // runs the fiber on top until it yields or returns, leaving what it gave
+        YIELD,  // suspends the running fiber, handing the value on top to its resumer
         RETURN,
     };
 
@@ -62,10 +99,23 @@ public:
     constexpr operator Code() const { return code; }
     constexpr operator uint8_t() const { return code; }
 
+    // The opcode's name as spelled in Code, for reports.
+    [[nodiscard]] static const char* name(Code code);
+
 private:
     Code code;
 };
 
+// Machine code for a loop, see Jit. It runs on the frame starting at `slots`, whose top is
+// in `*top`, and returns the offset the interpreter goes on from, having updated `*top`.
+using JitCode = uint32_t (*)(Value* slots, Value** top);
+
+// How often a conditional branch was taken (jumped) versus fell through.
+struct BranchCounts {
+    uint64_t taken = 0;
+    uint64_t fallthrough = 0;
+};
+
 class Chunk {
 public:
     Chunk() = default;
@@ -75,14 +125,52 @@ public:
     void writeConstant(Value value, size_t line);
     void writeVariable(OpCode::Code op, uint32_t var, size_t line);
 
+    [[nodiscard]] size_t instructionSize(size_t offset) const;
+    // How many values the instruction at `offset` pushes, less how many it pops.
+    [[nodiscard]] int32_t stackEffect(size_t offset) const;
+    // How deep the stack is when execution reaches `end`, given its depth at offset 0.
+    [[nodiscard]] int32_t stackDepthAt(size_t end, int32_t entryDepth) const;
+    // The deepest the stack gets anywhere in the chunk, given its depth at offset 0.
+    [[nodiscard]] uint32_t maxStackDepth(int32_t entryDepth) const;
+    // Checks that VM::Run, which checks nothing itself, can run the code: opcodes it
+    // knows, operands in bounds, jumps onto instructions, enough values on the stack and
+    // the same depth wherever paths meet. Operand types are left to demoteTypedOps. Returns
+    // what is wrong, if anything, and sets `maxDepth` to the deepest the stack gets on any
+    // path, which unlike maxStackDepth holds for any control flow, not just the compiler's.
+    [[nodiscard]] std::optional<std::string> verify(int32_t entryDepth,
+                                                    uint32_t& maxDepth) const;
+    // Puts the generic form back in place of every type-specialized instruction, for code
+    // whose operand types nothing has proven, such as code loaded from a file. Typed
+    // globals are only held to their type by guards in other chunks, so verify can't
+    // prove them either.
+    void demoteTypedOps();
+
     std::vector<size_t> lines;
     std::vector<uint8_t> code;
     std::vector<Value> constants;
+    // Slots used above the frame's base at most, callee and arguments included. Set by
+    // the compiler, or by the loader for compiled files.
+    uint32_t maxDepth = 0;
+    // The VM's storage for each global name in `constants`, filled in as GET_GLOBAL
+    // instructions are quickened. Globals are never removed, so the pointers stay valid.
+    std::vector<Value*> globalSlots;
+    // How often each LOOP has run, and the code for those whose loops were compiled, by
+    // the LOOP's offset. Only used with --jit.
+    std::vector<uint32_t> loopCounts;
+    std::unordered_map<size_t, JitCode> jitLoops;
+    // Each JUMP_FALSE the compiler emitted, or the JUMP_TRUE it was flipped into, as its
+    // number in compile order and its offset. Branch profiles go by those numbers. Empty
+    // for chunks loaded from compiled files.
+    std::vector<std::pair<uint32_t, size_t>> branches;
 
-#if defined(TRACE_EXECUTION)
-    void disassemble(std::string name);
-    size_t disassembleInstruction(size_t offset);
-#endif
+    // Prints the code, or the instruction at `offset`, returning the offset after it.
+    void disassemble(std::string name) const;
+    size_t disassembleInstruction(size_t offset) const;
+
+private:
+    // How many values from the top of the stack the instruction at `offset` reads.
+    [[nodiscard]] uint32_t stackInputs(size_t offset) const;
+    int32_t followStackDepth(size_t end, int32_t entryDepth, int32_t& maxDepth) const;
 };
 
 #endif
@@ -2,21 +2,37 @@
 #define COMMON_HPP
 
 #include <bit>
+#include <cmath>
+#include <iterator>
 #include <ostream>
+#include <string>
+#include <utility>
 #include <vector>
 #include <cstdint>
 
 #include "fmt/core.h"
 
+// <cmath> is included above so that these macros are gone for good, whatever is
+// included after this header.
 #undef INFINITY
 #undef NAN
 #undef EOF
 
+// While set, FMT_PRINT and FMT_PRINTLN on this thread append to the string instead of
+// writing to stdout. Batch runs use it to keep each script's output apart.
+inline thread_local std::string* g_outputCapture = nullptr;
+
+template <typename Format, typename... Ts>
+void printOutput(const Format& format, Ts&&... args) {
+    if (g_outputCapture == nullptr) fmt::print(format, std::forward<Ts>(args)...);
+    else fmt::format_to(std::back_inserter(*g_outputCapture), format, std::forward<Ts>(args)...);
+}
+
 #define FMT_PRINT(formatStr, ...) \
-    fmt::print(fmt::runtime(formatStr) __VA_OPT__(, ) __VA_ARGS__)
+    printOutput(fmt::runtime(formatStr) __VA_OPT__(, ) __VA_ARGS__)
 
 #define FMT_PRINTLN(formatStr, ...) \
-    fmt::println(fmt::runtime(formatStr) __VA_OPT__(, ) __VA_ARGS__)
+    (FMT_PRINT(formatStr __VA_OPT__(, ) __VA_ARGS__), printOutput(fmt::runtime("\n")))
 
 #define FMT_FORMAT(formatStr, ...) \
     fmt::format(fmt::runtime(formatStr) __VA_OPT__(, ) __VA_ARGS__)
@@ -39,7 +55,7 @@ using ssize_t = intmax_t;
 ///
 template <typename T>
 [[nodiscard]] const char* LEtoBEStr(const T& value) {
-    static char byteArray[sizeof(T)];
+    thread_local static char byteArray[sizeof(T)];
 
     const auto* valueBytes = reinterpret_cast<const uint8_t*>(&value);
 
@@ -76,7 +92,8 @@ std::ostream& operator<<(std::ostream& os,
 
 class InterpretResult {
 public:
-    enum Result : uint8_t { OK = 0, COMPILE_ERROR = 65, RUNTIME_ERROR = 70 };
+    // OUT_OF_FUEL stops a run that can be carried on, see VM::State::fuel.
+    enum Result : uint8_t { OK = 0, COMPILE_ERROR = 65, RUNTIME_ERROR = 70, OUT_OF_FUEL = 75 };
 
     enum Cause : uint8_t { NONE, UNTERMINATED };
 
@@ -94,6 +111,7 @@ public:
             case OK: return "OK";
             case RUNTIME_ERROR: return "RUNTIME_ERROR";
             case COMPILE_ERROR: return "COMPILE_ERROR";
+            case OUT_OF_FUEL: return "OUT_OF_FUEL";
             default: return "UNKNOWN";
         }
     }
@@ -119,6 +137,7 @@ public:
         RBRACK,
         COMMA,
         DOT,
+        DOTDOT,
         SEMI,
         COLON,
 
@@ -154,6 +173,7 @@ public:
         // literals
         IDENTIFIER,
         STR,
+        FSTR, // f-string text that runs up to an interpolated expression
         NUM,
         INF,
         NAN, // TODO: implement inf/NaN
@@ -184,6 +204,9 @@ public:
         CONTINUE,
         BREAK,
         IN,
+        FIBER,
+        RESUME,
+        YIELD,
 
         ERROR,
         EOF,
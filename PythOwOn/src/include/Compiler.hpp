@@ -4,9 +4,13 @@
 #include <stdint.h>
 
 #include <array>
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
 
@@ -52,34 +56,185 @@ struct Parser {
 struct Local {
     Token name;
     int32_t depth;
+    StaticType type = StaticType::UNKNOWN;
+    bool annotated = false; // type came from a `: type` hint and is enforced
+    uint32_t ordinal = 0;   // declaration order, stable across recompiles
 };
 
 struct CompilerState {
     std::vector<Local> locals;
     uint32_t scopeDepth;
+    uint32_t localCount;
 
-    CompilerState() : scopeDepth(0) {}
+    CompilerState() : scopeDepth(0), localCount(0) {}
 
     Local* addLocal(const Token& name) {
         locals.push_back(Local{name, -1});
+        locals.back().ordinal = localCount++;
 
         return &locals.back();
     }
 };
 
+// A rarely executed arm of an if statement. It is cut out of the main code and
+// emitted after the final RETURN, so the hot path stays contiguous.
+struct ColdBlock {
+    std::vector<uint8_t> code;
+    std::vector<size_t> lines;
+    uint16_t entryJump; // operand of the jump into the block
+    size_t resumeAt;    // where the block jumps back to once it is done
+    std::vector<size_t> branches; // indices into Chunk::branches, offsets relative to the block
+};
+
+// Every global annotated in the units compiled so far, with the one type it can ever hold,
+// and the globals that code without a guard assigns to. Lazy bodies share it, so they are
+// compiled against what is known by the time they are first called.
+struct GlobalTypes {
+    std::unordered_map<std::string, StaticType> annotated;
+    std::unordered_set<std::string> unguarded;
+};
+
+// A global function whose body is just `return <expr>;`, short enough to be compiled
+// straight into its callers. Calls to it bind at compile time.
+struct InlineCandidate {
+    std::shared_ptr<const std::string> source;
+    size_t exprStart; // offset of the returned expression
+    size_t line;
+    std::vector<std::pair<std::string, StaticType>> params; // UNKNOWN if not annotated
+};
+
+using InlineCandidates = std::unordered_map<std::string, InlineCandidate>;
+
+// The parameters of a body being inlined, living in the caller's argument slots.
+struct InlineFrame {
+    struct Param {
+        std::string name;
+        uint32_t slot;
+        StaticType type;
+    };
+
+    std::string function;
+    std::vector<Param> params;
+};
+
+// What a compile cost and produced. Apart from inlinedCalls, only gathered for
+// compilers that had enableStats called, as timing every token has a cost of its own.
+struct CompileStats {
+    using Duration = std::chrono::steady_clock::duration;
+
+    // Cumulative over every recompile pass.
+    Duration scanTime{};
+    Duration compileTime{}; // parsing and code generation, without scanning
+    Duration emitTime{};    // writing the compiled file, filled in by its writer
+    uint64_t tokens = 0;
+    uint32_t passes = 0;
+
+    // Of the final pass.
+    uint32_t inlinedCalls = 0;
+    uint32_t locals = 0;
+    uint32_t globals = 0;
+    uint32_t functions = 0;
+
+    // Of the finished chunks, functions included.
+    size_t chunks = 0;
+    size_t codeBytes = 0;
+    size_t constants = 0;
+    size_t shortConstantOperands = 0;
+    size_t longConstantOperands = 0;
+
+    CompileStats& operator+=(const CompileStats& other);
+};
+
+// A function declared without compiling its body. It is compiled on its first call.
+struct LazyFunction {
+    std::shared_ptr<const std::string> source;
+    size_t start; // offset of the '(' opening the parameter list
+    size_t line;
+    std::shared_ptr<GlobalTypes> globalTypes; // those of the declaring compiler
+    std::shared_ptr<const InlineCandidates> inlineCandidates; // likewise
+    std::shared_ptr<CompileStats> stats;
+};
+
 class Compiler {
 public:
-    Compiler();
+    // Strings and functions are created in `vm`, which has to be the one that runs the chunk.
+    explicit Compiler(VM& vm);
 
     std::pair<InterpretResult, Chunk> compile(const std::string& source);
 
+    // Counts indexed by the order in which conditional branches are compiled.
+    void useBranchProfile(std::vector<BranchCounts> profile);
+
+    // Start every error with `name`, the path of the source, if it isn't empty.
+    void setSourceName(std::string name);
+
+    // Only record where function bodies are, and compile each one on its first call.
+    void setLazyFunctions(bool lazy);
+    // Compiles the body of `function` for its first call, allocating its chunk and any
+    // strings and functions in it. The stack was sized before the body's depth was known,
+    // so the call that follows may also grow the stack, see VM::CallValue.
+    static bool CompileLazy(VM& vm, ObjFunction* function);
+
+    // Largest body, in tokens of its return expression, that calls are inlined for.
+    // 0 turns inlining off.
+    void setInlineThreshold(uint32_t tokens);
+    // Includes the calls inlined by lazily compiled bodies so far.
+    [[nodiscard]] const CompileStats& compileStats() const { return *stats; }
+    // Also turns lazy functions off, so that the stats cover every body.
+    void enableStats();
+
 private:
+    VM& vm;
+    std::shared_ptr<const std::string> source;
+    std::string sourceName;
     Chunk chunk;
     Scanner scanner;
     CompilerState state;
     std::array<ParseRule, TokenType::TOKEN_COUNT> rules;
     Parser parser;
 
+    // Type inference. `exprType` is the proven type of the last expression compiled.
+    // Unannotated locals take the type of their initializer; if one is later assigned
+    // a value of another type, it is added to `dynamicLocals` and the unit recompiled.
+    // A global annotated anywhere in the unit holds that type everywhere, so code seen
+    // before the annotation (`passGlobals`) is recompiled once it is found.
+    StaticType exprType;
+    std::shared_ptr<GlobalTypes> globalTypes;
+    std::unordered_set<std::string> passGlobals;
+    std::unordered_set<std::string> earlierUnguarded; // by the units compiled before this one
+    std::unordered_set<uint32_t> dynamicLocals;
+    bool needsRecompile;
+
+    // Profile-guided layout. `coldArmStart` is -1 unless an arm is being compiled
+    // with the intent of moving it out of line.
+    std::vector<BranchCounts> branchProfile;
+    uint32_t branchCount;
+    std::vector<ColdBlock> coldBlocks;
+    int32_t coldArmStart;
+    bool coldArmEscapes;
+
+    // Where a `continue` jumps to, or -1 outside of loops.
+    int32_t innermostLoopStart;
+    uint16_t innermostLoopScopeDepth;
+
+    // How many function bodies enclose the code being compiled; 0 for the script.
+    uint32_t functionDepth;
+    bool lazyFunctions;
+    // Stack depth on entry to the chunk being compiled: the callee and its arguments.
+    uint32_t frameStartDepth;
+    // Offset of the last CALL emitted, to turn `return f(...)` into a tail call.
+    size_t lastCall;
+
+    // Inlining. A candidate that is later rebound is added to `notInlinable`, and the
+    // unit recompiled if calls to it were already inlined.
+    uint32_t inlineThreshold;
+    InlineCandidates inlineCandidates;
+    std::shared_ptr<const InlineCandidates> inlineCandidatesSnapshot;
+    std::unordered_set<std::string> notInlinable;
+    std::vector<InlineFrame> inlineFrames;
+    std::shared_ptr<CompileStats> stats;
+    bool statsEnabled;
+
     void advance();
     void errorAt(Token token, const std::string& message);
     void consume(TokenType::Type type, const std::string& message);
@@ -96,8 +251,15 @@ private:
     void patchJumpLong(uint32_t offset);
     void emitVariable(OpCode op, uint32_t var);
     void emitLoop(uint16_t loopStart);
+    void emitJumpBack(size_t target);
+    [[nodiscard]] bool beginColdArm(uint32_t branch, bool jumpTaken);
+    std::optional<size_t> endColdArm(size_t start);
+    void emitColdBlocks();
     void emitReturn();
+    void emitTypeGuard(StaticType expected, const Token& name, bool isInitializer);
+    void emitBinaryOp(TokenType::Type operatorType, StaticType left, StaticType right);
     void endCompiler();
+    void recordChunkStats(const Chunk& chunk);
 
     //    uint8_t makeConstant(Value value);
     void parsePrecedence(Precedence precedence);
@@ -105,9 +267,11 @@ private:
     std::optional<uint32_t> resolveLocal(const Token& name);
 
     uint32_t parseVariable(const std::string& errorMessage);
-    void markInitialized();
-    void defineVariable(uint32_t global);
+    StaticType parseTypeHint();
+    void markInitialized(StaticType type, bool annotated);
+    void defineVariable(uint32_t global, const Token& name, StaticType type, bool annotated);
     void declareVariable();
+    void checkAssignment(const Token& name, std::optional<uint32_t> local);
 
     void and_(bool canAssign);
     void or_(bool canAssign);
@@ -121,11 +285,24 @@ private:
     void switchStatement();
     void whileStatement();
     void forStatement();
+    [[nodiscard]] bool atRangeLoop() const;
+    void forRangeStatement();
+    StaticType rangeBounds();
     void continueStatement();
     void breakStatement();
+    void yieldStatement();
     void statement();
     void declaration();
     void varDeclaration();
+    void funDeclaration();
+    void function(const Token& name);
+    void compileFunction(ObjFunction* function);
+    void declareLazy(ObjFunction* function);
+    void defineGlobalType(const Token& name, StaticType type, bool annotated);
+    [[nodiscard]] std::optional<InlineCandidate> findInlineCandidate(const Token& name) const;
+    [[nodiscard]] std::optional<uint32_t> peekArgumentCount() const;
+    [[nodiscard]] bool inlineCall(const Token& name);
+    void rebindGlobal(const std::string& name);
     void block();
     void beginScope();
     void endScope();
@@ -135,9 +312,13 @@ private:
     void binary(bool);
     void literal(bool);
     void string(bool);
+    void interpolation(bool);
     void variable(bool canAssign);
     void number(bool);
     void grouping(bool);
+    void call(bool);
+    void fiber(bool);
+    void resume(bool);
 };
 
 #endif
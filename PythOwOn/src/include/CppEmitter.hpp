@@ -0,0 +1,16 @@
+#ifndef CPP_EMITTER_HPP
+#define CPP_EMITTER_HPP
+
+#include <string>
+
+#include "Chunk.hpp"
+
+
+// Translates a compiled script, and every function compiled into it, into a C++ program
+// that prints and exits as running the script would. Each instruction becomes a few lines
+// of straight-line code on the frame's slots, and jumps become gotos. The program links
+// against the PythOwOnRuntime library, see AotRuntime. Every function must have its body
+// compiled, so the script must not have been compiled lazily.
+[[nodiscard]] std::string emitCpp(const Chunk& script, const std::string& sourceName);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Object.hpp"
+#include "Value.hpp"
+
+// The JIT emits x86-64 code for the System V calling convention. Traced builds leave it
+// out, since nothing inside a compiled loop would be traced.
+#if defined(GCCBUILD) && defined(__x86_64__) && !defined(TRACE_EXECUTION)
+#define HAS_JIT
+#endif
+
+#if defined(HAS_JIT)
+
+// A baseline compiler from hot loops to machine code, opted into with --jit. The code
+// works on the interpreter's own stack, one instruction at a time, and hands back to it,
+// at the instruction it stopped on, for operands of types it wasn't compiled for and for
+// instructions it doesn't know.
+class Jit {
+public:
+    static constexpr uint32_t DEFAULT_THRESHOLD = 1000;
+
+    explicit Jit(const uint32_t threshold) : threshold(threshold) {}
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Compiles the loop closed by the LOOP at `loopOffset`, which was reached with `depth`
+    // values in a frame that started out with `entryDepth`. Returns nullptr if it can't.
+    // `name` is what perf shows for the code.
+    [[nodiscard]] JitCode compileLoop(const Chunk& chunk, size_t loopOffset, int32_t entryDepth,
+                                      int32_t depth,
+                                      const std::unordered_map<ObjString, Value>& globals,
+                                      const std::string& name);
+
+    // How many times a LOOP runs before its loop is compiled.
+    const uint32_t threshold;
+
+private:
+    std::vector<std::pair<void*, size_t>> mappings;
+    FILE* perfMap = nullptr; // /tmp/perf-<pid>.map, opened with the first loop compiled
+};
+
+#endif
+
+#endif
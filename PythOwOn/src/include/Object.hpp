@@ -13,9 +13,21 @@
 enum class ObjType {
     NONE,
     STRING,
+    FUNCTION,
+    FIBER,
 };
 
+class AotRuntime;
+class Chunk;
+class VM;
+struct LazyFunction;
 struct ObjString;
+struct ObjFunction;
+struct ObjFiber;
+struct Value;
+
+// A function's body as C++ emitted by --emit-cpp, run on its frame's slots.
+using AotFunction = bool (*)(AotRuntime& runtime, Value* slots);
 
 struct Obj {
     ObjType type;
@@ -26,6 +38,18 @@ struct Obj {
         return reinterpret_cast<const ObjString*>(this);
     }
 
+    [[nodiscard]] const ObjFunction* asFunction() const {
+        return reinterpret_cast<const ObjFunction*>(this);
+    }
+
+    [[nodiscard]] ObjFunction* asFunction() { return reinterpret_cast<ObjFunction*>(this); }
+
+    [[nodiscard]] const ObjFiber* asFiber() const {
+        return reinterpret_cast<const ObjFiber*>(this);
+    }
+
+    [[nodiscard]] ObjFiber* asFiber() { return reinterpret_cast<ObjFiber*>(this); }
+
     bool operator==(const Obj& other) const;
     std::ostream& operator<<(std::ostream& os) const;
 };
@@ -34,13 +58,26 @@ struct ObjString {
     Obj object;
     std::string str;
 
-    static const ObjString* Create(const std::string& newStr);
-    static const ObjString* Create(const std::string& newStr,
+    // Interned in, and owned by, the given VM.
+    static const ObjString* Create(VM& vm, const std::string& newStr);
+    static const ObjString* Create(VM& vm, std::string&& newStr);
+    static const ObjString* Create(VM& vm, const std::string& newStr,
                                    std::tuple<int32_t, int32_t> slice);
 
     bool operator==(const ObjString& other) const;
 };
 
+struct ObjFunction {
+    Obj object;
+    uint32_t arity;
+    Chunk* chunk;        // nullptr until the body has been compiled
+    LazyFunction* lazy;  // where to find the body, while it is still uncompiled
+    AotFunction native;  // the body instead of `chunk` in programs from --emit-cpp
+    const ObjString* name;
+
+    static ObjFunction* Create(VM& vm, const ObjString* name);
+};
+
 template <>
 struct std::hash<ObjString> {
     std::size_t operator()(const ObjString& string) const noexcept {
@@ -0,0 +1,252 @@
+#ifndef OPERATORS_HPP
+#define OPERATORS_HPP
+
+#include <cmath>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "Common.hpp"
+#include "Object.hpp"
+#include "Value.hpp"
+
+
+// What the instructions that can fail do to their operands, shared by VM::Run and the
+// C++ that --emit-cpp writes, so that both behave the same.
+namespace Operators {
+constexpr const char* overflowError = "Integer overflow.";
+
+inline bool isAddable(const Value value) {
+    return value.isNumber() || value.isObjectType(ObjType::STRING);
+}
+
+// The binary operators. Two ints, or two doubles where the operator takes them, go
+// straight to Ints or Doubles, where Ints gives nothing if the result overflows. Other
+// operands that Accepts lets through use the generic Value operator, and the rest are the
+// type error named by `error`.
+struct Add {
+    static constexpr const char* error = "Can only add numbers or strings.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::AddIntegers(a, b);
+    }
+    static Value Doubles(const double a, const double b) { return Value::DoubleVal(a + b); }
+    static bool Accepts(const Value a, const Value b) { return isAddable(a) && isAddable(b); }
+    static Value Generic(VM& vm, const Value a, const Value b) { return a.add(vm, b); }
+};
+
+struct Multiply {
+    static constexpr const char* error = "Can only multiply numbers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::MultiplyIntegers(a, b);
+    }
+    static Value Doubles(const double a, const double b) { return Value::DoubleVal(a * b); }
+    static bool Accepts(const Value a, const Value b) {
+        return (a.isNumber() && isAddable(b)) || (isAddable(a) && b.isNumber());
+    }
+    static Value Generic(VM& vm, const Value a, const Value b) { return a.multiply(vm, b); }
+};
+
+// Dividing by zero gives an infinity or NaN Value, which the generic operator handles.
+struct Divide {
+    static constexpr const char* error = "Operands must be numbers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        if (b == 0) [[unlikely]] return Value::IntegerVal(a) / Value::IntegerVal(b);
+        return Value::DoubleVal(static_cast<double>(a) / static_cast<double>(b));
+    }
+    static Value Doubles(const double a, const double b) {
+        if (ProxEqual<double>(b, 0)) [[unlikely]] return Value::DoubleVal(a) / Value::DoubleVal(b);
+        return Value::DoubleVal(a / b);
+    }
+    static bool Accepts(const Value a, const Value b) { return a.isNumber() && b.isNumber(); }
+    static Value Generic(VM&, const Value a, const Value b) { return a / b; }
+};
+
+struct Modulo {
+    static constexpr const char* error = "Operands must be numbers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::DoubleVal(fmod(static_cast<double>(a), static_cast<double>(b)));
+    }
+    static Value Doubles(const double a, const double b) { return Value::DoubleVal(fmod(a, b)); }
+    static bool Accepts(const Value a, const Value b) { return a.isNumber() && b.isNumber(); }
+    static Value Generic(VM&, const Value a, const Value b) { return a % b; }
+};
+
+struct Greater {
+    static constexpr const char* error = "Operands must be numbers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::BoolVal(a > b);
+    }
+    static Value Doubles(const double a, const double b) { return Value::BoolVal(a > b); }
+    static bool Accepts(const Value a, const Value b) { return a.isNumber() && b.isNumber(); }
+    static Value Generic(VM&, const Value a, const Value b) { return Value::BoolVal(a > b); }
+};
+
+struct Less {
+    static constexpr const char* error = "Operands must be numbers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::BoolVal(a < b);
+    }
+    static Value Doubles(const double a, const double b) { return Value::BoolVal(a < b); }
+    static bool Accepts(const Value a, const Value b) { return a.isNumber() && b.isNumber(); }
+    static Value Generic(VM&, const Value a, const Value b) { return Value::BoolVal(a < b); }
+};
+
+struct LeftShift {
+    static constexpr const char* error = "Operands must be integers.";
+    // Shifting set bits out of an int's 48, or by a negative count, is an overflow.
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        if (a == 0) return Value::IntegerVal(0);
+        if (b < 0 || b >= 48 || !Value::FitsInteger(a << b) || (a << b) >> b != a)
+            return std::nullopt;
+        return Value::IntegerVal(a << b);
+    }
+};
+
+struct RightShift {
+    static constexpr const char* error = "Operands must be integers.";
+    static std::optional<Value> Ints(const ssize_t a, const ssize_t b) {
+        return Value::IntegerVal(a >> b);
+    }
+};
+
+// Replaces the two values below `top` with the result in the lower one's slot. Returns
+// what is wrong, leaving the stack as it was, if the operands are of the wrong types or
+// their int result overflows, and nullptr otherwise.
+template <typename Op>
+const char* applyBinary(VM& vm, Value* top) {
+    const Value b = top[-1];
+    const Value a = top[-2];
+
+    if (a.isInteger() && b.isInteger()) [[likely]] {
+        const std::optional<Value> result = Op::Ints(a.integer(), b.integer());
+        if (!result) [[unlikely]] return overflowError;
+        top[-2] = *result;
+        return nullptr;
+    }
+
+    if constexpr (requires { Op::Doubles(0.0, 0.0); }) {
+        if (a.isDouble() && b.isDouble()) {
+            top[-2] = Op::Doubles(a.decimal(), b.decimal());
+            return nullptr;
+        }
+    }
+
+    if constexpr (requires { Op::Generic(vm, a, b); }) {
+        if (Op::Accepts(a, b)) {
+            top[-2] = Op::Generic(vm, a, b);
+            return nullptr;
+        }
+    }
+
+    return Op::error;
+}
+
+// Returns what is wrong, leaving the value as it was, if it isn't a number or is the one
+// int whose negation doesn't fit.
+inline const char* negate(Value& value) {
+    if (value.isSpecialNumber()) {
+        value = value.isInf() ? Value::Infinity(!value.boolean()) : Value::Nan(!value.boolean());
+        return nullptr;
+    }
+
+    if (value.isInteger()) {
+        if (value.integer() == Value::INTEGER_MIN) [[unlikely]] return overflowError;
+        value = Value::IntegerVal(-value.integer());
+        return nullptr;
+    }
+
+    if (!value.isNumber()) return "Operand must be a number.";
+    value = Value::DoubleVal(-value.decimal());
+    return nullptr;
+}
+
+// Adds `by`, 1 or -1, to a number for INC and DEC. Returns what is wrong, leaving the
+// value as it was: `error` if it isn't a number, or an overflow.
+inline const char* step(Value& value, const ssize_t by, const char* error) {
+    if (value.isInteger()) {
+        if (!Value::FitsInteger(value.integer() + by)) [[unlikely]] return overflowError;
+        value = Value::IntegerVal(value.integer() + by);
+        return nullptr;
+    }
+
+    if (!value.isNumber()) return error;
+    value = Value::DoubleVal(Value::AsDouble(value).decimal() + static_cast<double>(by));
+    return nullptr;
+}
+
+// Concatenates the `count` values below `top`, converting non-strings.
+inline Value buildString(VM& vm, const Value* top, const uint32_t count) {
+    size_t size = 0;
+    for (uint32_t i = count; i > 0; i--) {
+        size += stringifiedSize(top[-static_cast<ptrdiff_t>(i)]);
+    }
+
+    std::string str(size, '\0');
+    char* out = str.data();
+    for (uint32_t i = count; i > 0; i--) {
+        out = stringifyValue(out, top[-static_cast<ptrdiff_t>(i)]);
+    }
+
+    return Value::ObjectVal(ObjString::Create(vm, std::move(str)));
+}
+
+enum class RangeStep : uint8_t { BODY, DONE, ERROR };
+
+// Tests and advances a range loop's counter, which is followed by its limit, its step and
+// the loop variable. While there are values left, the variable gets the counter's before
+// it moves on. On ERROR, `error` says what is wrong.
+inline RangeStep forRange(Value* counter, const char*& error) {
+    const Value limit = counter[1];
+    const Value step = counter[2];
+
+    if (counter->isInteger() && limit.isInteger() && step.isInteger()) [[likely]] {
+        const ssize_t at = counter->integer();
+        const ssize_t by = step.integer();
+        if (by > 0 ? at >= limit.integer() : by < 0 ? at <= limit.integer() : true) {
+            if (by == 0) [[unlikely]] {
+                error = "Range step cannot be zero.";
+                return RangeStep::ERROR;
+            }
+            return RangeStep::DONE;
+        }
+
+        if (!Value::FitsInteger(at + by)) [[unlikely]] {
+            error = overflowError;
+            return RangeStep::ERROR;
+        }
+
+        counter[3] = *counter;
+        *counter = Value::IntegerVal(at + by);
+        return RangeStep::BODY;
+    }
+
+    if (!counter->isNumber() || !limit.isNumber() || !step.isNumber()) {
+        error = "Range bounds and step must be numbers.";
+        return RangeStep::ERROR;
+    }
+
+    const double at = Value::AsDouble(*counter).decimal();
+    const double to = Value::AsDouble(limit).decimal();
+    const double by = Value::AsDouble(step).decimal();
+    if (by > 0 ? at >= to : by < 0 ? at <= to : true) {
+        if (by == 0) {
+            error = "Range step cannot be zero.";
+            return RangeStep::ERROR;
+        }
+        return RangeStep::DONE;
+    }
+
+    const bool real = counter->isReal() || step.isReal();
+    if (!real && (at + by > static_cast<double>(Value::INTEGER_MAX) ||
+                  at + by < static_cast<double>(Value::INTEGER_MIN))) [[unlikely]] {
+        error = overflowError;
+        return RangeStep::ERROR;
+    }
+
+    counter[3] = *counter;
+    *counter = Value::NumberVal(at + by, real);
+    return RangeStep::BODY;
+}
+} // namespace Operators
+
+#endif
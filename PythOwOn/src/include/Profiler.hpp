@@ -0,0 +1,79 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(MSVCBUILD)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#include <chrono>
+#endif
+
+
+// Where the time of a --profile run goes: how often each opcode and each source line runs,
+// and how many time-stamp counter cycles it takes. Each instruction is charged the cycles
+// until the next one starts, so a CALL includes setting up the callee's frame, and all of
+// them include the profiler's own bookkeeping, which weighs most on the cheapest ones.
+class Profiler {
+public:
+    // Charges the instruction timed so far and starts timing `op`, on `line`.
+    void enter(const uint8_t op, const size_t line) {
+        const uint64_t now = ReadCycles();
+        charge(now);
+
+        ops[op].count++;
+        if (line >= lines.size()) lines.resize(line + 1);
+        lines[line].count++;
+        timedOp = op;
+        timedLine = line;
+        timing = true;
+        last = now;
+    }
+
+    // Charges the last instruction once the run is over.
+    void stop() {
+        charge(ReadCycles());
+        timing = false;
+    }
+
+    // The hot lines, quoting `source` if it is given, then the opcodes, both by cycles.
+    [[nodiscard]] std::string report(std::string_view source) const;
+
+private:
+    struct Counts {
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+    };
+
+    std::array<Counts, 256> ops{};
+    std::vector<Counts> lines; // by line number
+    uint8_t timedOp = 0;
+    size_t timedLine = 0;
+    bool timing = false;
+    uint64_t last = 0;
+
+    void charge(const uint64_t now) {
+        if (!timing) return;
+        ops[timedOp].cycles += now - last;
+        lines[timedLine].cycles += now - last;
+    }
+
+    static uint64_t ReadCycles() {
+#if defined(__x86_64__) || defined(_M_X64)
+        return __rdtsc();
+#else
+        // Elsewhere nanoseconds stand in for cycles.
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+};
+
+#endif
@@ -6,21 +6,30 @@
 #include <optional>
 #include <string>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "Common.hpp"
 
 
 class Scanner {
 public:
-    Scanner(std::string source);
+    // The source is not copied, it must outlive the scanner.
+    Scanner(std::string_view source, size_t offset = 0, size_t line = 1);
 
     Token scanToken();
+    // Offset of the token scanned last.
+    [[nodiscard]] size_t tokenStart() const { return start; }
+    [[nodiscard]] uint64_t tokenCount() const { return tokens; }
 
 private:
-    std::string source;
+    std::string_view source;
     size_t start;
     size_t current;
     size_t line;
+    uint64_t tokens;
+    // Brace depth inside each f-string interpolation that is currently open.
+    std::vector<uint32_t> interpolations;
 
 
     char advance();
@@ -37,6 +46,7 @@ private:
 
     Token string();
     Token multiString();
+    Token fString();
     Token number();
     Token identifier();
 
@@ -0,0 +1,94 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Object.hpp"
+#include "Value.hpp"
+
+
+// One instruction run, as --trace records it.
+struct TraceEvent {
+    static constexpr uint8_t EMPTY = 0xFF; // `top` when the stack is empty
+    static constexpr uint16_t UNKNOWN_CHUNK = 0xFFFF;
+
+    uint16_t chunk; // numbered as Trace::Chunks numbers them
+    uint8_t op; // as it ran, which quickening may have changed from what was compiled
+    uint8_t top; // the ValueType on top of the stack
+    uint32_t offset;
+    uint32_t depth; // values on the whole stack
+};
+static_assert(sizeof(TraceEvent) == 12);
+
+// The last instructions a VM ran, kept for --trace in a ring that VM::Run writes to and
+// that is read back only to dump it, possibly from a signal handler interrupting the run.
+// The run never waits for the reader: it publishes each event by moving `head` on.
+class Trace {
+public:
+    static constexpr uint32_t EVENTS = 1 << 16;
+
+    // Dumps go to `path`.
+    explicit Trace(std::string path);
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    struct Unit {
+        const Chunk* chunk;
+        const ObjFunction* function; // nullptr for the script
+    };
+
+    // Every chunk the script's code can run, in the order events number them: the script,
+    // then each function as it is found depth-first through FUNCTION constants.
+    [[nodiscard]] static std::vector<Unit> Chunks(const Chunk& script);
+
+    // Numbers the chunks of the script about to run. Its functions must all be compiled.
+    void setScript(const Chunk& script);
+
+    void record(const Chunk& chunk, const size_t offset, const uint8_t op, const Value* stack,
+                const Value* top) {
+        if (&chunk != lastChunk) {
+            const auto found = chunkIds.find(&chunk);
+            lastChunk = &chunk;
+            lastId = found != chunkIds.end() ? found->second : TraceEvent::UNKNOWN_CHUNK;
+        }
+
+        const uint64_t at = head.load(std::memory_order_relaxed);
+        events[at & (EVENTS - 1)] = {
+            lastId, op,
+            top != stack ? static_cast<uint8_t>(top[-1].valueType()) : TraceEvent::EMPTY,
+            static_cast<uint32_t>(offset), static_cast<uint32_t>(top - stack)
+        };
+        head.store(at + 1, std::memory_order_release);
+    }
+
+    // Writes the events still in the ring, oldest first, making only calls that are safe in
+    // a signal handler. Returns whether the whole dump was written.
+    bool dump() const;
+
+    struct Dump {
+        uint64_t recorded; // how many events were recorded in all, dropped ones included
+        std::vector<TraceEvent> events;
+    };
+
+    // Reads back what dump() wrote, on a machine of the same byte order. Returns nullopt,
+    // having reported why, if the file isn't a trace.
+    [[nodiscard]] static std::optional<Dump> Read(const std::string& path);
+
+    const std::string path;
+
+private:
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head = 0;
+    std::unordered_map<const Chunk*, uint16_t> chunkIds;
+    const Chunk* lastChunk = nullptr;
+    uint16_t lastId = TraceEvent::UNKNOWN_CHUNK;
+};
+
+#endif
@@ -1,31 +1,59 @@
 #ifndef STACK_HPP
 #define STACK_HPP
 
-#include <vector>
+#include <stddef.h>
+#include <stdint.h>
 
+#include <memory>
 
+
+// A flat stack of fixed capacity, left uninitialised and never checked: whoever sizes it
+// must know how deep it gets. It never reallocates by itself, so the interpreter can keep
+// its own copy of the top, handing it back with setTop. It only grows by being replaced
+// with a bigger one, as VM::GrowStack does for a call whose frame doesn't fit, so pointers
+// into it have to be derived again from frame bases and top() after a call.
 template <typename T>
-class Stack : std::vector<T> {
+class Stack {
 public:
-    [[nodiscard]] T peek(uint32_t distance) const {
-        return this->at(this->size() - 1 - distance);
+    Stack() = default;
+    explicit Stack(const size_t capacity)
+        : values(std::make_unique_for_overwrite<T[]>(capacity)), valueCount(capacity),
+          stackTop(values.get()) {}
+
+    Stack(const Stack&) = delete;
+    Stack& operator=(const Stack&) = delete;
+    Stack(Stack&&) noexcept = default;
+    Stack& operator=(Stack&&) noexcept = default;
+
+    [[nodiscard]] T peek(const uint32_t distance) const {
+        return stackTop[-1 - static_cast<ptrdiff_t>(distance)];
     }
 
-    T pop() {
-        T value = peek(0);
-        this->pop_back();
-        return value;
-    }
+    T pop() { return *--stackTop; }
+    void push(T value) { *stackTop++ = value; }
+    void reset() { stackTop = values.get(); }
+
+    T& operator[](const size_t index) { return values[index]; }
+    const T& operator[](const size_t index) const { return values[index]; }
+
+    [[nodiscard]] size_t size() const { return static_cast<size_t>(stackTop - values.get()); }
+    [[nodiscard]] size_t capacity() const { return valueCount; }
+    [[nodiscard]] bool empty() const { return stackTop == values.get(); }
+    // Moves the top without touching the values, which must lie within the capacity.
+    void resize(const size_t count) { stackTop = values.get() + count; }
 
-    void push(T value) { this->emplace_back(value); }
-    void reset() { this->clear(); }
+    [[nodiscard]] T* top() { return stackTop; }
+    void setTop(T* top) { stackTop = top; }
 
-    using std::vector<T>::operator[];
+    T* begin() { return values.get(); }
+    T* end() { return stackTop; }
+    const T* begin() const { return values.get(); }
+    const T* end() const { return stackTop; }
 
-    using std::vector<T>::size;
-    using std::vector<T>::empty;
-    using std::vector<T>::begin;
-    using std::vector<T>::end;
+private:
+    std::unique_ptr<T[]> values;
+    size_t valueCount = 0;
+    T* stackTop = nullptr;
 };
 
 #endif
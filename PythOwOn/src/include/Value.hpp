@@ -2,7 +2,10 @@
 #define VALUE_HPP
 
 
+#include <bit>
 #include <cmath>
+#include <limits>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <utility>
@@ -24,16 +27,113 @@ enum class ValueType : uint8_t {
     OBJECT,
 };
 
+// The type of a value as far as the compiler can prove it. UNKNOWN means "any".
+enum class StaticType : uint8_t {
+    UNKNOWN,
+    NONE,
+    BOOL,
+    INT,
+    DOUBLE,
+    STRING,
+};
+
+[[nodiscard]] constexpr const char* StaticTypeName(const StaticType type) {
+    switch (type) {
+        case StaticType::NONE: return "none";
+        case StaticType::BOOL: return "bool";
+        case StaticType::INT: return "int";
+        case StaticType::DOUBLE: return "double";
+        case StaticType::STRING: return "str";
+        case StaticType::UNKNOWN: break;
+    }
+
+    return "unknown";
+}
+
+class VM;
 struct Value;
 
 void printValue(Value value);
 
-#if defined(TRACE_EXECUTION) || defined(_DEBUG)
+// Length of the text string concatenation produces for a value, see Value::ToObjString.
+size_t stringifiedSize(Value value);
+// Writes that text to out without allocating and returns the end of what was written.
+char* stringifyValue(char* out, Value value);
+
 void Debug_printValue(Value value);
-#endif
 
 
+// A value is a ValueType tag next to an 8-byte payload, 16 bytes in all. Building with
+// NAN_BOXING (premake's --nan-boxing) packs it into 8: doubles are stored as themselves,
+// infinities and NaNs included, and every other type lives in the payload of a quiet NaN.
+// Object pointers must then fit in 48 bits. Integers get 48 bits in either layout.
 struct Value {
+#if defined(NAN_BOXING)
+    // A double unless all the QNAN bits are set. Objects set the sign bit on top of them,
+    // the other types one of the tags, with their payload in the low 48 bits.
+    static constexpr uint64_t SIGN = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t TAG_NONE = 0x0001000000000000;
+    static constexpr uint64_t TAG_BOOL = 0x0002000000000000;
+    static constexpr uint64_t TAG_INT = 0x0003000000000000;
+    static constexpr uint64_t TAG_MASK = SIGN | QNAN | TAG_INT;
+    static constexpr uint64_t PAYLOAD = 0x0000ffffffffffff;
+
+    uint64_t bits;
+
+    static Value NoneVal() { return {QNAN | TAG_NONE}; }
+
+    static Value BoolVal(const bool value) { return {QNAN | TAG_BOOL | value}; }
+
+    static Value IntegerVal(const ssize_t value) {
+        return {QNAN | TAG_INT | (static_cast<uint64_t>(value) & PAYLOAD)};
+    }
+
+    // NaNs the hardware makes never set the extra QNAN bit, but one read from a file might.
+    static Value DoubleVal(const double value) {
+        const auto bits = std::bit_cast<uint64_t>(value);
+        if ((bits & QNAN) == QNAN) [[unlikely]] return {(bits & SIGN) | 0x7ff8000000000000};
+        return {bits};
+    }
+
+    static Value Infinity(const bool positive) {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        return DoubleVal(positive ? inf : -inf);
+    }
+
+    static Value Nan(const bool positive) {
+        constexpr double nan = std::numeric_limits<double>::quiet_NaN();
+        return DoubleVal(positive ? nan : -nan);
+    }
+
+    template <typename T>
+    static Value ObjectVal(const T value) {
+        return {SIGN | QNAN | reinterpret_cast<uintptr_t>(value)};
+    }
+
+    [[nodiscard]] ValueType valueType() const {
+        if (isDouble()) return ValueType::DOUBLE;
+        if (isObject()) return ValueType::OBJECT;
+        if (isInteger()) return ValueType::INT;
+        return isBool() ? ValueType::BOOL : ValueType::NONE;
+    }
+
+    [[nodiscard]] bool boolean() const { return bits & 1; }
+    // Shifting back down sign-extends the 48-bit payload.
+    [[nodiscard]] ssize_t integer() const { return static_cast<ssize_t>(bits << 16) >> 16; }
+    [[nodiscard]] double decimal() const { return std::bit_cast<double>(bits); }
+    [[nodiscard]] double real() const { return decimal(); }
+    [[nodiscard]] Obj* object() const { return reinterpret_cast<Obj*>(bits & PAYLOAD); }
+
+    [[nodiscard]] bool isNone() const { return bits == (QNAN | TAG_NONE); }
+    [[nodiscard]] bool isBool() const { return (bits & TAG_MASK) == (QNAN | TAG_BOOL); }
+    [[nodiscard]] bool isInteger() const { return (bits & TAG_MASK) == (QNAN | TAG_INT); }
+    [[nodiscard]] bool isDouble() const { return (bits & QNAN) != QNAN; }
+    // Infinities and NaNs are ordinary doubles here.
+    [[nodiscard]] bool isInf() const { return false; }
+    [[nodiscard]] bool isNaN() const { return false; }
+    [[nodiscard]] bool isObject() const { return (bits & (SIGN | QNAN)) == (SIGN | QNAN); }
+#else
     ValueType type;
 
     union {
@@ -51,10 +151,6 @@ struct Value {
 
     static Value DoubleVal(const double value) { return {ValueType::DOUBLE, {.decimal = value}}; }
 
-    static Value NumberVal(const double value, const bool isDouble) {
-        return isDouble ? DoubleVal(value) : IntegerVal(static_cast<ssize_t>(value));
-    }
-
     static Value Infinity(const bool positive) {
         return {ValueType::INFINITY, {.boolean = positive}};
     }
@@ -69,96 +165,179 @@ struct Value {
         };
     }
 
+    [[nodiscard]] ValueType valueType() const { return type; }
+
+    [[nodiscard]] bool boolean() const { return as.boolean; }
+    [[nodiscard]] ssize_t integer() const { return as.integer; }
+    [[nodiscard]] double decimal() const { return as.decimal; }
+    // Infinities and NaNs hold only their sign, so code typed `double` reads through this.
+    [[nodiscard]] double real() const {
+        if (type == ValueType::DOUBLE) [[likely]] return as.decimal;
+
+        const double special = type == ValueType::INFINITY
+                                   ? std::numeric_limits<double>::infinity()
+                                   : std::numeric_limits<double>::quiet_NaN();
+        return as.boolean ? special : -special;
+    }
+    [[nodiscard]] Obj* object() const { return as.obj; }
+
+    [[nodiscard]] bool isNone() const { return type == ValueType::NONE; }
+    [[nodiscard]] bool isBool() const { return type == ValueType::BOOL; }
+    [[nodiscard]] bool isInteger() const { return type == ValueType::INT; }
+    [[nodiscard]] bool isDouble() const { return type == ValueType::DOUBLE; }
+    [[nodiscard]] bool isInf() const { return type == ValueType::INFINITY; }
+    [[nodiscard]] bool isNaN() const { return type == ValueType::NAN; }
+    [[nodiscard]] bool isObject() const { return type == ValueType::OBJECT; }
+#endif
+
+    // The range of an int, the 48 bits NaN boxing has room for. Arithmetic that leaves it is
+    // an overflow error, so that both layouts agree instead of wrapping differently.
+    static constexpr ssize_t INTEGER_MAX = (ssize_t{1} << 47) - 1;
+    static constexpr ssize_t INTEGER_MIN = -INTEGER_MAX - 1;
+
+    [[nodiscard]] static constexpr bool FitsInteger(const ssize_t value) {
+        return value >= INTEGER_MIN && value <= INTEGER_MAX;
+    }
+
+    // Nothing if the result overflows. Any two ints fit a sum or difference in 64 bits.
+    static std::optional<Value> AddIntegers(const ssize_t a, const ssize_t b) {
+        if (!FitsInteger(a + b)) [[unlikely]] return std::nullopt;
+        return IntegerVal(a + b);
+    }
+
+    static std::optional<Value> SubtractIntegers(const ssize_t a, const ssize_t b) {
+        if (!FitsInteger(a - b)) [[unlikely]] return std::nullopt;
+        return IntegerVal(a - b);
+    }
+
+    static std::optional<Value> MultiplyIntegers(const ssize_t a, const ssize_t b) {
+#if defined(MSVCBUILD)
+        // Only turns away INTEGER_MIN itself among the products that fit.
+        if (a != 0 && std::abs(b) > INTEGER_MAX / std::abs(a)) return std::nullopt;
+        return IntegerVal(a * b);
+#else
+        ssize_t product;
+        if (__builtin_mul_overflow(a, b, &product) || !FitsInteger(product)) [[unlikely]]
+            return std::nullopt;
+        return IntegerVal(product);
+#endif
+    }
+
+    static Value NumberVal(const double value, const bool isDouble) {
+        return isDouble ? DoubleVal(value) : IntegerVal(static_cast<ssize_t>(value));
+    }
+
     static Value ObjectVal(const Value value) {
         if (value.isObject()) return value;
-        return {ValueType::OBJECT, {.obj = value.as.obj}};
+        return ObjectVal(value.object());
     }
 
-
     static Value AsBool(const Value value) {
         return value.isFalsey() ? BoolVal(false) : BoolVal(true);
     }
 
     static Value AsInteger(const Value value) {
         if (value.isInteger()) return value;
-        if (value.isDouble()) return IntegerVal(static_cast<ssize_t>(value.as.decimal));
-        if (value.isBool()) return IntegerVal(value.as.boolean ? 1 : 0);
+        if (value.isDouble()) return IntegerVal(static_cast<ssize_t>(value.decimal()));
+        if (value.isBool()) return IntegerVal(value.boolean() ? 1 : 0);
         return NoneVal();
     }
 
     static Value AsDouble(const Value value) {
         if (value.isDouble()) return value;
-        if (value.isInteger()) return DoubleVal(static_cast<double>(value.as.integer));
-        if (value.isBool()) return DoubleVal(value.as.boolean ? 1 : 0);
+        if (value.isSpecialNumber()) return DoubleVal(value.real());
+        if (value.isInteger()) return DoubleVal(static_cast<double>(value.integer()));
+        if (value.isBool()) return DoubleVal(value.boolean() ? 1 : 0);
         return NoneVal();
     }
 
     static Value AsNumber(const Value value) {
-        if (value.isDouble() || value.isInteger()) return value;
-        if (value.isBool()) return IntegerVal(value.as.boolean ? 1 : 0);
+        if (value.isNumber()) return value;
+        if (value.isBool()) return IntegerVal(value.boolean() ? 1 : 0);
         return NoneVal();
     }
 
-    static Obj* AsObject(const Value value) { return value.as.obj; }
-
-    static const ObjString* ToObjString(const Value value) {
-        switch (value.type) {
-            case ValueType::OBJECT: return Obj::TypeOf(value.as.obj) == ObjType::STRING
-                                               ? value.as.obj->asString()
-                                               : ObjString::Create("<Unprintable Object Type>");
-            case ValueType::INT: return ObjString::Create(std::to_string(value.as.integer));
-            case ValueType::DOUBLE: return ObjString::Create(std::to_string(value.as.decimal));
-            case ValueType::BOOL: return ObjString::Create(value.as.boolean ? "true" : "false");
-            case ValueType::INFINITY: return ObjString::Create(value.as.boolean ? "inf" : "-inf");
-            case ValueType::NAN: return ObjString::Create(value.as.boolean ? "Nan" : "-Nan");
-            case ValueType::NONE: return ObjString::Create("None");
+    static Obj* AsObject(const Value value) { return value.object(); }
+
+    // The helpers that make strings intern them in `vm`.
+    static const ObjString* ToObjString(VM& vm, const Value value) {
+        switch (value.valueType()) {
+            case ValueType::OBJECT: return Obj::TypeOf(value.object()) == ObjType::STRING
+                                               ? value.object()->asString()
+                                               : ObjString::Create(
+                                                   vm, "<Unprintable Object Type>");
+            case ValueType::INT: return ObjString::Create(vm, std::to_string(value.integer()));
+            case ValueType::DOUBLE: return ObjString::Create(
+                    vm, std::to_string(value.decimal()));
+            case ValueType::BOOL: return ObjString::Create(
+                    vm, value.boolean() ? "true" : "false");
+            case ValueType::INFINITY: return ObjString::Create(
+                    vm, value.boolean() ? "inf" : "-inf");
+            case ValueType::NAN: return ObjString::Create(
+                    vm, value.boolean() ? "nan" : "-nan");
+            case ValueType::NONE: return ObjString::Create(vm, "None");
         }
 
         // Unreachable
         return nullptr;
     }
 
-    static Obj* ToObjStringObj(const Value value) {
-        const Value objStringValue = ObjectVal(ToObjString(value));
+    static Obj* ToObjStringObj(VM& vm, const Value value) {
+        const Value objStringValue = ObjectVal(ToObjString(vm, value));
         return AsObject(objStringValue);
     }
 
-    [[nodiscard]] bool isNone() const { return type == ValueType::NONE; }
-    [[nodiscard]] bool isBool() const { return type == ValueType::BOOL; }
-    [[nodiscard]] bool isInteger() const { return type == ValueType::INT; }
-    [[nodiscard]] bool isDouble() const { return type == ValueType::DOUBLE; }
-    [[nodiscard]] bool isInf() const { return type == ValueType::INFINITY; }
-    [[nodiscard]] bool isNaN() const { return type == ValueType::NAN; }
-    [[nodiscard]] bool isNumber() const { return isInteger() || isDouble(); }
+    // Infinities and NaNs count as doubles in either layout, so that both run code alike.
+    [[nodiscard]] bool isNumber() const { return isInteger() || isReal(); }
+    [[nodiscard]] bool isReal() const { return isDouble() || isSpecialNumber(); }
     [[nodiscard]] bool isSpecialNumber() const { return isInf() || isNaN(); }
-    [[nodiscard]] bool isObject() const { return type == ValueType::OBJECT; }
 
     [[nodiscard]] bool isObjectType(const ObjType objectType) const {
-        return isObject() && Obj::TypeOf(as.obj) == objectType;
+        return isObject() && Obj::TypeOf(object()) == objectType;
+    }
+
+    [[nodiscard]] bool isOfStaticType(const StaticType staticType) const {
+        switch (staticType) {
+            case StaticType::UNKNOWN: return true;
+            case StaticType::NONE: return isNone();
+            case StaticType::BOOL: return isBool();
+            case StaticType::INT: return isInteger();
+            case StaticType::DOUBLE: return isReal();
+            case StaticType::STRING: return isObjectType(ObjType::STRING);
+        }
+
+        // Unreachable
+        return false;
     }
 
     [[nodiscard]] bool isFalsey() const {
-        return isNone() || (isBool() && !as.boolean) ||
-            (isObjectType(ObjType::STRING) && as.obj->asString()->str.empty());
+        return isNone() || (isBool() && !boolean()) ||
+            (isObjectType(ObjType::STRING) && object()->asString()->str.empty());
     }
 
     [[nodiscard]] bool isEqualTo(const Value other) const {
-        if ((type == ValueType::DOUBLE && other.type == ValueType::INT) ||
-            (type == ValueType::INT && other.type == ValueType::DOUBLE)) {
-            return ProxEqual<double>(AsDouble(*this).as.decimal, other.as.decimal,
+        if ((valueType() == ValueType::DOUBLE && other.valueType() == ValueType::INT) ||
+            (valueType() == ValueType::INT && other.valueType() == ValueType::DOUBLE)) {
+            return ProxEqual<double>(AsDouble(*this).decimal(), AsDouble(other).decimal(),
                                      DBL_EPSILON);
         }
 
-        if (type != other.type) return false;
+        if (isSpecialNumber() || other.isSpecialNumber()) {
+            return isNumber() && other.isNumber() &&
+                AsDouble(*this).decimal() == AsDouble(other).decimal();
+        }
+
+        if (valueType() != other.valueType()) return false;
 
-        switch (type) {
+        switch (valueType()) {
             case ValueType::NONE: return true;
             case ValueType::INFINITY:
-            case ValueType::BOOL: return as.boolean == other.as.boolean;
-            case ValueType::INT: return as.integer == other.as.integer;
-            case ValueType::DOUBLE: return ProxEqual<double>(
-                    as.decimal, other.as.decimal, DBL_EPSILON);
-            case ValueType::OBJECT: return as.obj == other.as.obj;
+            case ValueType::BOOL: return boolean() == other.boolean();
+            case ValueType::INT: return integer() == other.integer();
+            // Infinities are only equal through ==, as their difference is NaN.
+            case ValueType::DOUBLE: return decimal() == other.decimal() ||
+                ProxEqual<double>(decimal(), other.decimal(), DBL_EPSILON);
+            case ValueType::OBJECT: return object() == other.object();
             case ValueType::NAN: return false;
         }
 
@@ -166,13 +345,15 @@ struct Value {
         return false;
     }
 
-    static Value AddObjects(const Obj* a, const Obj* b) {
+    static Value AddObjects(VM& vm, const Obj* a, const Obj* b) {
         if (Obj::TypeOf(a) != Obj::TypeOf(b)) return NoneVal();
 
         switch (Obj::TypeOf(a)) {
             case ObjType::STRING: return ObjectVal(
-                    ObjString::Create(a->asString()->str + b->asString()->str));
+                    ObjString::Create(vm, a->asString()->str + b->asString()->str));
 
+            case ObjType::FUNCTION:
+            case ObjType::FIBER:
             case ObjType::NONE: return NoneVal();
         }
 
@@ -182,23 +363,23 @@ struct Value {
 
 
     template <typename A, typename B>
-    static Value MultiplyObjects(const A a, const B b) {
+    static Value MultiplyObjects(VM& vm, const A a, const B b) {
         if constexpr (std::is_same_v<A, Obj*> && std::is_same_v<B, Value>) {
             if (b.isNumber()) {
                 std::string str;
-                for (ssize_t i = 0; i < AsInteger(b).as.integer; i
+                for (ssize_t i = 0; i < AsInteger(b).integer(); i
                      ++)
                     str += a->asString()->str;
-                return ObjectVal(ObjString::Create(str));
+                return ObjectVal(ObjString::Create(vm, str));
             }
         }
         else if constexpr (std::is_same_v<A, Value> && std::is_same_v<B, Obj*>) {
             if (a.isNumber()) {
                 std::string str;
-                for (ssize_t i = 0; i < AsInteger(a).as.integer; i
+                for (ssize_t i = 0; i < AsInteger(a).integer(); i
                      ++)
                     str += b->asString()->str;
-                return ObjectVal(ObjString::Create(str));
+                return ObjectVal(ObjString::Create(vm, str));
             }
         }
 
@@ -206,88 +387,97 @@ struct Value {
     }
 
     Value operator/(const Value other) const {
-        if (this->isNumber() && ProxEqual<double>(AsDouble(*this).as.decimal, 0) &&
-            (other.isNumber() && ProxEqual<double>(AsDouble(other).as.decimal, 0)))
+        if (this->isNumber() && ProxEqual<double>(AsDouble(*this).decimal(), 0) &&
+            (other.isNumber() && ProxEqual<double>(AsDouble(other).decimal(), 0)))
             return Nan(false);
 
-        if (other.isNumber() && ProxEqual<double>(AsDouble(other).as.decimal, 0))
+        if (other.isNumber() && ProxEqual<double>(AsDouble(other).decimal(), 0))
             return
-                Infinity(AsDouble(*this).as.decimal > 0);
+                Infinity(AsDouble(*this).decimal() > 0);
 
-        return DoubleVal(AsDouble(*this).as.decimal / AsDouble(other).as.decimal);
+        return DoubleVal(AsDouble(*this).decimal() / AsDouble(other).decimal());
     }
 
-    Value operator*(const Value other) const {
+    [[nodiscard]] Value multiply(VM& vm, const Value other) const {
         if (this->isObject() && other.isNumber())
             return MultiplyObjects(
-                AsObject(*this), AsNumber(other));
+                vm, AsObject(*this), AsNumber(other));
 
 
         if (this->isNumber() && other.isObject())
             return MultiplyObjects(
-                AsNumber(*this), AsObject(other));
+                vm, AsNumber(*this), AsObject(other));
 
 
-        if (this->type == ValueType::DOUBLE || other.type == ValueType::DOUBLE)
+        if (this->isReal() || other.isReal())
             return
-                DoubleVal(AsDouble(*this).as.decimal * AsDouble(other).as.decimal);
+                DoubleVal(AsDouble(*this).decimal() * AsDouble(other).decimal());
 
 
-        return IntegerVal(this->as.integer * other.as.integer);
+        return IntegerVal(this->integer() * other.integer());
     }
 
-    Value operator+(const Value other) const {
-        switch (this->type) {
-            case ValueType::OBJECT: switch (other.type) {
-                    case ValueType::OBJECT: return AddObjects(AsObject(*this), AsObject(other));
+    [[nodiscard]] Value add(VM& vm, const Value other) const {
+        switch (this->valueType()) {
+            case ValueType::OBJECT: switch (other.valueType()) {
+                    case ValueType::OBJECT: return AddObjects(
+                            vm, AsObject(*this), AsObject(other));
 
                     case ValueType::INT:
                     case ValueType::DOUBLE:
                     case ValueType::BOOL:
                     case ValueType::INFINITY:
                     case ValueType::NAN:
-                    case ValueType::NONE: return AddObjects(AsObject(*this), ToObjStringObj(other));
+                    case ValueType::NONE: return AddObjects(
+                            vm, AsObject(*this), ToObjStringObj(vm, other));
                 }
                 break;
 
-            case ValueType::DOUBLE: switch (other.type) {
-                    case ValueType::DOUBLE: return DoubleVal(this->as.decimal + other.as.decimal);
+            case ValueType::DOUBLE: switch (other.valueType()) {
+                    case ValueType::DOUBLE: return DoubleVal(this->decimal() + other.decimal());
                     case ValueType::INT: return DoubleVal(
-                            this->as.decimal + AsDouble(other).as.decimal);
+                            this->decimal() + AsDouble(other).decimal());
                     case ValueType::OBJECT: return AddObjects(
-                            ToObjStringObj(*this), AsObject(other));
-                    case ValueType::INFINITY: return Infinity(this->as.boolean);
-                    case ValueType::NAN: return Nan(this->as.boolean);
-                    case ValueType::BOOL: return DoubleVal(this->as.decimal + other.as.boolean);
+                            vm, ToObjStringObj(vm, *this), AsObject(other));
+                    case ValueType::INFINITY:
+                    case ValueType::NAN: return DoubleVal(
+                            AsDouble(*this).decimal() + other.real());
+                    case ValueType::BOOL: return DoubleVal(this->decimal() + other.boolean());
                     case ValueType::NONE: return NoneVal();
                 }
                 break;
 
-            case ValueType::INT: switch (other.type) {
-                    case ValueType::INT: return IntegerVal(this->as.integer + other.as.integer);
+            case ValueType::INT: switch (other.valueType()) {
+                    case ValueType::INT: return IntegerVal(this->integer() + other.integer());
                     case ValueType::DOUBLE: return DoubleVal(
-                            AsDouble(*this).as.decimal + other.as.decimal);
+                            AsDouble(*this).decimal() + other.decimal());
                     case ValueType::OBJECT: return AddObjects(
-                            ToObjStringObj(*this), AsObject(other));
-                    case ValueType::INFINITY: return Infinity(this->as.boolean);
-                    case ValueType::NAN: return Nan(this->as.boolean);
-                    case ValueType::BOOL: return IntegerVal(this->as.integer + other.as.boolean);
+                            vm, ToObjStringObj(vm, *this), AsObject(other));
+                    case ValueType::INFINITY:
+                    case ValueType::NAN: return DoubleVal(
+                            AsDouble(*this).decimal() + other.real());
+                    case ValueType::BOOL: return IntegerVal(this->integer() + other.boolean());
                     case ValueType::NONE: return NoneVal();
                 }
                 break;
 
-            case ValueType::INFINITY: return Infinity(this->as.boolean);
-
-            case ValueType::NAN: return Nan(this->as.boolean);
+            case ValueType::INFINITY:
+            case ValueType::NAN: switch (other.valueType()) {
+                    case ValueType::OBJECT: return AddObjects(
+                            vm, ToObjStringObj(vm, *this), AsObject(other));
+                    case ValueType::NONE: return NoneVal();
+                    default: return DoubleVal(this->real() + AsDouble(other).decimal());
+                }
 
-            case ValueType::BOOL: switch (other.type) {
-                    case ValueType::BOOL: return BoolVal(this->as.boolean || other.as.boolean);
-                    case ValueType::INT: return IntegerVal(this->as.boolean + other.as.integer);
-                    case ValueType::DOUBLE: return DoubleVal(this->as.boolean + other.as.decimal);
+            case ValueType::BOOL: switch (other.valueType()) {
+                    case ValueType::BOOL: return BoolVal(this->boolean() || other.boolean());
+                    case ValueType::INT: return IntegerVal(this->boolean() + other.integer());
+                    case ValueType::DOUBLE: return DoubleVal(this->boolean() + other.decimal());
                     case ValueType::OBJECT: return AddObjects(
-                            ToObjStringObj(*this), AsObject(other));
-                    case ValueType::INFINITY: return Infinity(this->as.boolean);
-                    case ValueType::NAN: return Nan(this->as.boolean);
+                            vm, ToObjStringObj(vm, *this), AsObject(other));
+                    case ValueType::INFINITY:
+                    case ValueType::NAN: return DoubleVal(
+                            AsDouble(*this).decimal() + other.real());
                     case ValueType::NONE: return NoneVal();
                 }
                 break;
@@ -300,7 +490,7 @@ struct Value {
     }
 
     Value operator%(const Value other) const {
-        return DoubleVal(fmod(AsDouble(*this).as.decimal, AsDouble(other).as.decimal));
+        return DoubleVal(fmod(AsDouble(*this).decimal(), AsDouble(other).decimal()));
     }
 
     Value operator==(const Value other) const { return BoolVal(isEqualTo(other)); }
@@ -308,84 +498,84 @@ struct Value {
     Value operator!=(const Value other) const { return BoolVal(!isEqualTo(other)); }
 
     bool operator>(const Value other) const {
-        if (this->type == ValueType::DOUBLE || other.type == ValueType::DOUBLE)
+        if (this->isReal() || other.isReal())
             return
-                AsDouble(*this).as.decimal > AsDouble(other).as.decimal;
+                AsDouble(*this).decimal() > AsDouble(other).decimal();
 
-        if (this->type == ValueType::INT && other.type == ValueType::INT)
+        if (this->valueType() == ValueType::INT && other.valueType() == ValueType::INT)
             return
-                AsInteger(*this).as.integer > AsInteger(other).as.integer;
+                AsInteger(*this).integer() > AsInteger(other).integer();
 
         return false;
     }
 
     bool operator<(const Value other) const {
-        if (this->type == ValueType::DOUBLE || other.type == ValueType::DOUBLE)
+        if (this->isReal() || other.isReal())
             return
-                AsDouble(*this).as.decimal < AsDouble(other).as.decimal;
+                AsDouble(*this).decimal() < AsDouble(other).decimal();
 
-        if (this->type == ValueType::INT && other.type == ValueType::INT)
+        if (this->valueType() == ValueType::INT && other.valueType() == ValueType::INT)
             return
-                AsInteger(*this).as.integer < AsInteger(other).as.integer;
+                AsInteger(*this).integer() < AsInteger(other).integer();
 
         return false;
     }
 
     bool operator>=(const Value other) const {
-        if (this->type == ValueType::DOUBLE || other.type == ValueType::DOUBLE)
+        if (this->isReal() || other.isReal())
             return
-                AsDouble(*this).as.decimal >= AsDouble(other).as.decimal;
+                AsDouble(*this).decimal() >= AsDouble(other).decimal();
 
-        if (this->type == ValueType::INT && other.type == ValueType::INT)
+        if (this->valueType() == ValueType::INT && other.valueType() == ValueType::INT)
             return
-                AsInteger(*this).as.integer >= AsInteger(other).as.integer;
+                AsInteger(*this).integer() >= AsInteger(other).integer();
 
         return false;
     }
 
     bool operator<=(const Value other) const {
-        if (this->type == ValueType::DOUBLE || other.type == ValueType::DOUBLE)
+        if (this->isReal() || other.isReal())
             return
-                AsDouble(*this).as.decimal <= AsDouble(other).as.decimal;
+                AsDouble(*this).decimal() <= AsDouble(other).decimal();
 
-        if (this->type == ValueType::INT && other.type == ValueType::INT)
+        if (this->valueType() == ValueType::INT && other.valueType() == ValueType::INT)
             return
-                AsInteger(*this).as.integer <= AsInteger(other).as.integer;
+                AsInteger(*this).integer() <= AsInteger(other).integer();
 
         return false;
     }
 
     Value operator<<(const Value other) const {
-        if (other.type == ValueType::INT && type == ValueType::INT)
+        if (other.valueType() == ValueType::INT && valueType() == ValueType::INT)
             return IntegerVal(
-                as.integer << other.as.integer);
+                integer() << other.integer());
 
         return NoneVal();
     }
 
     Value operator>>(const Value other) const {
-        if (other.type == ValueType::INT && type == ValueType::INT)
+        if (other.valueType() == ValueType::INT && valueType() == ValueType::INT)
             return IntegerVal(
-                as.integer >> other.as.integer);
+                integer() >> other.integer());
 
         return NoneVal();
     }
 
     std::ostream& operator<<(std::ostream& os) const {
-        switch (type) {
+        switch (valueType()) {
             case ValueType::NONE: os << 0 << 0x0;
                 break;
-            case ValueType::BOOL: os << std::string(as.boolean ? "true" : "false");
+            case ValueType::BOOL: os << std::string(boolean() ? "true" : "false");
                 break;
-            case ValueType::INT: os << std::to_string(as.integer);
+            case ValueType::INT: os << std::to_string(integer());
                 break;
-            case ValueType::DOUBLE: os << std::to_string(as.decimal);
+            case ValueType::DOUBLE: os << std::to_string(decimal());
                 break;
-            case ValueType::INFINITY: os << std::string(as.boolean ? "inf" : "-inf");
+            case ValueType::INFINITY: os << std::string(boolean() ? "inf" : "-inf");
                 break;
-            case ValueType::NAN: os << std::string(as.boolean ? "Nan" : "-Nan");
+            case ValueType::NAN: os << std::string(boolean() ? "nan" : "-nan");
                 break;
-            case ValueType::OBJECT: as.obj->operator<<(os);
+            case ValueType::OBJECT: object()->operator<<(os);
                 break;
         }
 
@@ -393,5 +583,9 @@ struct Value {
     }
 };
 
+#if defined(NAN_BOXING)
+static_assert(sizeof(Value) == 8);
+#endif
+
 
 #endif  // VALUE_HPP
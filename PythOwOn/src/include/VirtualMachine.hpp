@@ -2,34 +2,113 @@
 #define VM_HPP
 
 #include <algorithm>
-#include <functional>
+#include <array>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "Chunk.hpp"
 #include "Common.hpp"
+#include "Jit.hpp"
 #include "Object.hpp"
+#include "Profiler.hpp"
+#include "Trace.hpp"
 #include "Value.hpp"
 #include "Utils/LinkedList.hpp"
 #include "Utils/Stack.hpp"
 
 
+// An active function call. `ip` is only written back when another call is made on
+// top of this one; `base` is an index since the value stack may reallocate.
+struct CallFrame {
+    const ObjFunction* function; // nullptr for the top-level script
+    Chunk* chunk; // not const: Run quickens its code in place
+    uint8_t* ip;
+    size_t base; // stack index of the frame's slot 0
+};
+
+// The stack and frames of a line of execution that isn't running: the script's while a
+// fiber runs, or a fiber's while it doesn't. The innermost frame's `ip` is up to date.
+struct ExecutionContext {
+    Stack<Value> stack;
+    std::vector<CallFrame> frames; // a fiber's grow as its calls need them
+    uint32_t frameCount = 0;
+};
+
+// A call that runs on a stack of its own, once something resumes it. A yield suspends it
+// where it is, to carry on from there when it is next resumed, until its function returns.
+// While it runs, the VM's state holds its stack and frames.
+struct ObjFiber {
+    enum class Status : uint8_t {
+        SUSPENDED, // not started yet, or stopped at a yield
+        RUNNING,   // running, or waiting for a fiber it resumed
+        DONE,      // returned, or stopped by a runtime error
+    };
+
+    Obj object;
+    Status status;
+    const ObjFunction* function;
+    ObjFiber* resumer; // who to go back to; nullptr for the script
+    ExecutionContext context;
+
+    // A fiber for the call at `call`: the callee, a compiled function, then its arguments.
+    // Its stack has just the room the function's frame needs.
+    static ObjFiber* Create(VM& vm, const Value* call, uint8_t argCount);
+};
+
 class VM {
 public:
+    static constexpr uint32_t FRAMES_MAX = 1024;
+    static constexpr uint32_t FIBER_FRAMES = 4; // a fiber's frames to begin with
+    static constexpr uint64_t UNLIMITED_FUEL = UINT64_MAX;
+
     struct State {
         Chunk chunk;
         uint8_t* ip;
+        std::vector<CallFrame> frames; // FRAMES_MAX of them for the script
+        uint32_t frameCount;
+        CallFrame* frame; // the innermost frame
         Stack<Value> stack;
-        std::unordered_set<ObjString> strings;
+        // The fiber whose stack and frames the ones above are, or nullptr for the script,
+        // whose own are then kept in `script`.
+        ObjFiber* fiber;
+        ExecutionContext script;
+        // The most slots a frame of the script, or of any function, uses. The stack has
+        // room for the script's frame and FRAMES_MAX function frames on top of it.
+        uint32_t scriptDepth;
+        uint32_t functionDepth;
+        // Interned strings, keyed by a view of the ObjString's own text.
+        std::unordered_map<std::string_view, const ObjString*> strings;
         std::unordered_map<ObjString, Value> globals;
         LinkedList::Single<Obj*> objects;
+
+        // How many more loop iterations and calls Run may make before it stops with
+        // OUT_OF_FUEL, ready to carry on from there when called again with more. Loops
+        // compiled by the JIT don't use any.
+        uint64_t fuel;
+
+        // Per-offset JUMP_FALSE counts for each chunk, only gathered for --profile-out runs.
+        bool profileBranches;
+        std::unordered_map<const Chunk*, std::vector<BranchCounts>> branchCounts;
+
+        // Times every instruction run, only set for --profile runs.
+        std::unique_ptr<Profiler> profiler;
+        // Keeps the last instructions run, only set for --trace runs.
+        std::unique_ptr<Trace> trace;
+
+#if defined(HAS_JIT)
+        // Compiles hot loops when running with --jit, and owns their code.
+        std::unique_ptr<Jit> jit;
+#endif
     };
 
-    static State VMstate;
+    // Everything an interpreter owns. Nothing is shared between VMs, so each thread can
+    // run one of its own.
+    State state;
 
     VM() { InitVM(); }
     ~VM() { ShutdownVM(); }
@@ -39,101 +118,78 @@ public:
     VM(VM&&) = delete;
     VM& operator=(VM&&) = delete;
 
-    static void InitVM();
-    static void ShutdownVM();
-
-    static uint8_t ReadByte() { return *VMstate.ip++; }
-
-    static uint16_t ReadShort() {
-        uint16_t value = static_cast<uint16_t>(ReadByte() << 8);
-        value |= ReadByte();
-        return value;
-    }
-
-    static uint32_t ReadLong() {
-        uint32_t value = ReadByte() << 24;
-        value |= ReadByte() << 16;
-        value |= ReadByte() << 8;
-        value |= ReadByte();
-        return value;
-    }
-
-    static Value ReadConstant() { return VMstate.chunk.constants[ReadByte()]; }
-    static Value ReadConstantLong() { return VMstate.chunk.constants[ReadLong()]; }
+    void InitVM();
+    void ShutdownVM();
+    // Frees what the last script left behind but keeps the stack and the tables' storage,
+    // so the next script run on this VM starts with a warm heap.
+    void Reset();
+    void FreeObjects();
 
     template <typename O>
-    static O* NewObject(const ObjType type) {
+    O* NewObject(const ObjType type) {
         auto* object = reinterpret_cast<Obj*>(new O());
         object->type = type;
 
-        VMstate.objects.push(object);
+        state.objects.push(object);
 
         return reinterpret_cast<O*>(object);
     }
 
-    static void AddString(const ObjString* string) { VMstate.strings.emplace(*string); }
+    void AddString(const ObjString* string) {
+        state.strings.emplace(string->str, string);
+    }
+
+    bool HasString(const ObjString* string) {
+        return state.strings.contains(string->str);
+    }
 
-    static bool HasString(const ObjString* string) { return VMstate.strings.contains(*string); }
+    bool HasString(const std::string& string) { return state.strings.contains(string); }
 
-    static bool HasString(const std::string& string) {
-        return std::ranges::any_of(VMstate.strings, [&string](const auto& objStr) {
-            return objStr.str == string;
-        });
+    const ObjString* GetString(const std::string& string) {
+        const auto found = state.strings.find(string);
+        return found != state.strings.end() ? found->second : nullptr;
     }
 
-    static const ObjString* GetString(const std::string& string) {
-        for (const auto& objStr : VMstate.strings) { if (objStr.str == string) return &objStr; }
-        return nullptr;
+    void DefineGlobal(const ObjString* name, const Value& value) {
+        state.globals[*name] = value;
     }
 
-    static void DefineGlobal(const ObjString* name, const Value& value) {
-        VMstate.globals[*name] = value;
+    bool HasGlobal(const std::string& name) {
+        const ObjString* string = GetString(name);
+        return string && state.globals.contains(*string);
     }
 
-    static void SetChunk(Chunk chunk);
-    static InterpretResult Run();
+    void SetChunk(Chunk chunk);
+    void ReserveStack(uint32_t scriptDepth, uint32_t functionDepth);
+    // Moves the stack into one with room for `capacity` values, keeping what is on it.
+    // Pointers into the old one, Run's copy of the top included, are left dangling.
+    void GrowStack(size_t capacity);
+    // Runs the chunk set, or carries on with it after OUT_OF_FUEL.
+    InterpretResult Run();
+    // A tail call replaces the current frame instead of pushing a new one. A call can
+    // allocate: a frame that doesn't fit grows the stack, and a fiber's frames grow too, so
+    // pointers into either have to be derived again afterwards.
+    InterpretResult CallValue(Value callee, uint8_t argCount, bool tailCall = false);
+    // Replaces the callee and its arguments with a fiber that makes the call when resumed.
+    InterpretResult NewFiber(Value callee, uint8_t argCount);
+    // Pops the fiber and runs it, until it leaves the value it yields or returns in its place.
+    InterpretResult Resume(Value target);
+    // Goes back to the running fiber's resumer, handing it `value`.
+    void LeaveFiber(ObjFiber::Status status, Value value);
+    // Makes `fiber`, or the script if nullptr, the line of execution that Run carries on.
+    void SwitchTo(ObjFiber* fiber);
+    void RecordBranch(bool taken);
+    // Hands the current frame's instruction at `instruction`, about to run with the stack
+    // up to `top`, to the profiler and the trace, whichever are on.
+    void ObserveInstruction(const uint8_t* instruction, const Value* top);
+#if defined(HAS_JIT)
+    // Compiles the loop closed by the current frame's LOOP at `loopOffset`, reached with
+    // `depth` values in the frame, and turns that LOOP into a LOOP_JIT.
+    bool CompileLoop(size_t loopOffset, int32_t depth);
+#endif
 
     template <AllPrintable... Ts>
-    static void RuntimeError(const std::string& message, Ts... args);
-
-    /// <summary>
-    /// Performs a binary operation on the stack.
-    /// verifierFn is a function that checks if the top two values of the stack are
-    /// valid for the operation.
-    /// </summary>
-    /// <typeparam name="Op">The binary operation to do.</typeparam>
-    /// <param name="verifyFn">A function to verify that the stack contains values valid
-    /// for the specified binary operation.</param>
-    /// <returns>RUNTIME_ERROR if an error occurred, otherwise nullopt.</returns>
-    template <typename Op>
-    static std::optional<InterpretResult> BinaryOp(
-        const std::function<InterpretResult()>& verifyFn) {
-        if (verifyFn() != InterpretResult::OK) return InterpretResult::RUNTIME_ERROR;
-
-        Value b = VMstate.stack.pop();
-        Value a = VMstate.stack.pop();
-
-        if constexpr (auto val = Op{}(a, b); std::is_same_v<
-            decltype(val), bool>) { VMstate.stack.push(Value::BoolVal(val)); }
-        else if
-        constexpr (std::is_same_v<decltype(val), std::string>) {
-            VMstate.stack.push(Value::ObjectVal(ObjString::Create(val)));
-        }
-        else if constexpr (std::is_same_v<decltype(val), Obj*>) {
-            VMstate.stack.push(Value::ObjectVal(val));
-        }
-        else if constexpr (std::is_same_v<decltype(val), Value>) { VMstate.stack.push(val); }
-        else { FMT_PRINT("Unknown type, type was {}.\n", typeid(val).name()); }
-
-        return std::nullopt;
-    }
-
-private:
-    static InterpretResult DigitChecker();
-    static InterpretResult IntegerChecker();
-    static InterpretResult StringChecker();
-    static InterpretResult AddableChecker();
-    static InterpretResult MultiplicableChecker();
+    void RuntimeError(const std::string& message, Ts... args);
 };
 
 #endif
@@ -0,0 +1,40 @@
+
+"neg"
+501
+== profile: 26547 instructions,
+ADD 3
+ADD_INT_INT 998
+CALL 501
+CONSTANT 5011
+DEF_GLOBAL 2
+EQUAL 2000
+FOR_RANGE 1001
+GET_GLOBAL 6
+GET_GLOBAL_CACHED 1497
+GET_LOCAL 3503
+GREATER 1
+GREATER_INT 1
+GREATER_INT_INT 499
+JUMP 503
+JUMP_FALSE 3003
+LESS 2
+LESS_INT_INT 500
+LOOP 1000
+MODULO 1000
+NEGATE 2
+NONE 1
+POP 4008
+PRINT 2
+RETURN 502
+SET_GLOBAL 1001
+line 10 runs 1004
+line 11 runs 2
+line 12 runs 1
+line 2 runs 2516
+line 3 runs 2500
+line 4 runs 1000
+line 5 runs 2
+line 6 runs 2
+line 7 runs 1005
+line 8 runs 5015
+line 9 runs 13500
@@ -0,0 +1,131 @@
+#!/usr/bin/env bash
+# Runs the test scripts with a PythOwOn binary, and compares what each prints, and its exit
+# status, with the .expected file next to it. Use a Release or Debug build; the same
+# expectations hold with and without NaN-boxing.
+#
+# usage: run.sh binary [runtime-library]
+#
+#   scripts/  run from source, compiled to .powon and run again, and checked with
+#             --jit-check where the build has a JIT. Given the PythOwOnRuntime library
+#             of the same build, each is also translated with --emit-cpp, built, and run.
+#   fibers/   as scripts/, except for --emit-cpp, whose programs can't run fibers.
+#   corrupt/  damaged .powon files the loader has to reject, made from valid.pwn, and
+#             hand-made ones it has to run safely.
+#   profile/  --profile-out counts, which --profile-use with --profile-out has to write
+#             back unchanged, and the counts in --profile's report.
+#   trace/    scripts that fail with --trace on, and the --trace-decode of the trace.
+#
+# Programs from --emit-cpp are built with $CXX (default g++), the flags in $AOT_CXXFLAGS
+# on top of the include directories, and the libraries in $AOT_LIBS (default -lfmt
+# -lpthread). A NaN-boxed library needs -DNAN_BOXING in $AOT_CXXFLAGS.
+
+set -uo pipefail
+
+if [[ $# -lt 1 || $# -gt 2 ]]; then
+    echo "usage: $0 binary [runtime-library]" >&2
+    exit 1
+fi
+
+binary=$(realpath "$1")
+runtime=${2:+$(realpath "$2")}
+here=$(cd "$(dirname "$0")" && pwd)
+src=$(cd "$here/../src" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+passed=0
+failed=0
+
+# Output and exit status of a command, with trailing spaces dropped.
+run() {
+    local output status
+    output=$(timeout 60 "$@" 2>&1)
+    status=$?
+    printf '%s\nexit %d\n' "$output" "$status" | sed 's/[[:space:]]*$//'
+}
+
+# check <what> <expected file> <actual output>
+check() {
+    if diff -u <(sed 's/[[:space:]]*$//' "$2") <(printf '%s\n' "$3") > "$work/diff"; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL $1"
+        head -n 20 "$work/diff"
+    fi
+}
+
+hasJit=false
+if "$binary" --help | grep -q -- --jit-check; then hasJit=true; fi
+
+runScripts() {
+    local dir=$1 emitCpp=$2
+    cd "$here/$dir" || exit 1
+
+    for script in *.pwn; do
+        local name=${script%.pwn}
+        local expected=$name.expected
+        check "$dir/$script" "$expected" "$(run "$binary" -r "$script")"
+
+        # A script that doesn't compile has nothing more to run.
+        if grep -q '^exit 65$' "$expected"; then continue; fi
+
+        "$binary" -c "$script" -o "$work/$name.powon" > /dev/null
+        check "$dir/$script (compiled)" "$expected" "$(run "$binary" -r "$work/$name.powon")"
+
+        if $hasJit; then
+            check "$dir/$script (--jit-check)" <(printf '%s: the JIT agrees with the interpreter.\nexit 0\n' "$script") \
+                "$(run "$binary" --jit-check "$script" | tail -n 2)"
+        fi
+
+        if $emitCpp && [[ -n "$runtime" ]]; then
+            if ! "$binary" --emit-cpp "$work/$name.cpp" "$script" > /dev/null ||
+               ! ${CXX:-g++} -std=c++20 -O1 -DGCCBUILD ${AOT_CXXFLAGS:-} -I"$src/include" \
+                   -I"$src/../vendor/fmt/include" "$work/$name.cpp" "$runtime" \
+                   ${AOT_LIBS:--lfmt -lpthread} -o "$work/$name" 2> "$work/$name.log"; then
+                failed=$((failed + 1))
+                echo "FAIL $dir/$script (--emit-cpp): could not build the program"
+                head -n 20 "$work/$name.log"
+                continue
+            fi
+            check "$dir/$script (--emit-cpp)" "$expected" "$(run "$work/$name")"
+        fi
+    done
+}
+
+runScripts scripts true
+runScripts fibers false
+
+cd "$here/corrupt" || exit 1
+for file in *.powon; do
+    check "corrupt/$file" "${file%.powon}.expected" "$(run "$binary" -r "$file")"
+done
+
+cd "$here/profile" || exit 1
+for script in *.pwn; do
+    name=${script%.pwn}
+    "$binary" -r "$script" --profile-out "$work/$name.prof" > /dev/null
+    check "profile/$script (--profile-out)" "$name.prof" "$(cat "$work/$name.prof")"
+
+    "$binary" -r "$script" --profile-use "$name.prof" --profile-out "$work/$name.again" > /dev/null
+    check "profile/$script (--profile-use)" "$name.prof" "$(cat "$work/$name.again")"
+
+    # Only the counts are kept from the report, as the cycles differ from run to run.
+    report=$("$binary" -r "$script" --profile 2>&1 | awk '
+        /^== profile:/ { print $1, $2, $3, $4; section = "lines"; next }
+        /^ *line / || /^opcode / { if (/^opcode/) section = "opcodes"; next }
+        section == "lines" && NF >= 4 { print "line", $1, "runs", $4; next }
+        section == "opcodes" && NF >= 2 { print $1, $2; next }
+        section == "" { print }' | sort)
+    check "profile/$script (--profile)" "$name.profile" "$report"
+done
+
+cd "$here/trace" || exit 1
+for script in *.pwn; do
+    name=${script%.pwn}
+    "$binary" -r "$script" --trace "$work/$name.trace" > /dev/null
+    check "trace/$script" "$name.expected" "$(run "$binary" --trace-decode "$work/$name.trace" "$script")"
+done
+
+echo "$passed passed, $failed failed"
+[[ $failed -eq 0 ]]
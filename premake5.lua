@@ -9,6 +9,11 @@ workspace "PythOwOn"
 
 outputDir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 
+newoption {
+    trigger = "nan-boxing",
+    description = "Pack values into 8 bytes by storing them inside NaN doubles"
+}
+
 includeDirs = {}
 includeDirs["fmt"] = "PythOwOn/vendor/fmt/include"
 includeDirs["cxxopts"] = "PythOwOn/vendor/cxxopts"
@@ -17,58 +22,38 @@ group "Dependencies"
     include "PythOwOn/vendor/fmt"
 
 
-group ""
-project "PythOwOn"
+-- What the interpreter and its runtime library are both built with.
+function pythowonSettings()
     location "PythOwOn"
-    kind "ConsoleApp"
     staticruntime "on"
     systemversion "latest"
     language "C++"
     cppdialect "C++20"
 
-    targetdir ("../bin/" .. outputDir .. "/")
-	objdir ("bin/intermediate/" .. outputDir .. "/")
-
-    
     externalanglebrackets "on"
     externalwarnings "off"
 
     targetdir ("bin/" .. outputDir)
-    objdir ("bin/intermediate/" .. outputDir)
-
-    files {
-        "%{prj.name}/src/include/**.hpp",
-        "%{prj.name}/src/cpp/**.cpp",
-
-    }
+    objdir ("bin/intermediate/" .. outputDir .. "/%{prj.name}")
 
     includedirs { 
-        "%{prj.name}/src/include/",
+        "PythOwOn/src/include/",
         "%{includeDirs.fmt}",
         "%{includeDirs.cxxopts}"
     }
 
-    links {
-        "fmt"
-    }
-
-  --  prebuildcommands {
-   --         "{DEL} ../bin/" .. outputDir .. "/%{cfg.buildtarget.name}",
-  --          "{RMDIR} ../bin/",
-  --  }
-
-  --  postbuildcommands {
- --           "{MKDIR} ../bin/" .. outputDir .. "/",
-  --          "{COPYFILE} %{cfg.buildtarget.relpath} ../bin/" .. outputDir .. "/",
-  --  }
-
     filter "system:linux"
         pic "on"
-        --    links {}
         defines { "GCCBUILD" }
 
+    -- Stops GCC from merging the per-handler dispatch jumps of VM::Run back into one.
+    filter { "system:linux", "files:**/VirtualMachine.cpp" }
+        buildoptions { "-fno-gcse", "-fno-crossjumping" }
+
+    filter "options:nan-boxing"
+        defines { "NAN_BOXING" }
+
     filter "system:windows"
-        --   links {}
         defines { "MSVCBUILD" }
 
     filter "toolset:msc*"
@@ -91,3 +76,49 @@ project "PythOwOn"
         defines { "_RELEASE" }
         runtime "Release"
         optimize "on"
+
+    filter {}
+end
+
+group ""
+-- Everything but the command line, for the C++ programs --emit-cpp writes to link against.
+project "PythOwOnRuntime"
+    kind "StaticLib"
+    pythowonSettings()
+
+    files {
+        "PythOwOn/src/include/**.hpp",
+        "PythOwOn/src/cpp/**.cpp",
+    }
+
+    removefiles {
+        "PythOwOn/src/cpp/PythOwOn.cpp",
+        "PythOwOn/src/cpp/CppEmitter.cpp",
+    }
+
+project "PythOwOn"
+    kind "ConsoleApp"
+    pythowonSettings()
+
+    files {
+        "PythOwOn/src/cpp/PythOwOn.cpp",
+        "PythOwOn/src/cpp/CppEmitter.cpp",
+    }
+
+    links {
+        "PythOwOnRuntime",
+        "fmt"
+    }
+
+  --  prebuildcommands {
+   --         "{DEL} ../bin/" .. outputDir .. "/%{cfg.buildtarget.name}",
+  --          "{RMDIR} ../bin/",
+  --  }
+
+  --  postbuildcommands {
+ --           "{MKDIR} ../bin/" .. outputDir .. "/",
+  --          "{COPYFILE} %{cfg.buildtarget.relpath} ../bin/" .. outputDir .. "/",
+  --  }
+
+    filter "system:linux"
+        links { "pthread" }